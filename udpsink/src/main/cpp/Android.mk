@@ -3,9 +3,9 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 LOCAL_CFLAGS := -DGST_USE_UNSTABLE_API
 LOCAL_MODULE    := android_camera
-LOCAL_SRC_FILES := android_camera.c
+LOCAL_SRC_FILES := android_camera.c gstspscqueue.c stream_logic.c
 LOCAL_SHARED_LIBRARIES := gstreamer_android
-LOCAL_LDLIBS := -landroid -llog
+LOCAL_LDLIBS := -landroid -llog -lm
 include $(BUILD_SHARED_LIBRARY)
 
 APP_PLATFORM := android-6
@@ -32,6 +32,9 @@ endif
 
 GSTREAMER_NDK_BUILD_PATH  := $(GSTREAMER_ROOT)/share/gst-android/ndk-build
 include $(GSTREAMER_NDK_BUILD_PATH)/plugins.mk
-GSTREAMER_PLUGINS         := $(GSTREAMER_PLUGINS_CORE) $(GSTREAMER_PLUGINS_ENCODING) androidmedia videofilter openh264 flac opensles opengl $(GSTREAMER_PLUGINS_NET)
-GSTREAMER_EXTRA_DEPS      := gstreamer-video-1.0 gstreamer-player-1.0 gio-2.0 glib-2.0
+GSTREAMER_PLUGINS         := $(GSTREAMER_PLUGINS_CORE) $(GSTREAMER_PLUGINS_ENCODING) androidmedia videofilter compositor openh264 vpx jpeg flac opensles opengl $(GSTREAMER_PLUGINS_NET)
+# x265, svtav1 and rav1e aren't part of the stock GStreamer Android binaries, list them
+# in GSTREAMER_EXTRA_PLUGINS (e.g. "x265 svtav1") when your build provides them
+GSTREAMER_PLUGINS         += $(GSTREAMER_EXTRA_PLUGINS)
+GSTREAMER_EXTRA_DEPS      := gstreamer-video-1.0 gstreamer-rtp-1.0 gstreamer-net-1.0 gstreamer-player-1.0 gio-2.0 glib-2.0
 include $(GSTREAMER_NDK_BUILD_PATH)/gstreamer-1.0.mk
@@ -23,14 +23,37 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <jni.h>
 #include <android/native_window.h>
 #include <android/native_window_jni.h>
 #include <gst/gst.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <linux/errqueue.h>
+#include <glib/gstdio.h>
+#include <gst/video/video.h>
 #include <gst/video/videooverlay.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/rtp/gstrtcpbuffer.h>
+#include <gst/net/gstnet.h>
 #include <gst/interfaces/photography.h>
 #include <jmorecfg.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "gstspscqueue.h"
+#include "stream_logic.h"
 
 GST_DEBUG_CATEGORY_STATIC (debug_category);
 #define GST_CAT_DEFAULT debug_category
@@ -54,22 +77,43 @@ typedef struct _GstAhc
   GMainLoop *main_loop;
   ANativeWindow *native_window;
   gboolean state;
-  GstElement *ahcsrc, *filter, *tee, *queue_preview, *vsink;
+  GstElement *ahcsrc, *selector, *filter, *tee, *queue_preview, *vsink;
   gboolean initialized;
   GstPad *tee_src_1, *pad_preview;
 } GstAhc;
 
+/* upper bound of elements in the streaming branch */
+#define BRANCH_MAX_ELEMENTS PLANNER_MAX_ELEMENTS
+
 struct PipelineBranch{
-    GstElement *queue_udp, *rotation, *videoconvert, *encoder, *rtp, *udpsink;
+    GstElement *queue_udp, *videorate, *ratefilter, *crop, *crop_scale, *crop_filter, *rotation, *compositor, *videoconvert, *encoder, *queue_send, *rtp, *fec, *rtx, *srtp, *session, *funnel, *fanout_tee, *udpsink;
+    /* RTCP coming back on the bundle socket */
+    GstElement *rtcp_source;
+    /* source of the picture-in-picture inset, linked into the compositor next to the camera */
+    GstElement *inset_source, *inset_scale, *inset_filter;
+    /* queues inserted by the thread planner, stage_queue[i] follows stage_after[i] */
+    GstElement *stage_after[BRANCH_MAX_ELEMENTS], *stage_queue[BRANCH_MAX_ELEMENTS];
+    guint stages;
     GstPad *tee_src_2, *pad_udp;
 };
 
 struct PipelineBranch my_branch;
 struct PipelineBranch *branch = &my_branch;
 
+/* side branch of the tee sending a small JPEG every few seconds */
+struct PipelineSnapshot{
+    GstElement *queue, *scale, *filter, *encoder, *udpsink, *filesink;
+    GstPad *tee_src, *pad_queue;
+};
+
+struct PipelineSnapshot my_snapshot;
+struct PipelineSnapshot *snapshot = &my_snapshot;
+
 struct PipelineAudio{
     GstElement *pipeline;
     GstElement *source, *queue, *capsfilter, *convert, *resample, *encoder, *udpsink;
+    /* only when bundled with the video; rtcp_source passes the session the receiver's RTCP about the audio */
+    GstElement *rtp, *session, *funnel, *rtcp_source;
 };
 
 struct PipelineAudio my_audio;
@@ -84,7 +128,479 @@ static jmethodID on_state_changed_method_id;
 static jmethodID set_message_method_id;
 static jmethodID on_gstreamer_initialized_method_id;
 char rotation_angle = 0;
-boolean pak = FALSE;
+/* the streaming branch follows rotation_angle, also while it runs */
+gboolean stream_autorotation = FALSE;
+/* camera frame size of the running stream */
+int stream_width = 0, stream_height = 0;
+
+/* digital zoom: the camera captures at the capture size, the streaming branch crops the region of interest out of it
+ * and scales the region to the stream size; the region can move while streaming, the camera and encoder caps stay */
+int zoom_capture_width = 0, zoom_capture_height = 0;
+/* requested region, see struct Roi */
+struct Roi roi;
+/* what the camera delivers to the running stream, the capture size with digital zoom, else the stream size */
+int capture_width = 0, capture_height = 0;
+
+/* video codec used by the streaming branch, see enum VideoCodec */
+int video_codec = CODEC_H264;
+/* codec of the running stream, video_codec unless its encoder or payloader is missing */
+int stream_codec = CODEC_H264;
+
+/* SRTP protection of the RTP modes, see enum SrtpCipher */
+/* master key + salt, the longest one (AES-256-ICM) is 46 bytes */
+#define SRTP_MAX_KEY_LENGTH 46
+int srtp_cipher = SRTP_NONE;
+guint8 srtp_key[SRTP_MAX_KEY_LENGTH];
+gsize srtp_key_length = 0;
+
+/* multicast destination settings, ignored for unicast addresses */
+int multicast_ttl = 1;
+gboolean multicast_loop = FALSE;
+gchar *multicast_iface = NULL;
+/* ULPFEC overhead in percent for multicast RTP, receivers can't ask for retransmissions */
+int multicast_fec_percentage = 0;
+/* payload type of FEC packets, next to rtph264pay's default of 96 */
+#define FEC_PAYLOAD_TYPE 122
+#define VIDEO_PAYLOAD_TYPE 96
+
+/*
+ * Unequal error protection: video packets are classified by what losing them costs, the class travels with the buffer
+ * as flags (HEADER | NON_DROPPABLE for parameter sets, NON_DROPPABLE for keyframes, DELTA_UNIT for reference frames,
+ * DELTA_UNIT | DROPPABLE for the rest). rtpulpfecenc protects NON_DROPPABLE packets at percentage-important.
+ */
+gboolean unequal_protection = FALSE;
+static const gchar *uep_class_names[UEP_CLASSES] = {"parameter sets", "keyframes", "reference", "non-reference"};
+/* extra copies of each packet, sent UEP_DUPLICATE_SPACING packets apart so a short burst doesn't take all of them */
+static const guint uep_duplicates[UEP_CLASSES] = {2, 1, 0, 0};
+#define UEP_DUPLICATE_SPACING 3
+#define UEP_MAX_PENDING 64
+/* FEC for keyframes and parameter sets, unicast streams get no FEC for the other classes */
+#define UEP_IMPORTANT_PERCENTAGE 50
+
+struct UepCounters {
+    guint64 packets, bytes;
+    guint64 fec_packets, fec_bytes;
+    guint64 duplicate_packets, duplicate_bytes;
+};
+struct UepDuplicate {
+    GstBuffer *buffer;
+    int class;
+    guint64 due;
+};
+struct UnequalProtection {
+    GMutex lock;
+    struct UepCounters counters[UEP_CLASSES];
+    /* class of the frame being classified, for packets that don't carry it themselves */
+    guint32 frame_timestamp;
+    int frame_class;
+    /* highest class sent since the last FEC packet, rtpulpfecenc sends FEC right after the frames it protects */
+    int fec_class;
+    gboolean fec_sent;
+    /* video packets sent, and copies waiting for their turn; only touched by the streaming thread */
+    guint64 sent;
+    GQueue pending;
+    /* copies go straight to udpsink's socket, its sink pad is busy with the packet at hand */
+    GSocket *socket;
+    GSocketAddress *destination;
+};
+struct UnequalProtection uep;
+
+/*
+ * Frame scheduler: encoded frames wait for the socket in queue_send, and when the network stalls they are dropped
+ * as they leave it, by class, instead of being sent late in order: non-reference frames first, then everything up to
+ * the next keyframe, which is requested from the encoder.
+ */
+gboolean frame_scheduler = FALSE;
+#define SCHEDULER_MAX_BACKLOG (2 * GST_SECOND)
+/* the encoder is asked for a keyframe at most this often, in µs */
+#define SCHEDULER_KEYFRAME_INTERVAL G_USEC_PER_SEC
+
+struct FrameScheduler {
+    GMutex lock;
+    /* dropping up to the next keyframe */
+    bool skipping;
+    gint64 requested_at;
+    guint64 sent, dropped_non_reference, dropped_skipping, keyframe_requests;
+    GstClockTime peak_backlog;
+};
+struct FrameScheduler scheduler;
+
+/*
+ * Send-queue congestion control: what the video and audio sockets hold unsent (SIOCOUTQ) grows as soon as the link
+ * slows down, long before any receiver report, and it works without RTP. The encoder bitrate backs off while the
+ * queues hold more than SENDQ_CONGESTED of the stream and creeps back while they are nearly empty.
+ */
+gboolean send_queue_control = FALSE;
+#define SENDQ_INTERVAL (20 * G_TIME_SPAN_MILLISECOND)
+/* a frame sent as a burst of packets fills the queue for a moment even on a good link, so only what stays queued
+ * through a whole window counts: the smallest sample of it, as in CoDel */
+#define SENDQ_WINDOW (200 * G_TIME_SPAN_MILLISECOND)
+
+struct SendQueue {
+    GThread *thread;
+    gint running;
+    /* sinks whose sockets are sampled, attached while they are playing; audio only when it has a socket of its own */
+    GMutex lock;
+    GstElement *video_sink, *audio_sink;
+    GstElement *encoder;
+    /* latest and peak unsent bytes, socket send buffer */
+    gint video_bytes, audio_bytes, video_peak, audio_peak;
+    gint video_buffer, audio_buffer;
+    /* encoder bitrate: configured and applied */
+    gint configured, bitrate;
+    gint64 changed_at, clear_since;
+    gint64 window_start;
+    gint window_min;
+    guint decreases, increases;
+    /* bytes out of the encoder, added by its source pad's probe */
+    gint encoded_bytes;
+    gulong encoded_probe;
+    /* the last change until its output is measured; the restart of an encoder that can't change it while playing */
+    gint verify_bitrate, verify_previous;
+    gint64 verify_bytes;
+    struct EncoderRestart *restart;
+    /* changes confirmed by the encoder's property and output, changes needing a restart, changes not taken */
+    guint confirmed, restarted, unapplied;
+};
+struct SendQueue sendq;
+
+/*
+ * Hybrid protection: with the bundle, the receiver's reports pick how losses are repaired. Retransmissions (RTX,
+ * RFC 4588, asked for by NACKs) cost only what was lost but take a round trip, FEC costs all the time but repairs
+ * at once, and single losses only. Each report decides between RTX only, FEC only or both, and the FEC percentage.
+ */
+gboolean hybrid_protection = FALSE;
+#define RTX_PAYLOAD_TYPE 99
+/* longest run of losses (XR Loss RLE) from which losses count as bursty */
+#define HYBRID_BURST_PACKETS 3
+/* decisions are held at least this long, in µs */
+#define HYBRID_HOLD (2 * G_USEC_PER_SEC)
+#define HYBRID_LOG 8
+
+static const gchar *hybrid_mode_names[] = {"no repair", "RTX only", "FEC only", "RTX and FEC"};
+
+struct HybridDecision {
+    gint64 at;
+    enum HybridMode mode;
+    gint fec_percentage;
+    gint rtt;
+    gdouble loss;
+    guint longest_burst;
+};
+struct HybridProtection {
+    GMutex lock;
+    gint64 started_at;
+    /* smoothed fraction lost, in percent */
+    gdouble loss;
+    struct HybridDecision current;
+    /* the latest decisions, oldest first once the ring has wrapped */
+    struct HybridDecision log[HYBRID_LOG];
+    guint logged;
+    guint64 nacks_dropped;
+};
+struct HybridProtection hybrid;
+
+/*
+ * Fan-out: the stream also goes to extra receivers, each behind its own queue and token bucket, so a slow link is
+ * served at its own rate without holding back the encoder or the other receivers. A receiver falling behind loses
+ * frames by class: non-reference frames first, then everything up to the next keyframe.
+ */
+#define FANOUT_MAX 4
+/* "host:port@kbit/s" separated by commas, a receiver without a rate is not shaped */
+gchar *fanout_destinations = NULL;
+#define FANOUT_MAX_BACKLOG (1 * GST_SECOND)
+#define FANOUT_NON_REFERENCE_BACKLOG (150 * GST_MSECOND)
+#define FANOUT_KEYFRAME_BACKLOG (500 * GST_MSECOND)
+
+struct FanoutDestination {
+    /* held while the receiver's probe decides and paces, so receivers don't wait for each other; kept across streams,
+     * everything from host on is cleared by fanout_parse */
+    GMutex lock;
+    /* wakes the paced sender when the stream stops */
+    GCond cond;
+    gchar host[64];
+    gint port;
+    /* bytes per second, 0 when not shaped */
+    gint64 rate;
+    GstElement *queue, *udpsink;
+    GstPad *tee_src;
+    struct TokenBucket bucket;
+    /* the frame at hand, by RTP timestamp (a count without RTP), and whether its packets are dropped */
+    guint32 frame;
+    gboolean started, frame_dropped, skipping;
+    /* set while the probe pushes the packets of a list one by one, only touched by the queue's thread */
+    gboolean splitting;
+    guint64 packets, bytes, frames_non_reference, frames_skipped, packets_dropped;
+    gint64 started_at, paced_us;
+    GstClockTime peak_backlog;
+};
+struct Fanout {
+    /* guards the list of receivers */
+    GMutex lock;
+    gint running;
+    struct FanoutDestination destinations[FANOUT_MAX];
+    guint count;
+};
+struct Fanout fanout;
+
+/* audio and video on one UDP socket and destination port, told apart by payload type (and SSRC), with RTCP muxed in */
+gboolean rtp_bundle = FALSE;
+/* the socket outlives the streams, so restarting keeps the same source port and NAT binding */
+GSocket *bundle_socket = NULL;
+guint32 bundle_video_ssrc, bundle_audio_ssrc;
+#define BUNDLE_AUDIO_PAYLOAD_TYPE 97
+#define BUNDLE_FLAC_PAYLOAD_TYPE 98
+
+/* what the receiver reports about one of the bundled streams, from RTCP receiver reports and extended reports (RFC 3611) */
+struct ReceiverReport {
+    guint32 ssrc;
+    guint clock_rate;
+    guint reports;
+    /* RR: loss since the previous report in 1/256, cumulative loss, interarrival jitter in timestamp units */
+    guint8 fraction_lost;
+    gint32 cumulative_lost;
+    guint32 jitter;
+    /* from the last sender report the receiver saw, in ms, -1 before the first one */
+    gint rtt;
+    /* XR Loss RLE: packets received and lost over the reported range, longest run of losses */
+    gboolean rle;
+    guint rle_received, rle_lost, rle_longest_burst;
+    /* XR Statistics Summary, jitter in timestamp units */
+    gboolean summary;
+    guint32 summary_lost, summary_dup, summary_jitter_mean, summary_jitter_max;
+    /* XR VoIP Metrics, rates and densities in 1/256, R factor and MOS x10 are 127 when unavailable */
+    gboolean voip;
+    guint8 loss_rate, discard_rate, burst_density, gap_density, r_factor, ext_r_factor, mos_lq, mos_cq;
+    guint16 burst_duration, gap_duration, roundtrip_delay, end_system_delay;
+};
+
+struct ReceiverReports {
+    GMutex lock;
+    struct ReceiverReport video, audio;
+    /* monotonic time of the last RTCP packet from the receiver, reports or not, 0 before the first */
+    gint64 last_rtcp_at;
+    /* appsrc of the audio session while the audio is bundled, its RTCP arrives on the video's udpsrc */
+    GstElement *audio_rtcp;
+};
+struct ReceiverReports receiver_reports;
+
+/* path MTU towards the receiver, probed at stream start; RTP packets, FEC packets and slices are sized to fit it */
+gboolean path_mtu_discovery = TRUE;
+#define PMTU_DEFAULT 1500
+/* probes go to the discard port, they must not end up in the receiver's pipeline */
+#define PMTU_PROBE_PORT 9
+#define PMTU_PROBE_ROUNDS 4
+#define PMTU_PROBE_TIMEOUT_MS 100
+/* the kernel forgets learned path MTUs after 10 minutes, so does the app */
+#define PMTU_REPROBE_INTERVAL (600 * G_USEC_PER_SEC)
+
+struct PathMtu {
+    gchar host[16];
+    gint64 probed_at;
+    /* MTU of the route's interface and what the probes found beyond it */
+    int interface_mtu;
+    int mtu;
+    /* ICMP Fragmentation Needed replies received */
+    int reductions;
+    /* applied to the running stream */
+    int rtp_mtu;
+    int slices;
+};
+struct PathMtu path_mtu;
+
+/* RFC 8285 one-byte header extension carrying the NTP wall-clock capture time of each frame */
+#define ABS_CAPTURE_TIME_ID 3
+#define ABS_CAPTURE_TIME_URI "http://www.webrtc.org/experiments/rtp-hdrext/abs-capture-time"
+gboolean abs_capture_time = TRUE;
+
+/* shared clock the pipelines are slaved to, values match GstAhc.NetClock */
+enum NetClockMode {
+    NET_CLOCK_OFF,
+    /* GstNetTimeProvider on a host, serving its real-time clock */
+    NET_CLOCK_NET,
+    NET_CLOCK_NTP,
+    NET_CLOCK_PTP
+};
+int net_clock_mode = NET_CLOCK_OFF;
+GstClock *net_clock = NULL;
+gchar *net_clock_description = NULL;
+/* pipelines started before the clock was synchronized are restarted on the application's main loop, under this lock
+ * so a stream being stopped waits for a restart in progress */
+GMutex net_clock_lock;
+/* the application's main context, set while its loop runs, for work that can't be done in streaming or worker threads */
+GMutex app_context_lock;
+GMainContext *app_context = NULL;
+
+/* second picture composited into the streamed frame, values match GstAhc.PictureInPicture */
+enum PipMode {
+    PIP_OFF,
+    PIP_FRONT_CAMERA,
+    /* test pattern standing in for a slate */
+    PIP_SLATE
+};
+int pip_mode = PIP_OFF;
+
+/* JPEG snapshots: seconds between them (0 = off), UDP port and/or file they go to */
+int snapshot_interval = 0;
+int snapshot_port = 0;
+gchar *snapshot_path = NULL;
+#define SNAPSHOT_WIDTH 320
+#define SNAPSHOT_HEIGHT 240
+#define SNAPSHOT_QUALITY 75
+
+struct SnapshotStats {
+    GMutex lock;
+    GstClockTime next;
+    guint64 count;
+    /* thread CPU time spent scaling and encoding, and when the branch started */
+    gint64 cpu_ns, started_ns, cpu_start_ns;
+};
+struct SnapshotStats snapshot_stats;
+
+/* store-and-forward: while the destination is unreachable, packets leaving the branch go to a size-capped queue of
+ * segment files, and are forwarded to a backlog port once it is back */
+gboolean store_forward = FALSE;
+gchar *store_forward_dir = NULL;
+guint64 store_forward_cap = 256 * 1024 * 1024;
+int store_forward_port = 5004;
+/* live plus backlog traffic is capped at this multiple of the stream bitrate, the backlog drains at one less */
+int store_forward_rate_factor = 4;
+#define SAF_SEGMENT_SIZE (1024 * 1024)
+/* packets waiting for the worker, beyond this the disk can't keep up and they are dropped */
+#define SAF_MAX_PENDING 4096
+#define SAF_TICK (10 * G_TIME_SPAN_MILLISECOND)
+#define SAF_ROUTE_CHECK (500 * G_TIME_SPAN_MILLISECOND)
+/* receivers send RTCP at least every 5 s (RFC 3550), one that stays silent for three intervals is gone */
+#define SAF_REPORT_TIMEOUT (15 * G_TIME_SPAN_SECOND)
+
+struct StoreForward {
+    GThread *thread;
+    gint running;
+    /* packets from the streaming thread while offline, written by the worker */
+    GAsyncQueue *pending;
+    gint max_pending;
+    gint offline;
+    /* bytes that went out live since the worker last looked, they have priority over the backlog */
+    gint live_bytes;
+    int socket;
+    struct sockaddr_in dest, backlog;
+    /* bytes per second for live and backlog together */
+    gint64 rate;
+    /* segments first..next-1 are on disk, the last one is open for writing while offline */
+    guint first, next;
+    FILE *writer, *reader;
+    guint reading;
+    gsize written;
+
+    GMutex lock;
+    guint64 stored, forwarded, dropped;
+};
+struct StoreForward saf;
+
+/* regularizing capture timestamps to the nominal framerate, values match GstAhc.Smoothing */
+enum TimestampSmoothing {
+    SMOOTHING_OFF,
+    SMOOTHING_DROP_ONLY,
+    SMOOTHING_DUPLICATE
+};
+int timestamp_smoothing = SMOOTHING_OFF;
+
+/* frame interval statistics of a pad, intervals in nanoseconds */
+struct FrameTiming {
+    GMutex lock;
+    GstClockTime nominal;
+    GstClockTime last_pts;
+    guint64 frames, intervals, drops;
+    GstClockTime min, max;
+    /* running mean and sum of squared differences (Welford) */
+    gdouble mean, m2;
+};
+
+/* live switch between cameras: the incoming ahcsrc starts next to the running one on another input-selector pad
+ * and takes over at its first frame, everything after the selector keeps running */
+struct CameraSwitch {
+    GMutex lock;
+    /* camera feeding the selector */
+    gint index;
+    GstElement *incoming, *outgoing;
+    GstPad *incoming_pad, *outgoing_pad;
+    /* incoming source whose start next to the running camera failed, its error message is expected */
+    GstElement *failed;
+    gboolean warm;
+    /* last frame out of the selector, and of the outgoing camera while the gap is measured */
+    GstClockTime last_pts, switch_pts;
+    gboolean measuring;
+    gchar *report;
+};
+struct CameraSwitch camera_switch;
+
+/* ahcsrc output and output of the smoothing stage */
+struct FrameTiming capture_timing;
+struct FrameTiming smoothed_timing;
+
+/* thread partitioning planner: splits the streaming branch into stages running on their own threads */
+gboolean thread_planner = FALSE;
+/* frames measured before planning */
+#define PLANNER_FRAMES 90
+
+struct ThreadPlanner {
+    /* held by the measuring probes, the relink on the main loop and the statistics */
+    GMutex lock;
+    /* measured elements in link order and their accumulated processing time */
+    GstElement *elements[BRANCH_MAX_ELEMENTS];
+    GstClockTime cost[BRANCH_MAX_ELEMENTS];
+    guint length;
+    guint frames;
+    gint previous;
+    GstClockTime last;
+    GstClockTime interval;
+    gboolean planned;
+    /* the first measured pad held while the main loop relinks the branch */
+    GstPad *blocked;
+    gulong block;
+    GSource *source;
+    gchar *report;
+};
+struct ThreadPlanner planner;
+
+static void planner_apply (void);
+
+/* lock-free spscqueue instead of queue for the preview, streaming and audio hand-offs */
+gboolean spsc_queues = FALSE;
+/* polls before a side of an spscqueue parks, a few microseconds on current phones */
+#define SPSC_SPIN_COUNT 200
+
+/* low-memory profile: every queue and buffer pool of the session is capped by bytes, 0 keeps GStreamer's defaults */
+guint memory_budget_mb = 0;
+#define MEMORY_METERS 24
+/* meters kept across streams: the preview queue lives as long as the pipeline, audio starts on its own */
+#define MEMORY_METER_PREVIEW 0
+#define MEMORY_METER_AUDIO 1
+
+/* peak bytes held by a queue (measured) or a pool (buffer size times the most buffers it may allocate) */
+struct MemoryMeter {
+    gchar name[32];
+    gint64 cap;
+    gint64 peak;
+};
+
+struct MemoryUsage {
+    GMutex lock;
+    struct MemoryMeter meters[MEMORY_METERS];
+    guint count;
+    /* bytes each pool may hold, what the queues leave of the budget split evenly */
+    gint64 pool_share;
+};
+struct MemoryUsage memory = {.count = MEMORY_METER_AUDIO + 1};
+
+/* microphone level, peak << 16 | RMS of the last buffer as linear S16 magnitudes; written by the audio thread with
+ * a single atomic store, the UI polls it */
+gint audio_level = 0;
+/* silence suppression: RMS below which audio buffers are dropped (0 = off) and how long the level must stay there */
+gint silence_rms = 0;
+#define SILENCE_HANGOVER (300 * GST_MSECOND)
+GstClockTime silence_since = GST_CLOCK_TIME_NONE;
+gint silence_dropped = 0;
 /* declarations */
 
 int audio_start(int bitrate, unsigned char *arg, int port);
@@ -144,6 +660,7 @@ static void set_ui_message(const gchar *message, GstAhc *data) {
   (*env)->DeleteLocalRef(env, jmessage);
 }
 
+static gboolean pip_replace_with_slate (GstAhc *ahc, GstMessage *message);
 
 static void
 on_error (GstBus * bus, GstMessage * message, GstAhc * ahc)
@@ -154,6 +671,20 @@ on_error (GstBus * bus, GstMessage * message, GstAhc * ahc)
   jstring jmessage;
   JNIEnv *env = get_jni_env ();
 
+  g_mutex_lock (&camera_switch.lock);
+  if (camera_switch.failed && GST_MESSAGE_SRC (message) == GST_OBJECT (camera_switch.failed)) {
+    /* the phone can't run two cameras at once, the switch went on without the warm start */
+    g_mutex_unlock (&camera_switch.lock);
+    GST_DEBUG ("Ignoring error of the incoming camera");
+    return;
+  }
+  g_mutex_unlock (&camera_switch.lock);
+
+  /* the second camera of the inset failed to open, the stream goes on with the slate */
+  if (pip_replace_with_slate (ahc, message)) {
+    return;
+  }
+
   gst_message_parse_error (message, &err, &debug_info);
   message_string =
       g_strdup_printf ("Error received from element %s: %s",
@@ -222,6 +753,411 @@ check_initialization_complete (GstAhc * data)
   }
 }
 
+static void
+frame_timing_reset (struct FrameTiming *timing, GstClockTime nominal)
+{
+  g_mutex_lock (&timing->lock);
+  timing->nominal = nominal;
+  timing->last_pts = GST_CLOCK_TIME_NONE;
+  timing->frames = timing->intervals = timing->drops = 0;
+  timing->min = GST_CLOCK_TIME_NONE;
+  timing->max = 0;
+  timing->mean = timing->m2 = 0;
+  g_mutex_unlock (&timing->lock);
+}
+
+static void
+frame_timing_add (struct FrameTiming *timing, GstClockTime pts)
+{
+  g_mutex_lock (&timing->lock);
+  timing->frames++;
+  if (GST_CLOCK_TIME_IS_VALID (timing->last_pts) && pts > timing->last_pts) {
+    GstClockTime interval = pts - timing->last_pts;
+    gdouble delta = interval - timing->mean;
+
+    timing->intervals++;
+    timing->mean += delta / timing->intervals;
+    timing->m2 += delta * (interval - timing->mean);
+    timing->min = MIN (timing->min, interval);
+    timing->max = MAX (timing->max, interval);
+    /* a gap of more than one and a half frame durations means the camera skipped frames */
+    if (timing->nominal && 2 * interval > 3 * timing->nominal) {
+      timing->drops += (interval + timing->nominal / 2) / timing->nominal - 1;
+    }
+  }
+  timing->last_pts = pts;
+  g_mutex_unlock (&timing->lock);
+}
+
+static void
+frame_timing_append (struct FrameTiming *timing, const gchar *name, GString *report)
+{
+  g_mutex_lock (&timing->lock);
+  if (timing->intervals > 1) {
+    gdouble deviation = sqrt (timing->m2 / (timing->intervals - 1));
+    g_string_append_printf (report,
+        "%s: %" G_GUINT64_FORMAT " frames, interval %.2f ms (min %.2f, max %.2f, std dev %.2f), %" G_GUINT64_FORMAT " dropped\n",
+        name, timing->frames, timing->mean / GST_MSECOND,
+        (gdouble) timing->min / GST_MSECOND, (gdouble) timing->max / GST_MSECOND,
+        deviation / GST_MSECOND, timing->drops);
+  }
+  g_mutex_unlock (&timing->lock);
+}
+
+/* feeds buffer timestamps into a FrameTiming, restarts it when the framerate changes */
+static GstPadProbeReturn
+frame_timing_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  struct FrameTiming *timing = (struct FrameTiming *) user_data;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+      frame_timing_add (timing, GST_BUFFER_PTS (buffer));
+    }
+  } else if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_CAPS) {
+    GstCaps *caps;
+    gint num = 0, den = 1;
+
+    gst_event_parse_caps (GST_PAD_PROBE_INFO_EVENT (info), &caps);
+    gst_structure_get_fraction (gst_caps_get_structure (caps, 0), "framerate", &num, &den);
+    frame_timing_reset (timing, num > 0 ? gst_util_uint64_scale_int (GST_SECOND, den, num) : 0);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* measures the gap between the last frame of the outgoing camera and the first of the incoming one */
+static GstPadProbeReturn
+camera_switch_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstClockTime pts = GST_BUFFER_PTS (buffer);
+
+    if (!GST_CLOCK_TIME_IS_VALID (pts)) {
+        return GST_PAD_PROBE_OK;
+    }
+    g_mutex_lock(&camera_switch.lock);
+    if (camera_switch.measuring && GST_CLOCK_TIME_IS_VALID (camera_switch.switch_pts)) {
+        g_mutex_lock(&capture_timing.lock);
+        gdouble interval = capture_timing.mean > 0 ? capture_timing.mean : GST_SECOND / 30.0;
+        g_mutex_unlock(&capture_timing.lock);
+        /* timestamps of the incoming camera may start behind the outgoing one's */
+        gint64 gap = MAX (GST_CLOCK_DIFF (camera_switch.switch_pts, pts), 0);
+        g_free(camera_switch.report);
+        camera_switch.report = g_strdup_printf("Camera switch to %d (%s start): %.1f frames missing, %.1f ms gap\n",
+                                               camera_switch.index, camera_switch.warm ? "warm" : "cold",
+                                               MAX (gap / interval - 1.0, 0.0), (gdouble) gap / GST_MSECOND);
+        camera_switch.measuring = FALSE;
+    }
+    camera_switch.last_pts = pts;
+    g_mutex_unlock(&camera_switch.lock);
+    return GST_PAD_PROBE_OK;
+}
+
+/* removes the outgoing camera, on the main loop since its streaming thread has to stop */
+static gboolean
+camera_switch_finish (gpointer user_data)
+{
+    GstAhc *ahc = (GstAhc *) user_data;
+
+    g_mutex_lock(&camera_switch.lock);
+    GstElement *outgoing = camera_switch.outgoing;
+    GstPad *outgoing_pad = camera_switch.outgoing_pad;
+    ahc->ahcsrc = camera_switch.incoming;
+    camera_switch.incoming = camera_switch.outgoing = NULL;
+    camera_switch.outgoing_pad = NULL;
+    g_clear_object(&camera_switch.incoming_pad);
+    camera_switch.failed = NULL;
+    g_mutex_unlock(&camera_switch.lock);
+
+    gst_element_set_state(outgoing, GST_STATE_NULL);
+    gst_element_release_request_pad(ahc->selector, outgoing_pad);
+    gst_object_unref(outgoing_pad);
+    gst_bin_remove(GST_BIN (ahc->pipeline), outgoing);
+    GST_INFO ("Switched to camera %d", camera_switch.index);
+    return G_SOURCE_REMOVE;
+}
+
+/* the first frame of the incoming camera makes it the active one, so the switch happens at a frame boundary */
+static GstPadProbeReturn
+camera_incoming_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstAhc *ahc = (GstAhc *) user_data;
+
+    g_mutex_lock(&camera_switch.lock);
+    /* a failed switch releases the pad on the application thread */
+    if (!camera_switch.incoming_pad) {
+        g_mutex_unlock(&camera_switch.lock);
+        return GST_PAD_PROBE_REMOVE;
+    }
+    GstPad *incoming_pad = gst_object_ref(camera_switch.incoming_pad);
+    g_mutex_unlock(&camera_switch.lock);
+    g_object_set(G_OBJECT(ahc->selector), "active-pad", incoming_pad, NULL);
+    gst_object_unref(incoming_pad);
+
+    g_mutex_lock(&camera_switch.lock);
+    camera_switch.switch_pts = camera_switch.last_pts;
+    camera_switch.measuring = TRUE;
+    camera_switch.index = GPOINTER_TO_INT (g_object_get_data(G_OBJECT(camera_switch.incoming), "camera-index"));
+    g_mutex_unlock(&camera_switch.lock);
+
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, camera_switch_finish, ahc, NULL);
+    g_source_attach(source, g_main_loop_get_context(ahc->main_loop));
+    g_source_unref(source);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+/* makes the queue decoupling two threads, spscqueue when enabled */
+static GstElement *
+make_queue (const gchar *name, guint capacity, GstSpscQueueLeaky leaky)
+{
+    GstElement *queue;
+
+    if (!spsc_queues) {
+        return gst_element_factory_make("queue", name);
+    }
+    queue = gst_element_factory_make("spscqueue", name);
+    g_object_set(G_OBJECT(queue), "capacity", capacity, "leaky", leaky, "spin-count", SPSC_SPIN_COUNT, NULL);
+    return queue;
+}
+
+/* hand-off latency and drops of an spscqueue */
+static void
+spsc_queue_append (GstElement *queue, const gchar *name, GString *report)
+{
+    guint64 pushed, dropped, latency;
+
+    if (!queue || !GST_IS_SPSC_QUEUE (queue)) {
+        return;
+    }
+    g_object_get(G_OBJECT(queue), "dropped", &dropped, "average-latency", &latency, NULL);
+    pushed = GST_SPSC_QUEUE (queue)->pushed;
+    g_string_append_printf(report, "%s queue: %" G_GUINT64_FORMAT " items, %" G_GUINT64_FORMAT " dropped, "
+        "hand-off %.1f us\n", name, pushed, dropped, latency / 1000.0);
+}
+
+static guint
+memory_meter_find (const gchar *name)
+{
+    guint i;
+
+    for (i = 0; i < memory.count; i++) {
+        if (g_strcmp0(memory.meters[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (memory.count < MEMORY_METERS) {
+        memory.count++;
+    }
+    i = memory.count - 1;
+    g_strlcpy(memory.meters[i].name, name, sizeof (memory.meters[i].name));
+    memory.meters[i].cap = memory.meters[i].peak = 0;
+    return i;
+}
+
+/* samples the level of the queue every time a buffer enters: what it already holds plus this one */
+static GstPadProbeReturn
+memory_queue_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    struct MemoryMeter *meter = &memory.meters[GPOINTER_TO_UINT (user_data)];
+    GstElement *queue = GST_PAD_PARENT (pad);
+    gint64 size = gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER (info));
+    gint64 level;
+
+    if (!memory_budget_mb) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (GST_IS_SPSC_QUEUE (queue)) {
+        guint items;
+        g_object_get(G_OBJECT(queue), "current-level", &items, NULL);
+        level = (gint64) items * size;
+    } else {
+        guint bytes;
+        g_object_get(G_OBJECT(queue), "current-level-bytes", &bytes, NULL);
+        level = bytes;
+    }
+    g_mutex_lock(&memory.lock);
+    meter->peak = MAX (meter->peak, level + size);
+    g_mutex_unlock(&memory.lock);
+    return GST_PAD_PROBE_OK;
+}
+
+/* caps a queue at bytes, in whole items of item_size for spscqueue; pass index to reuse a fixed meter, or -1 */
+static void
+memory_cap_queue (GstElement *queue, gint index, gint64 bytes, gint64 item_size)
+{
+    if (!queue) {
+        return;
+    }
+    if (GST_IS_SPSC_QUEUE (queue)) {
+        g_object_set(G_OBJECT(queue), "capacity", memory_spsc_capacity(bytes, item_size), NULL);
+    } else {
+        g_object_set(G_OBJECT(queue), "max-size-bytes", (guint) bytes, "max-size-buffers", 0, "max-size-time", (guint64) 0, NULL);
+    }
+
+    g_mutex_lock(&memory.lock);
+    guint i = index >= 0 ? (guint) index : memory_meter_find(GST_ELEMENT_NAME (queue));
+    g_strlcpy(memory.meters[i].name, GST_ELEMENT_NAME (queue), sizeof (memory.meters[i].name));
+    memory.meters[i].cap = bytes;
+    memory.meters[i].peak = 0;
+    g_mutex_unlock(&memory.lock);
+
+    if (index < 0 || index == MEMORY_METER_AUDIO) {
+        GstPad *sink = gst_element_get_static_pad(queue, "sink");
+        gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER, memory_queue_probe, GUINT_TO_POINTER (i), NULL);
+        gst_object_unref(sink);
+    }
+}
+
+/* buffers the pool behind this pad must be allowed above its minimum: the slack, what the queues right downstream hold
+ * in frames of this size, and the frames an encoder after them keeps */
+static guint
+memory_pool_reserve (GstPad *src, guint size)
+{
+    guint reserve = MEMORY_POOL_SLACK;
+    GstPad *peer = gst_pad_get_peer(src);
+
+    while (peer) {
+        GstElement *element = gst_pad_get_parent_element(peer);
+        GstElementFactory *factory = element ? gst_element_get_factory(element) : NULL;
+        gst_object_unref(peer);
+        peer = NULL;
+        if (!element) {
+            break;
+        }
+        if (GST_IS_VIDEO_ENCODER (element)) {
+            reserve += MEMORY_ENCODER_FRAMES;
+        } else if (GST_IS_SPSC_QUEUE (element) || (factory && g_str_equal(GST_OBJECT_NAME (factory), "queue"))) {
+            guint items = 0, bytes = 0;
+            if (GST_IS_SPSC_QUEUE (element)) {
+                g_object_get(G_OBJECT(element), "capacity", &items, NULL);
+            } else {
+                g_object_get(G_OBJECT(element), "max-size-buffers", &items, "max-size-bytes", &bytes, NULL);
+                items = memory_queue_items(items, bytes, size);
+            }
+            reserve += items;
+            GstPad *next = gst_element_get_static_pad(element, "src");
+            if (next) {
+                peer = gst_pad_get_peer(next);
+                gst_object_unref(next);
+            }
+        }
+        gst_object_unref(element);
+    }
+    return reserve;
+}
+
+/* once downstream answered the allocation query, its pools are limited to the share of the budget. When downstream
+ * proposes none, an entry without a pool carries the limit to the pool the element makes itself. */
+static GstPadProbeReturn
+memory_allocation_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+    gchar name[32];
+
+    if (!memory_budget_mb || GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION || !(GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_PULL)) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (!gst_query_get_n_allocation_pools(query)) {
+        GstCaps *caps = NULL;
+        GstVideoInfo video_info;
+        gst_query_parse_allocation(query, &caps, NULL);
+        if (caps && gst_video_info_from_caps(&video_info, caps)) {
+            gst_query_add_allocation_pool(query, NULL, (guint) GST_VIDEO_INFO_SIZE (&video_info), 0, 0);
+        }
+    }
+    g_snprintf(name, sizeof (name), "%s pool", GST_ELEMENT_NAME (GST_PAD_PARENT (pad)));
+    for (guint i = 0; i < gst_query_get_n_allocation_pools(query); i++) {
+        GstBufferPool *pool;
+        guint size, min, max;
+        gst_query_parse_nth_allocation_pool(query, i, &pool, &size, &min, &max);
+        if (size) {
+            guint reserve = memory_pool_reserve(pad, size);
+            g_mutex_lock(&memory.lock);
+            /* below its minimum and reserve the element can't run, it is then over budget */
+            max = memory_pool_max(size, min, max, reserve, memory.pool_share);
+            gst_query_set_nth_allocation_pool(query, i, pool, size, min, max);
+            struct MemoryMeter *meter = &memory.meters[memory_meter_find(name)];
+            meter->cap = memory.pool_share;
+            meter->peak = MAX (meter->peak, (gint64) size * max);
+            g_mutex_unlock(&memory.lock);
+        }
+        if (pool) {
+            gst_object_unref(pool);
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+memory_cap_pools (GstElement *element)
+{
+    GstPad *src = element ? gst_element_get_static_pad(element, "src") : NULL;
+
+    if (src) {
+        gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, memory_allocation_probe, NULL, NULL);
+        gst_object_unref(src);
+    }
+}
+
+/*
+ * Fits the streaming session into the budget: the preview queue holds one frame, queue_udp MEMORY_QUEUE_FRAMES, and the
+ * pools allocating raw frames share the rest. Called in NULL state, when spscqueue capacities can still change.
+ */
+static void
+memory_apply (GstElement *queue_preview, int width, int height)
+{
+    gint64 frame = (gint64) width * height * 3 / 2;
+    gint64 budget = (gint64) memory_budget_mb * 1024 * 1024;
+    GstElement *raw[] = {branch->videorate, branch->ratefilter, branch->crop, branch->crop_scale, branch->rotation, branch->compositor,
+                         branch->videoconvert, branch->inset_source, branch->inset_scale, branch->inset_filter};
+    guint pools = 1;
+
+    g_mutex_lock(&memory.lock);
+    memory.count = MEMORY_METER_AUDIO + 1;
+    g_mutex_unlock(&memory.lock);
+    if (!budget) {
+        return;
+    }
+    memory_cap_queue(queue_preview, MEMORY_METER_PREVIEW, frame, frame);
+    memory_cap_queue(branch->queue_udp, -1, MEMORY_QUEUE_FRAMES * frame, frame);
+    for (guint i = 0; i < G_N_ELEMENTS (raw); i++) {
+        if (raw[i]) {
+            memory_cap_pools(raw[i]);
+            pools++;
+        }
+    }
+    g_mutex_lock(&memory.lock);
+    memory.pool_share = memory_pool_share(budget, frame, pools);
+    g_mutex_unlock(&memory.lock);
+    GST_INFO ("Memory budget %u MB, %.1f MB per pool", memory_budget_mb, memory.pool_share / 1048576.0);
+}
+
+static void
+memory_append (GString *report)
+{
+    gint64 total = 0;
+
+    if (!memory_budget_mb) {
+        return;
+    }
+    g_mutex_lock(&memory.lock);
+    g_string_append_printf(report, "Memory budget %u MB:", memory_budget_mb);
+    for (guint i = 0; i < memory.count; i++) {
+        struct MemoryMeter *meter = &memory.meters[i];
+        if (!meter->name[0]) {
+            continue;
+        }
+        g_string_append_printf(report, " %s %.1f/%.1f MB%s", meter->name, meter->peak / 1048576.0, meter->cap / 1048576.0,
+                               meter->peak > meter->cap ? " (over)" : "");
+        total += meter->peak;
+    }
+    g_string_append_printf(report, ", peak total %.1f MB%s\n", total / 1048576.0,
+                           total > (gint64) memory_budget_mb * 1024 * 1024 ? ", over budget" : "");
+    g_mutex_unlock(&memory.lock);
+}
+
 static void *
 app_function (void *userdata)
 {
@@ -236,9 +1172,12 @@ app_function (void *userdata)
 
   /* create our own GLib Main Context, so we do not interfere with other libraries using GLib */
   context = g_main_context_new ();
+  g_mutex_lock (&app_context_lock);
+  app_context = context;
+  g_mutex_unlock (&app_context_lock);
 
-  //TODO: Compile Ggstahc plugin to access front facing camera
-  //https://github.com/GStreamer/gst-plugins-bad/blob/master/sys/androidmedia/gstahcsrc.c#L171
+  /* camera 0 feeds the pipeline at start, gst_native_switch_camera swaps in the others while it runs
+   * https://github.com/GStreamer/gst-plugins-bad/blob/master/sys/androidmedia/gstahcsrc.c#L171 */
 
   /** the main stem of the pipeline responsible for showing preview */
   ahc->pipeline = gst_pipeline_new ("camera-pipeline");
@@ -246,20 +1185,34 @@ app_function (void *userdata)
   /** https://gstreamer.freedesktop.org/documentation/videotestsrc/index.html#GstVideoTestSrcPattern */
     //ahc->ahcsrc = gst_element_factory_make ("videotestsrc", NULL);
     //g_object_set(G_OBJECT(ahc->ahcsrc), "pattern", 19, NULL);
+  /* cameras are switched here, the caps filter behind it keeps the caps unchanged */
+  ahc->selector = gst_element_factory_make ("input-selector", "camera_selector");
+  g_object_set (G_OBJECT (ahc->selector), "sync-streams", FALSE, NULL);
   ahc->filter = gst_element_factory_make("capsfilter", NULL);
   ahc->tee = gst_element_factory_make ("tee", "tee");
-  ahc->queue_preview = gst_element_factory_make("queue", "queue_preview");
+  /* the display only needs the newest frame */
+  ahc->queue_preview = make_queue ("queue_preview", 4, GST_SPSC_QUEUE_LEAK_DOWNSTREAM);
   ahc->vsink = gst_element_factory_make ("glimagesink", "vsink");
 
   gst_bin_add_many (GST_BIN (ahc->pipeline),
     ahc->ahcsrc,
+    ahc->selector,
     ahc->filter,
     ahc->tee,
     ahc->queue_preview,
     ahc->vsink,
     NULL);
 
-    gst_element_link_many(ahc->ahcsrc, ahc->filter, ahc->tee, NULL);
+    gst_element_link_many(ahc->ahcsrc, ahc->selector, ahc->filter, ahc->tee, NULL);
+    /* the camera's pool, only limited while a memory budget is set */
+    memory_cap_pools (ahc->ahcsrc);
+
+    /* records capture timing of every frame the cameras deliver */
+    GstPad *selector_src = gst_element_get_static_pad (ahc->selector, "src");
+    gst_pad_add_probe (selector_src, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        frame_timing_probe, &capture_timing, NULL);
+    gst_pad_add_probe (selector_src, GST_PAD_PROBE_TYPE_BUFFER, camera_switch_probe, NULL, NULL);
+    gst_object_unref (selector_src);
 
     ahc->tee_src_1 = gst_element_get_request_pad (ahc->tee, "src_%u");
     g_print ("Obtained request pad %s for preview branch: ", gst_pad_get_name (ahc->tee_src_1));
@@ -269,6 +1222,7 @@ app_function (void *userdata)
     if (gst_pad_link (ahc->tee_src_1, ahc->pad_preview) != GST_PAD_LINK_OK) {
         GST_DEBUG ("Tee could not be linked to preview queue.\n");
     }
+    gst_pad_add_probe (ahc->pad_preview, GST_PAD_PROBE_TYPE_BUFFER, memory_queue_probe, GUINT_TO_POINTER (MEMORY_METER_PREVIEW), NULL);
 
     gst_element_link_many(ahc->queue_preview, ahc->vsink, NULL);
 
@@ -304,9 +1258,13 @@ app_function (void *userdata)
   ahc->main_loop = NULL;
 
   /* Free resources */
+  g_mutex_lock (&app_context_lock);
+  app_context = NULL;
+  g_mutex_unlock (&app_context_lock);
   g_main_context_unref (context);
   gst_element_set_state (ahc->pipeline, GST_STATE_NULL);
   gst_object_unref (ahc->ahcsrc);
+  gst_object_unref (ahc->selector);
   gst_object_unref (ahc->filter);
   gst_object_unref (ahc->tee);
   gst_object_unref (ahc->queue_preview);
@@ -315,154 +1273,3338 @@ app_function (void *userdata)
   return NULL;
 }
 
-void
-gst_native_start_streaming_video (JNIEnv * env, jobject thiz, jshort width, jshort height, jshort framerate, int bitrate, jboolean rotate, jboolean packetization, jbyte byte0, jbyte byte1, jbyte byte2, jbyte byte3, int port) {
-    GstAhc *stem = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
-    gst_element_set_state(stem->pipeline, GST_STATE_PAUSED);
-    gst_element_set_state(stem->pipeline, GST_STATE_NULL);
-
-    /** the branch of the pipeline responsible for streaming */
-    branch->queue_udp = gst_element_factory_make("queue", "queue_udp");
-    if (!branch->queue_udp) { GST_DEBUG ("queue_udp is null!"); }
-    g_assert(branch->queue_udp);
+/* collects the elements of the streaming branch that are in use, in link order */
+static guint
+branch_collect (GstElement **chain)
+{
+    GstElement *all[] = {
+        branch->queue_udp,
+        branch->videorate,
+        branch->ratefilter,
+        branch->crop,
+        branch->crop_scale,
+        branch->crop_filter,
+        branch->rotation,
+        branch->compositor,
+        branch->videoconvert,
+        branch->encoder,
+        branch->queue_send,
+        branch->rtp,
+        branch->fec,
+        branch->rtx,
+        branch->srtp,
+        branch->session,
+        branch->funnel,
+        branch->fanout_tee,
+        branch->udpsink
+    };
+    guint length = 0;
+
+    for (guint i = 0; i < G_N_ELEMENTS (all) && length < BRANCH_MAX_ELEMENTS; i++) {
+        if (!all[i]) { continue; }
+        chain[length++] = all[i];
+        for (guint j = 0; j < branch->stages && length < BRANCH_MAX_ELEMENTS; j++) {
+            if (branch->stage_after[j] == all[i]) { chain[length++] = branch->stage_queue[j]; }
+        }
+    }
+    return length;
+}
 
-    /** https://gstreamer.freedesktop.org/documentation/videofilter/videoflip.html */
-    branch->rotation = gst_element_factory_make("videoflip", "rotation");
-    if (!branch->rotation) { GST_DEBUG ("rotation is null!"); }
-    if (rotate) {
-        g_object_set(G_OBJECT(branch->rotation), "video-direction", rotation_angle, NULL);
-        g_print("rotation_angle: %d\n", rotation_angle);
-    } else { g_object_set(G_OBJECT(branch->rotation), "video-direction", 0, NULL); }
-    g_assert(branch->rotation);
+/* runs the function once on the application's main loop; the returned source is owned by the loop and only valid until
+ * the function has run, NULL if the loop isn't running */
+static GSource *
+app_idle_attach (GSourceFunc function, gpointer data, GDestroyNotify notify)
+{
+    GSource *source = NULL;
+
+    g_mutex_lock(&app_context_lock);
+    if (app_context) {
+        source = g_idle_source_new();
+        g_source_set_callback(source, function, data, notify);
+        g_source_attach(source, app_context);
+        g_source_unref(source);
+    } else if (notify) {
+        notify(data);
+    }
+    g_mutex_unlock(&app_context_lock);
+    return source;
+}
 
-    branch->videoconvert = gst_element_factory_make("videoconvert", NULL);
-    if (!branch->videoconvert) { GST_DEBUG ("videoconvert is null!"); }
-    g_assert(branch->videoconvert);
+static GstPad *
+first_sink_pad (GstElement *element)
+{
+    GstPad *pad = NULL;
 
-    branch->encoder = gst_element_factory_make("openh264enc", "encoder");
-    if (!branch->encoder) { GST_DEBUG ("encoder is null!"); }
-    g_assert(branch->encoder);
+    GST_OBJECT_LOCK (element);
+    if (element->sinkpads) { pad = gst_object_ref (GST_PAD (element->sinkpads->data)); }
+    GST_OBJECT_UNLOCK (element);
+    return pad;
+}
 
-    /* optional element */
-    //TODO: https://github.com/mavlink/qgroundcontrol/blob/master/src/VideoReceiver/README.md
-    pak = packetization;
-    if (packetization) {
-        branch->rtp = gst_element_factory_make("rtph264pay", "rtp");
-        if (!branch->encoder) { GST_DEBUG ("rtp is null!"); }
-        g_assert(branch->rtp);
+/* on the main loop, nothing runs in the branch while its first pad is held */
+static gboolean
+planner_relink (gpointer user_data)
+{
+    g_mutex_lock(&planner.lock);
+    /* planner_stop may have cancelled it while this waited for the lock */
+    if (g_source_is_destroyed(g_main_current_source())) {
+        g_mutex_unlock(&planner.lock);
+        return G_SOURCE_REMOVE;
     }
+    planner.source = NULL;
+    planner_apply();
+    gst_pad_remove_probe(planner.blocked, planner.block);
+    gst_object_unref(planner.blocked);
+    planner.blocked = NULL;
+    planner.block = 0;
+    g_mutex_unlock(&planner.lock);
+    return G_SOURCE_REMOVE;
+}
 
-    branch->udpsink = gst_element_factory_make("udpsink", "sink");
-    if (branch->udpsink) { GST_DEBUG ("UDP sink is null!"); }
-    else {
-        g_print("Branch elements made.");
+static GstPadProbeReturn
+planner_blocked (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstPadProbeReturn ret = GST_PAD_PROBE_OK;
+
+    g_mutex_lock(&planner.lock);
+    if (planner.block && !planner.source) {
+        planner.source = app_idle_attach(planner_relink, NULL, NULL);
+        /* without a main loop the branch stays on one thread */
+        if (!planner.source) {
+            gst_object_unref(planner.blocked);
+            planner.blocked = NULL;
+            planner.block = 0;
+            ret = GST_PAD_PROBE_REMOVE;
+        }
     }
-    g_assert(branch->udpsink);
+    g_mutex_unlock(&planner.lock);
+    return ret;
+}
 
-    gst_bin_add_many(GST_BIN (stem->pipeline),
-                     branch->queue_udp,
-                     branch->rotation,
-                     branch->videoconvert,
-                     branch->encoder,
-                     NULL);
+/* measures how long every element after queue_udp takes per frame, while the branch still runs on one thread; the probe
+ * at index planner.length, in front of queue_send, ends the last element's time */
+static GstPadProbeReturn
+planner_measure_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    gint index = GPOINTER_TO_INT (user_data);
+    GstClockTime now;
 
-        if (packetization) {
-            gst_bin_add(GST_BIN(stem->pipeline), branch->rtp);
+    g_mutex_lock(&planner.lock);
+    if (planner.planned) {
+        g_mutex_unlock(&planner.lock);
+        return GST_PAD_PROBE_REMOVE;
+    }
+    now = gst_util_get_timestamp();
+    if (index == 0) {
+        /* a frame left queue_udp, the time since the previous one was spent waiting for it */
+        if (planner.frames++ == PLANNER_FRAMES) {
+            /* the next frame waits here until the main loop has relinked the branch */
+            planner.planned = TRUE;
+            planner.blocked = gst_object_ref(pad);
+            planner.block = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, planner_blocked, NULL, NULL);
+            g_mutex_unlock(&planner.lock);
+            return GST_PAD_PROBE_REMOVE;
         }
+    } else if (planner.previous >= 0) {
+        planner.cost[planner.previous] += now - planner.last;
+    }
+    planner.previous = (guint) index < planner.length ? index : -1;
+    planner.last = now;
+    g_mutex_unlock(&planner.lock);
+    return GST_PAD_PROBE_OK;
+}
 
-    gst_bin_add_many(GST_BIN (stem->pipeline),
-                     branch->udpsink,
-                     NULL);
-
-    g_print("Branch elements added to pipeline.\n");
-
-    branch->tee_src_2 = gst_element_get_request_pad(stem->tee, "src_%u");
-    g_print("Obtained request pad %s for streaming branch: ", gst_pad_get_name (branch->tee_src_2));
+/* starts measuring the elements of the streaming branch after queue_udp */
+static void
+planner_start (GstElement **chain, guint length, int framerate)
+{
+    g_mutex_lock(&planner.lock);
+    memset(planner.cost, 0, sizeof (planner.cost));
+    planner.length = 0;
+    planner.frames = 0;
+    planner.previous = -1;
+    planner.planned = FALSE;
+    planner.interval = framerate > 0 ? GST_SECOND / framerate : 0;
+    g_free(planner.report);
+    planner.report = g_strdup("Thread planner: measuring\n");
+
+    for (guint i = 1; i < length; i++) {
+        GstPad *sink = first_sink_pad(chain[i]);
+        if (!sink) { continue; }
+        /* the sender side after queue_send already has a thread of its own, the sink ends the branch */
+        gboolean last = chain[i] == branch->queue_send || i + 1 == length;
+        if (!last) {
+            planner.elements[planner.length] = chain[i];
+        }
+        gst_pad_add_probe(sink, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, planner_measure_probe,
+                          GINT_TO_POINTER (planner.length), NULL);
+        gst_object_unref(sink);
+        if (last) {
+            break;
+        }
+        planner.length++;
+    }
+    g_mutex_unlock(&planner.lock);
+}
 
-    branch->pad_udp = gst_element_get_static_pad(branch->queue_udp, "sink");
+/* before the branch is torn down: a pending relink is dropped and the held pad let go */
+static void
+planner_stop (void)
+{
+    g_mutex_lock(&planner.lock);
+    planner.planned = TRUE;
+    if (planner.source) {
+        g_source_destroy(planner.source);
+        planner.source = NULL;
+    }
+    if (planner.block) {
+        gst_pad_remove_probe(planner.blocked, planner.block);
+        gst_object_unref(planner.blocked);
+        planner.blocked = NULL;
+        planner.block = 0;
+    }
+    g_mutex_unlock(&planner.lock);
+}
 
-    if (gst_pad_link(branch->tee_src_2, branch->pad_udp) != GST_PAD_LINK_OK) {
-        GST_DEBUG ("Tee could not be linked!\n");
+/* splits the measured elements into stages (planner_partition), then puts a queue in front of every stage but the
+ * first, which keeps running on queue_udp's thread; called with planner.lock held */
+static void
+planner_apply (void)
+{
+    guint n = planner.length;
+    guint cores = g_get_num_processors();
+    uint64_t cost[BRANCH_MAX_ELEMENTS];
+    GstClockTime prefix[BRANCH_MAX_ELEMENTS + 1];
+    guint starts[BRANCH_MAX_ELEMENTS + 1];
+    uint64_t bottleneck;
+
+    if (n == 0) {
+        return;
     }
 
-    if (packetization) {
-        gst_element_link_many(branch->queue_udp, branch->rotation, branch->videoconvert, branch->encoder, branch->rtp, branch->udpsink, NULL);
-    } else {
-        gst_element_link_many(branch->queue_udp, branch->rotation, branch->videoconvert, branch->encoder, branch->udpsink, NULL);
+    prefix[0] = 0;
+    for (guint i = 0; i < n; i++) {
+        cost[i] = planner.cost[i] / PLANNER_FRAMES;
+        prefix[i + 1] = prefix[i] + cost[i];
     }
+    guint stages = planner_partition(cost, n, cores, starts, &bottleneck);
+
+    GstElement *pipeline = GST_ELEMENT (gst_element_get_parent(planner.elements[0]));
+    for (guint s = 1; s < stages; s++) {
+        GstElement *upstream = planner.elements[starts[s] - 1];
+        GstElement *downstream = planner.elements[starts[s]];
+        GstPad *sink = first_sink_pad(downstream);
+        GstPad *src = sink ? gst_pad_get_peer(sink) : NULL;
+        if (!src) {
+            if (sink) { gst_object_unref(sink); }
+            continue;
+        }
 
-    GstCaps *caps_new;
-    if (packetization) {
-        caps_new = gst_caps_new_simple("video/x-raw",
-                                       "width", G_TYPE_INT, width,
-                                       "height", G_TYPE_INT, height,
-                                       NULL);
+        gchar *name = g_strdup_printf("queue_stage_%u", s);
+        GstElement *queue = gst_element_factory_make("queue", name);
+        g_free(name);
+        /* a few frames are enough to decouple the threads, more would only add latency */
+        g_object_set(G_OBJECT(queue), "max-size-buffers", 3, "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+        if (memory_budget_mb) {
+            gint64 frame = (gint64) stream_width * stream_height * 3 / 2;
+            memory_cap_queue(queue, -1, frame, frame);
+        }
+        gst_bin_add(GST_BIN (pipeline), queue);
+
+        GstPad *queue_sink = gst_element_get_static_pad(queue, "sink");
+        GstPad *queue_src = gst_element_get_static_pad(queue, "src");
+        gst_pad_unlink(src, sink);
+        if (gst_pad_link(src, queue_sink) != GST_PAD_LINK_OK || gst_pad_link(queue_src, sink) != GST_PAD_LINK_OK) {
+            GST_WARNING ("Could not insert %s", GST_ELEMENT_NAME (queue));
+        }
+        gst_element_sync_state_with_parent(queue);
+        branch->stage_after[branch->stages] = upstream;
+        branch->stage_queue[branch->stages] = queue;
+        branch->stages++;
+
+        gst_object_unref(queue_sink);
+        gst_object_unref(queue_src);
+        gst_object_unref(src);
+        gst_object_unref(sink);
     }
-    else {
-    //FIXME
-    caps_new = gst_caps_new_simple("video/x-raw",
-                                       "width", G_TYPE_INT, width,
-                                       "height", G_TYPE_INT, height,
-                                       "framerate", GST_TYPE_FRACTION, framerate, 1,
-                                       NULL);
+    gst_object_unref(pipeline);
+
+    /* per-thread load against the frame interval */
+    GString *report = g_string_new(NULL);
+    g_string_append_printf(report, "Thread planner: %u stage(s) on %u core(s), throughput gain %.2fx\n",
+                           stages, cores, bottleneck ? (gdouble) prefix[n] / bottleneck : 1.0);
+    for (guint s = 0; s < stages; s++) {
+        GstClockTime stage_cost = prefix[starts[s + 1]] - prefix[starts[s]];
+        g_string_append_printf(report, "  thread %u:", s + 1);
+        for (guint i = starts[s]; i < starts[s + 1]; i++) {
+            g_string_append_printf(report, " %s", GST_ELEMENT_NAME (planner.elements[i]));
+        }
+        g_string_append_printf(report, ", %.2f ms/frame", (gdouble) stage_cost / GST_MSECOND);
+        if (planner.interval) {
+            g_string_append_printf(report, ", %.0f%% load", 100.0 * stage_cost / planner.interval);
+        }
+        g_string_append(report, "\n");
     }
+    GST_INFO ("%s", report->str);
 
-    g_object_set(stem->filter, "caps", caps_new, NULL);
-    gst_caps_unref(caps_new);
-
-    g_object_set(branch->encoder, "bitrate", bitrate, NULL);
-    /* sets the destination port */
-    g_object_set(G_OBJECT(branch->udpsink), "port", port, NULL);
+    g_free(planner.report);
+    planner.report = g_string_free(report, FALSE);
+}
 
-    /* sets the destination IP address */
+/* encoders coming from different plugin versions don't share property names, so only set what exists */
+static void
+set_property_if_exists (GstElement *element, const gchar *name, const gchar *value)
+{
+    if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), name)) {
+        gst_util_set_object_arg (G_OBJECT (element), name, value);
+    } else {
+        GST_DEBUG ("%s has no property %s, skipping", GST_ELEMENT_NAME (element), name);
+    }
+}
+
+static const gchar *
+video_encoder_bitrate_property (GstElement *encoder, int *scale)
+{
+    return encoder_bitrate_property(GST_OBJECT_NAME (gst_element_get_factory(encoder)), scale);
+}
+
+/* returns FALSE if a running encoder won't take it before it is started again */
+static gboolean
+set_video_encoder_bitrate (GstElement *encoder, int bitrate)
+{
+    int scale;
+    const gchar *property = video_encoder_bitrate_property(encoder, &scale);
+    GParamSpec *spec;
+    gchar value[32];
+
+    g_snprintf(value, sizeof (value), "%d", bitrate / scale);
+    set_property_if_exists(encoder, property, value);
+    spec = g_object_class_find_property(G_OBJECT_GET_CLASS (encoder), property);
+    return spec && (spec->flags & GST_PARAM_MUTABLE_PLAYING);
+}
+
+/* the bitrate the encoder holds in bit/s, -1 if it can't be read */
+static gint64
+get_video_encoder_bitrate (GstElement *encoder)
+{
+    int scale;
+    const gchar *property = video_encoder_bitrate_property(encoder, &scale);
+    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS (encoder), property);
+    GValue value = G_VALUE_INIT;
+    gint64 bitrate = -1;
+
+    if (!spec) {
+        return -1;
+    }
+    g_value_init(&value, spec->value_type);
+    g_object_get_property(G_OBJECT (encoder), property, &value);
+    if (G_VALUE_HOLDS_UINT (&value)) {
+        bitrate = g_value_get_uint(&value);
+    } else if (G_VALUE_HOLDS_INT (&value)) {
+        bitrate = g_value_get_int(&value);
+    } else if (G_VALUE_HOLDS_UINT64 (&value)) {
+        bitrate = (gint64) g_value_get_uint64(&value);
+    }
+    g_value_unset(&value);
+    return bitrate < 0 ? -1 : bitrate * scale;
+}
+
+/*
+ * Encoders like openh264enc 1.14 read the bitrate only when they are started. Such an encoder is restarted: the pad in
+ * front of it is blocked, and on the main loop the encoder is unlinked, taken to READY, given the bitrate, linked again,
+ * which sends the sticky caps and segment again, and brought back to its parent's state. It starts with a keyframe.
+ */
+struct EncoderRestart {
+    GstElement *encoder;
+    GstPad *upstream;
+    gulong probe;
+    GSource *source;
+    gint bitrate;
+};
+
+static void
+encoder_restart_free (struct EncoderRestart *restart)
+{
+    if (restart->probe) {
+        gst_pad_remove_probe(restart->upstream, restart->probe);
+    }
+    gst_object_unref(restart->upstream);
+    gst_object_unref(restart->encoder);
+    g_free(restart);
+}
+
+static gboolean
+encoder_restart_run (gpointer user_data)
+{
+    struct EncoderRestart *restart = user_data;
+    GstPad *sink = gst_element_get_static_pad(restart->encoder, "sink");
+    gboolean linked;
+
+    g_mutex_lock(&sendq.lock);
+    /* sendq_stop may have cancelled it while this waited for the lock */
+    if (g_source_is_destroyed(g_main_current_source())) {
+        g_mutex_unlock(&sendq.lock);
+        gst_object_unref(sink);
+        return G_SOURCE_REMOVE;
+    }
+    gst_pad_unlink(restart->upstream, sink);
+    gst_element_set_state(restart->encoder, GST_STATE_READY);
+    set_video_encoder_bitrate(restart->encoder, restart->bitrate);
+    linked = gst_pad_link(restart->upstream, sink) == GST_PAD_LINK_OK;
+    gst_element_sync_state_with_parent(restart->encoder);
+    if (linked) {
+        sendq.restarted++;
+        /* the output is measured from now on */
+        sendq.changed_at = g_get_monotonic_time();
+        sendq.verify_bytes = 0;
+    } else {
+        GST_WARNING ("%s could not be linked again after its restart!", GST_ELEMENT_NAME (restart->encoder));
+    }
+    sendq.restart = NULL;
+    encoder_restart_free(restart);
+    g_mutex_unlock(&sendq.lock);
+    gst_object_unref(sink);
+    return G_SOURCE_REMOVE;
+}
+
+/* in the upstream streaming thread, the pad stays blocked until the restart removes the probe */
+static GstPadProbeReturn
+encoder_restart_blocked (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    struct EncoderRestart *restart = user_data;
+
+    GstPadProbeReturn ret = GST_PAD_PROBE_OK;
+
+    g_mutex_lock(&sendq.lock);
+    if (sendq.restart == restart && !restart->source) {
+        restart->source = app_idle_attach(encoder_restart_run, restart, NULL);
+        /* without a main loop the pad isn't held and the change isn't taken */
+        if (!restart->source) {
+            restart->probe = 0;
+            ret = GST_PAD_PROBE_REMOVE;
+            sendq.restart = NULL;
+            sendq.unapplied++;
+            sendq.verify_bitrate = 0;
+            encoder_restart_free(restart);
+        }
+    }
+    g_mutex_unlock(&sendq.lock);
+    return ret;
+}
+
+/* called with sendq.lock held */
+static gboolean
+encoder_restart_request (GstElement *encoder, gint bitrate)
+{
+    GstPad *sink = gst_element_get_static_pad(encoder, "sink");
+    GstPad *upstream = gst_pad_get_peer(sink);
+    struct EncoderRestart *restart;
+
+    gst_object_unref(sink);
+    if (!upstream) {
+        return FALSE;
+    }
+    restart = g_new0(struct EncoderRestart, 1);
+    restart->encoder = gst_object_ref(encoder);
+    restart->upstream = upstream;
+    restart->bitrate = bitrate;
+    sendq.restart = restart;
+    restart->probe = gst_pad_add_probe(upstream, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                                       encoder_restart_blocked, restart, NULL);
+    return TRUE;
+}
+
+/* called with sendq.lock held, before the pipeline stops */
+static void
+encoder_restart_cancel (void)
+{
+    if (!sendq.restart) {
+        return;
+    }
+    if (sendq.restart->source) {
+        g_source_destroy(sendq.restart->source);
+    }
+    encoder_restart_free(sendq.restart);
+    sendq.restart = NULL;
+}
+
+/* makes the encoder for the requested codec, falls back to openh264enc if the plugin is missing */
+static GstElement *
+make_video_encoder (int *codec, int bitrate)
+{
+    GstElement *encoder = NULL;
+    gchar value[32];
+
+    switch (*codec) {
+        case CODEC_H265:
+            encoder = gst_element_factory_make("x265enc", "encoder");
+            if (encoder) {
+                set_video_encoder_bitrate(encoder, bitrate);
+                set_property_if_exists(encoder, "speed-preset", "ultrafast");
+                set_property_if_exists(encoder, "tune", "zerolatency");
+                set_property_if_exists(encoder, "key-int-max", "90");
+            }
+            break;
+        case CODEC_AV1:
+            encoder = gst_element_factory_make("svtav1enc", "encoder");
+            if (encoder) {
+                set_video_encoder_bitrate(encoder, bitrate);
+                set_property_if_exists(encoder, "preset", "12");
+                set_property_if_exists(encoder, "intra-period-length", "90");
+                break;
+            }
+            encoder = gst_element_factory_make("rav1enc", "encoder");
+            if (encoder) {
+                set_video_encoder_bitrate(encoder, bitrate);
+                set_property_if_exists(encoder, "speed-preset", "10");
+                set_property_if_exists(encoder, "low-latency", "true");
+                set_property_if_exists(encoder, "max-key-frame-interval", "90");
+            }
+            break;
+        case CODEC_VP8:
+        case CODEC_VP9:
+            /* real-time settings */
+            encoder = gst_element_factory_make(*codec == CODEC_VP8 ? "vp8enc" : "vp9enc", "encoder");
+            if (encoder) {
+                set_video_encoder_bitrate(encoder, bitrate);
+                set_property_if_exists(encoder, "end-usage", "cbr");
+                set_property_if_exists(encoder, "deadline", "1");
+                set_property_if_exists(encoder, "lag-in-frames", "0");
+                set_property_if_exists(encoder, "error-resilient", "default+partitions");
+                set_property_if_exists(encoder, "keyframe-max-dist", "90");
+                g_snprintf(value, sizeof (value), "%u", vpx_encoder_threads(g_get_num_processors()));
+                set_property_if_exists(encoder, "threads", value);
+                if (*codec == CODEC_VP8) {
+                    set_property_if_exists(encoder, "token-partitions", "4");
+                    set_property_if_exists(encoder, "cpu-used", "8");
+                } else {
+                    set_property_if_exists(encoder, "tile-columns", "2");
+                    set_property_if_exists(encoder, "frame-parallel-decoding", "true");
+                    set_property_if_exists(encoder, "row-mt", "true");
+                    set_property_if_exists(encoder, "cpu-used", "7");
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (!encoder) {
+        if (*codec != CODEC_H264) {
+            GST_WARNING ("Encoder for codec %d is not available, falling back to openh264enc", *codec);
+        }
+        *codec = CODEC_H264;
+        encoder = gst_element_factory_make("openh264enc", "encoder");
+        if (encoder) {
+            g_object_set(encoder, "bitrate", bitrate, NULL);
+        }
+    }
+    return encoder;
+}
+
+/* 224.0.0.0 to 239.255.255.255 */
+static gboolean
+is_multicast (unsigned char first_byte)
+{
+    return first_byte >= 224 && first_byte <= 239;
+}
+
+/* applies TTL, loopback and outgoing interface to a udpsink sending to a multicast group */
+static void
+configure_multicast (GstElement *udpsink)
+{
+    g_object_set(G_OBJECT(udpsink),
+                 "ttl-mc", multicast_ttl,
+                 "loop", multicast_loop,
+                 NULL);
+    if (multicast_iface && *multicast_iface) {
+        g_object_set(G_OBJECT(udpsink), "multicast-iface", multicast_iface, NULL);
+    }
+    GST_INFO ("Multicast TTL: %d, loop: %d, interface: %s", multicast_ttl, multicast_loop,
+              multicast_iface && *multicast_iface ? multicast_iface : "default");
+}
+
+/* makes srtpenc protecting RTP and RTCP with the key supplied through nativeSetSrtpKey */
+static GstElement *
+make_srtp_encoder (int cipher)
+{
+    const gchar *name = srtp_cipher_name(cipher);
+
+    if (!name) {
+        return NULL;
+    }
+    if (srtp_key_length != srtp_cipher_key_length(cipher)) {
+        GST_WARNING ("SRTP key is %" G_GSIZE_FORMAT " bytes long, %s needs %u",
+                     srtp_key_length, name, srtp_cipher_key_length(cipher));
+        return NULL;
+    }
+
+    GstElement *srtp = gst_element_factory_make("srtpenc", "srtp");
+    if (!srtp) {
+        return NULL;
+    }
+    /* GCM came with srtpenc 1.16, the key length rules out falling back to ICM */
+    GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS (srtp), "rtp-cipher");
+    if (!spec || !G_IS_PARAM_SPEC_ENUM (spec) ||
+        !g_enum_get_value_by_nick(G_PARAM_SPEC_ENUM (spec)->enum_class, name)) {
+        GST_WARNING ("srtpenc doesn't support %s", name);
+        gst_object_unref(srtp);
+        return NULL;
+    }
+
+    GstBuffer *key = gst_buffer_new_wrapped(g_memdup(srtp_key, srtp_key_length), srtp_key_length);
+    g_object_set(srtp, "key", key, NULL);
+    gst_buffer_unref(key);
+
+    /* GCM authenticates by itself, ICM needs HMAC */
+    const gchar *auth = cipher >= SRTP_AES_128_GCM ? "null" : "hmac-sha1-80";
+    gst_util_set_object_arg(G_OBJECT(srtp), "rtp-cipher", name);
+    gst_util_set_object_arg(G_OBJECT(srtp), "rtp-auth", auth);
+    gst_util_set_object_arg(G_OBJECT(srtp), "rtcp-cipher", name);
+    gst_util_set_object_arg(G_OBJECT(srtp), "rtcp-auth", auth);
+    return srtp;
+}
+
+/* time of the shared clock as NTP; the NTP clock counts from 1900, the others from 1970 */
+static guint64
+net_clock_to_ntp (GstClockTime time)
+{
+    if (net_clock_mode == NET_CLOCK_NTP) {
+        return ntp_ns_to_ntp(time);
+    }
+    return unix_us_to_ntp((gint64) (time / GST_USECOND));
+}
+
+static void
+slave_to_net_clock (GstElement *pipeline)
+{
+    gst_pipeline_use_clock(GST_PIPELINE (pipeline), net_clock);
+    gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+    gst_element_set_base_time(pipeline, 0);
+    GST_INFO ("Pipeline %s slaved to %s", GST_ELEMENT_NAME (pipeline), net_clock_description);
+}
+
+/* on the application's main loop: the stream restarts from READY on the shared clock, its running time and RTP
+ * timestamps start over like on any restart, receivers see a new segment */
+static gboolean
+net_clock_restart (gpointer user_data)
+{
+    GstElement *pipeline = GST_ELEMENT (user_data);
+    GstState state = GST_STATE_NULL;
+
+    g_mutex_lock(&net_clock_lock);
+    /* net_clock_forget may have cancelled it while this waited for the lock */
+    if (g_source_is_destroyed(g_main_current_source())) {
+        g_mutex_unlock(&net_clock_lock);
+        return G_SOURCE_REMOVE;
+    }
+    g_object_set_data(G_OBJECT (pipeline), "net-clock-restart", NULL);
+    if (net_clock && gst_clock_is_synced(net_clock)) {
+        gst_element_get_state(pipeline, &state, NULL, 0);
+        gst_element_set_state(pipeline, GST_STATE_READY);
+        slave_to_net_clock(pipeline);
+        if (state > GST_STATE_READY) {
+            gst_element_set_state(pipeline, state);
+        }
+    }
+    g_mutex_unlock(&net_clock_lock);
+    return G_SOURCE_REMOVE;
+}
+
+/* emitted by the clock's own thread, the pipeline is restarted on the main loop */
+static void
+net_clock_synced (GstClock *clock, gboolean synced, gpointer user_data)
+{
+    GstElement *pipeline = GST_ELEMENT (user_data);
+
+    if (!synced) {
+        return;
+    }
+    g_mutex_lock(&net_clock_lock);
+    if (!g_object_get_data(G_OBJECT (pipeline), "net-clock-restart")) {
+        GSource *source = app_idle_attach(net_clock_restart, gst_object_ref(pipeline), gst_object_unref);
+        g_object_set_data(G_OBJECT (pipeline), "net-clock-restart", source);
+    }
+    g_mutex_unlock(&net_clock_lock);
+    /* drops the handler's reference to the pipeline, last */
+    g_signal_handlers_disconnect_by_func(clock, net_clock_synced, pipeline);
+}
+
+/* a pipeline going away or changing clocks stops waiting for the shared clock; a restart already running is waited for */
+static void
+net_clock_forget (GstElement *pipeline)
+{
+    if (net_clock) {
+        g_signal_handlers_disconnect_by_func(net_clock, net_clock_synced, pipeline);
+    }
+    g_mutex_lock(&net_clock_lock);
+    GSource *source = g_object_get_data(G_OBJECT (pipeline), "net-clock-restart");
+    if (source) {
+        g_source_destroy(source);
+        g_object_set_data(G_OBJECT (pipeline), "net-clock-restart", NULL);
+    }
+    g_mutex_unlock(&net_clock_lock);
+}
+
+/* called before the pipeline goes to PLAYING: slaved to a synchronized shared clock with base time 0, running time
+ * equals clock time, so buffer timestamps are comparable across devices. Stream start doesn't wait for the clock: until
+ * it is synchronized the pipeline runs on its own clock, and once it is, the pipeline is restarted on the shared one,
+ * which makes timestamps jump once. Without a shared clock the pipeline goes back to choosing its clock. */
+static void
+use_net_clock (GstElement *pipeline)
+{
+    net_clock_forget(pipeline);
+    if (!net_clock) {
+        gst_pipeline_auto_clock(GST_PIPELINE (pipeline));
+        gst_element_set_start_time(pipeline, 0);
+        return;
+    }
+    if (gst_clock_is_synced(net_clock)) {
+        slave_to_net_clock(pipeline);
+        return;
+    }
+    GST_WARNING ("%s not synchronized yet, the pipeline restarts on it once it is", net_clock_description);
+    gst_pipeline_auto_clock(GST_PIPELINE (pipeline));
+    gst_element_set_start_time(pipeline, 0);
+    g_signal_connect_data(net_clock, "synced", G_CALLBACK (net_clock_synced), gst_object_ref(pipeline),
+                          (GClosureNotify) gst_object_unref, 0);
+}
+
+/* RTP timestamp of the last frame stamped, reset when a stream starts */
+struct AbsCaptureTime {
+    guint32 last_rtptime;
+    gboolean have_rtptime;
+};
+struct AbsCaptureTime abs_capture;
+
+/* adds the abs-capture-time extension to the packet if it is the first of its frame */
+static gboolean
+abs_capture_time_buffer (GstBuffer **buffer, guint idx, gpointer user_data)
+{
+    GstElement *pipeline = GST_ELEMENT (user_data);
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+    if (!GST_BUFFER_PTS_IS_VALID (*buffer) || !gst_rtp_buffer_map(*buffer, GST_MAP_READ, &rtp)) {
+        return TRUE;
+    }
+    /* all packets of a frame share the RTP timestamp, the first one carries a new value */
+    guint32 rtptime = gst_rtp_buffer_get_timestamp(&rtp);
+    gst_rtp_buffer_unmap(&rtp);
+    if (abs_capture.have_rtptime && rtptime == abs_capture.last_rtptime) {
+        return TRUE;
+    }
+    abs_capture.last_rtptime = rtptime;
+    abs_capture.have_rtptime = TRUE;
+
+    GstClock *clock = gst_element_get_clock(pipeline);
+    if (!clock) {
+        return TRUE;
+    }
+    /* ahcsrc is live with a TIME segment starting at 0, so PTS is the running time */
+    GstClockTime capture = gst_element_get_base_time(pipeline) + GST_BUFFER_PTS (*buffer);
+    guint8 data[8];
+    if (clock == net_clock) {
+        /* the shared clock already is wall-clock time, so every device stamps the same instant alike */
+        GST_WRITE_UINT64_BE (data, net_clock_to_ntp(capture));
+    } else {
+        /* the age of the frame on the pipeline clock is subtracted from the current wall-clock time */
+        GstClockTime now = gst_clock_get_time(clock);
+        gint64 real_now = g_get_real_time();
+        gint64 capture_us = real_now - GST_CLOCK_DIFF (capture, now) / GST_USECOND;
+        GST_WRITE_UINT64_BE (data, unix_us_to_ntp(capture_us));
+    }
+    gst_object_unref(clock);
+
+    *buffer = gst_buffer_make_writable(*buffer);
+    if (gst_rtp_buffer_map(*buffer, GST_MAP_READWRITE, &rtp)) {
+        if (!gst_rtp_buffer_add_extension_onebyte_header(&rtp, ABS_CAPTURE_TIME_ID, data, sizeof (data))) {
+            GST_DEBUG ("Could not add abs-capture-time extension");
+        }
+        gst_rtp_buffer_unmap(&rtp);
+    }
+    return TRUE;
+}
+
+/* on the payloader's source pad; fragmented frames leave rtph264pay as buffer lists */
+static GstPadProbeReturn
+abs_capture_time_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = gst_buffer_list_make_writable(GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+        gst_buffer_list_foreach(list, abs_capture_time_buffer, user_data);
+        GST_PAD_PROBE_INFO_DATA (info) = list;
+    } else {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+        abs_capture_time_buffer(&buffer, 0, user_data);
+        GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* sum of squares and peak magnitude of S16 samples, 8 samples per step where NEON or SSE2 is available */
+static void
+audio_level_measure (const gint16 *samples, gsize count, guint64 *sum_squares, gint *peak)
+{
+    guint64 sum = 0;
+    gint max = 0;
+    gsize i = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint64x2_t sum64 = vdupq_n_u64(0);
+    int16x8_t max16 = vdupq_n_s16(0);
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t v = vld1q_s16(samples + i);
+        /* saturating, so -32768 counts as 32767 */
+        max16 = vmaxq_s16(max16, vqabsq_s16(v));
+        /* squares fit in 31 bits, accumulated pairwise into 64 bits */
+        sum64 = vpadalq_u32(sum64, vreinterpretq_u32_s32(vmull_s16(vget_low_s16(v), vget_low_s16(v))));
+        sum64 = vpadalq_u32(sum64, vreinterpretq_u32_s32(vmull_s16(vget_high_s16(v), vget_high_s16(v))));
+    }
+    sum = vgetq_lane_u64(sum64, 0) + vgetq_lane_u64(sum64, 1);
+    gint16 lanes[8];
+    vst1q_s16(lanes, max16);
+    for (int j = 0; j < 8; j++) {
+        max = MAX (max, lanes[j]);
+    }
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum64 = zero;
+    __m128i max16 = zero;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (samples + i));
+        max16 = _mm_max_epi16(max16, _mm_max_epi16(v, _mm_subs_epi16(zero, v)));
+        /* pairs of squares, at most 2^31, so unsigned */
+        __m128i squares = _mm_madd_epi16(v, v);
+        sum64 = _mm_add_epi64(sum64, _mm_unpacklo_epi32(squares, zero));
+        sum64 = _mm_add_epi64(sum64, _mm_unpackhi_epi32(squares, zero));
+    }
+    guint64 sums[2];
+    gint16 lanes[8];
+    _mm_storeu_si128((__m128i *) sums, sum64);
+    _mm_storeu_si128((__m128i *) lanes, max16);
+    sum = sums[0] + sums[1];
+    for (int j = 0; j < 8; j++) {
+        max = MAX (max, lanes[j]);
+    }
+#endif
+    for (; i < count; i++) {
+        gint sample = samples[i];
+        sum += (guint64) (sample * sample);
+        max = MAX (max, ABS (sample));
+    }
+    *sum_squares = sum;
+    *peak = MIN (max, G_MAXINT16);
+}
+
+/* meters every audio buffer and, when enabled, drops buffers once the input has been quiet for the hangover */
+static GstPadProbeReturn
+audio_level_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstMapInfo map;
+    guint64 sum_squares;
+    gint peak, rms;
+    gsize count;
+
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return GST_PAD_PROBE_OK;
+    }
+    /* the capsfilter in front fixes S16LE mono */
+    count = map.size / sizeof (gint16);
+    audio_level_measure((const gint16 *) map.data, count, &sum_squares, &peak);
+    gst_buffer_unmap(buffer, &map);
+    if (count == 0) {
+        return GST_PAD_PROBE_OK;
+    }
+    rms = MIN ((gint) sqrt((gdouble) sum_squares / count), G_MAXINT16);
+    g_atomic_int_set(&audio_level, peak << 16 | rms);
+
+    gint threshold = g_atomic_int_get(&silence_rms);
+    if (threshold == 0 || rms >= threshold) {
+        if (GST_CLOCK_TIME_IS_VALID (silence_since)) {
+            /* tells the encoder and the receiver that buffers are missing */
+            silence_since = GST_CLOCK_TIME_NONE;
+            buffer = gst_buffer_make_writable(buffer);
+            GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+            GST_PAD_PROBE_INFO_DATA (info) = buffer;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    GstClockTime now = gst_util_get_timestamp();
+    if (!GST_CLOCK_TIME_IS_VALID (silence_since)) {
+        silence_since = now;
+    }
+    if (now - silence_since < SILENCE_HANGOVER) {
+        return GST_PAD_PROBE_OK;
+    }
+    g_atomic_int_inc(&silence_dropped);
+    return GST_PAD_PROBE_DROP;
+}
+
+/* meters the raw samples leaving the capsfilter of the audio pipeline */
+static void
+audio_level_attach (GstElement *capsfilter)
+{
+    GstPad *pad = gst_element_get_static_pad(capsfilter, "src");
+    g_atomic_int_set(&audio_level, 0);
+    silence_since = GST_CLOCK_TIME_NONE;
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, audio_level_probe, NULL, NULL);
+    gst_object_unref(pad);
+}
+
+static GstElement *
+pip_make_slate (void)
+{
+    GstElement *slate = gst_element_factory_make("videotestsrc", "inset_source");
+
+    if (slate) {
+        g_object_set(G_OBJECT(slate), "is-live", TRUE, NULL);
+        gst_util_set_object_arg(G_OBJECT(slate), "pattern", "smpte");
+    }
+    return slate;
+}
+
+/* makes the source of the inset, another camera or a slate, scaled with videoscale's SIMD paths */
+static gboolean
+pip_make (int mode, int width, int height)
+{
+    if (mode == PIP_FRONT_CAMERA) {
+        branch->inset_source = gst_element_factory_make("ahcsrc", "inset_source");
+        if (branch->inset_source) {
+            /* the camera that isn't feeding the preview, gst_native_switch_camera leaves both alone while it runs */
+            g_mutex_lock(&camera_switch.lock);
+            set_property_if_exists(branch->inset_source, "device", camera_switch.index == 1 ? "0" : "1");
+            g_mutex_unlock(&camera_switch.lock);
+        } else {
+            GST_WARNING ("second ahcsrc is null, using a slate instead!");
+        }
+    }
+    if (!branch->inset_source) {
+        branch->inset_source = pip_make_slate();
+    }
+    branch->inset_scale = gst_element_factory_make("videoscale", "inset_scale");
+    branch->inset_filter = gst_element_factory_make("capsfilter", "inset_filter");
+    branch->compositor = gst_element_factory_make("compositor", "compositor");
+    if (!branch->inset_source || !branch->inset_scale || !branch->inset_filter || !branch->compositor) {
+        GST_WARNING ("compositor is null, streaming without picture-in-picture!");
+        if (branch->inset_source) { gst_object_unref(branch->inset_source); }
+        if (branch->inset_scale) { gst_object_unref(branch->inset_scale); }
+        if (branch->inset_filter) { gst_object_unref(branch->inset_filter); }
+        if (branch->compositor) { gst_object_unref(branch->compositor); }
+        branch->inset_source = branch->inset_scale = branch->inset_filter = branch->compositor = NULL;
+        return FALSE;
+    }
+    int inset_width, inset_height, xpos, ypos;
+    pip_geometry(width, height, FALSE, &inset_width, &inset_height, &xpos, &ypos);
+    GstCaps *caps_inset = gst_caps_new_simple("video/x-raw",
+                                              "width", G_TYPE_INT, inset_width,
+                                              "height", G_TYPE_INT, inset_height,
+                                              "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+                                              NULL);
+    g_object_set(G_OBJECT(branch->inset_filter), "caps", caps_inset, NULL);
+    gst_caps_unref(caps_inset);
+    return TRUE;
+}
+
+/* links the inset into the compositor, whose first pad already carries the camera; one encode for both pictures */
+/* puts the inset in the top right corner, videoflip turns the frame on its side for 90 and 270 degrees */
+static void
+pip_position (void)
+{
+    gboolean sideways = stream_autorotation && (rotation_angle == 1 || rotation_angle == 3);
+    GstPad *filter_src = gst_element_get_static_pad(branch->inset_filter, "src");
+    GstPad *inset_pad = gst_pad_get_peer(filter_src);
+    int inset_width, inset_height, xpos, ypos;
+
+    pip_geometry(stream_width, stream_height, sideways, &inset_width, &inset_height, &xpos, &ypos);
+    if (inset_pad) {
+        g_object_set(G_OBJECT(inset_pad),
+                     "xpos", xpos,
+                     "ypos", ypos,
+                     "zorder", 1,
+                     NULL);
+        gst_object_unref(inset_pad);
+    }
+    gst_object_unref(filter_src);
+}
+
+/* links the inset into the compositor, whose first pad already carries the camera; one encode for both pictures */
+static void
+pip_link (GstElement *pipeline)
+{
+    gst_bin_add_many(GST_BIN (pipeline), branch->inset_source, branch->inset_scale, branch->inset_filter, NULL);
+    if (!gst_element_link_many(branch->inset_source, branch->inset_scale, branch->inset_filter, branch->compositor, NULL)) {
+        GST_DEBUG ("Failed to link the picture-in-picture inset!\n");
+        return;
+    }
+    pip_position();
+    GST_INFO ("Picture-in-picture inset %dx%d from %s", stream_width / PIP_SCALE, stream_height / PIP_SCALE,
+              GST_ELEMENT_NAME (branch->inset_source));
+}
+
+/* a second camera that can't be opened only fails at the state change, on the main loop: the slate takes its place
+ * as if the camera had never been made, instead of the error stopping the stream */
+static gboolean
+pip_replace_with_slate (GstAhc *ahc, GstMessage *message)
+{
+    GstElement *failed = branch->inset_source;
+    GstElementFactory *factory = failed ? gst_element_get_factory(failed) : NULL;
+
+    if (!failed || GST_MESSAGE_SRC (message) != GST_OBJECT (failed)
+        || !factory || g_strcmp0(GST_OBJECT_NAME (factory), "ahcsrc") != 0) {
+        return FALSE;
+    }
+    GST_WARNING ("second camera failed to open, using a slate instead!");
+    gst_element_unlink(failed, branch->inset_scale);
+    gst_element_set_state(failed, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN (ahc->pipeline), failed);
+
+    branch->inset_source = pip_make_slate();
+    if (!branch->inset_source) {
+        GST_WARNING ("videotestsrc is null, the inset stays empty!");
+        return TRUE;
+    }
+    gst_bin_add(GST_BIN (ahc->pipeline), branch->inset_source);
+    if (!gst_element_link(branch->inset_source, branch->inset_scale)) {
+        GST_DEBUG ("Failed to link the slate!\n");
+    }
+    gst_element_sync_state_with_parent(branch->inset_source);
+    /* the failed state change left the rest of the pipeline short of PLAYING */
+    if (GST_STATE_TARGET (ahc->pipeline) == GST_STATE_PLAYING) {
+        gst_element_set_state(ahc->pipeline, GST_STATE_PLAYING);
+    }
+    GST_INFO ("Picture-in-picture inset from %s", GST_ELEMENT_NAME (branch->inset_source));
+    return TRUE;
+}
+
+static void
+pip_unlink (GstElement *pipeline)
+{
+    if (!branch->inset_source) {
+        return;
+    }
+    gst_element_unlink_many(branch->inset_source, branch->inset_scale, branch->inset_filter, branch->compositor, NULL);
+    gst_bin_remove_many(GST_BIN (pipeline), branch->inset_source, branch->inset_scale, branch->inset_filter, NULL);
+    branch->inset_source = branch->inset_scale = branch->inset_filter = NULL;
+}
+
+static gint64
+thread_cpu_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+/* lets one frame in per interval, the others are dropped before they cost anything */
+static GstPadProbeReturn
+snapshot_gate_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstClockTime now = gst_util_get_timestamp();
+    GstPadProbeReturn ret = GST_PAD_PROBE_DROP;
+
+    g_mutex_lock(&snapshot_stats.lock);
+    if (!GST_CLOCK_TIME_IS_VALID (snapshot_stats.next) || now >= snapshot_stats.next) {
+        snapshot_stats.next = now + snapshot_interval * GST_SECOND;
+        ret = GST_PAD_PROBE_OK;
+    }
+    g_mutex_unlock(&snapshot_stats.lock);
+    return ret;
+}
+
+/* scaling and encoding run on the queue's thread between these two probes, its CPU time is their cost */
+static GstPadProbeReturn
+snapshot_begin_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    snapshot_stats.cpu_start_ns = thread_cpu_ns();
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+snapshot_end_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    gint64 cpu = thread_cpu_ns() - snapshot_stats.cpu_start_ns;
+
+    g_mutex_lock(&snapshot_stats.lock);
+    snapshot_stats.cpu_ns += cpu;
+    snapshot_stats.count++;
+    g_mutex_unlock(&snapshot_stats.lock);
+    return GST_PAD_PROBE_OK;
+}
+
+/* tee -> queue -> videoscale -> capsfilter -> jpegenc -> udpsink and/or multifilesink, one frame per interval */
+static void
+snapshot_start (GstAhc *stem, const gchar *host)
+{
+    if (snapshot_interval <= 0 || (snapshot_port <= 0 && !snapshot_path)) {
+        return;
+    }
+    snapshot->queue = gst_element_factory_make("queue", "queue_snapshot");
+    snapshot->scale = gst_element_factory_make("videoscale", "snapshot_scale");
+    snapshot->filter = gst_element_factory_make("capsfilter", "snapshot_filter");
+    snapshot->encoder = gst_element_factory_make("jpegenc", "snapshot_encoder");
+    if (snapshot_port > 0) {
+        snapshot->udpsink = gst_element_factory_make("udpsink", "snapshot_udpsink");
+    }
+    if (snapshot_path) {
+        snapshot->filesink = gst_element_factory_make("multifilesink", "snapshot_filesink");
+    }
+    if (!snapshot->queue || !snapshot->scale || !snapshot->filter || !snapshot->encoder
+        || (snapshot_port > 0 && !snapshot->udpsink) || (snapshot_path && !snapshot->filesink)) {
+        GST_WARNING ("jpegenc is null, no snapshots!");
+        GstElement *made[] = {snapshot->queue, snapshot->scale, snapshot->filter, snapshot->encoder, snapshot->udpsink, snapshot->filesink};
+        for (guint i = 0; i < G_N_ELEMENTS (made); i++) {
+            if (made[i]) { gst_object_unref(made[i]); }
+        }
+        memset(snapshot, 0, sizeof (*snapshot));
+        return;
+    }
+
+    /* holds one frame at most, the camera never waits for the encoder */
+    g_object_set(G_OBJECT(snapshot->queue), "max-size-buffers", 1, "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+    gst_util_set_object_arg(G_OBJECT(snapshot->queue), "leaky", "downstream");
+    if (memory_budget_mb) {
+        gint64 frame = (gint64) stream_width * stream_height * 3 / 2;
+        memory_cap_queue(snapshot->queue, -1, frame, frame);
+        memory_cap_pools(snapshot->scale);
+    }
+    GstCaps *caps_snapshot = gst_caps_new_simple("video/x-raw",
+                                                 "width", G_TYPE_INT, SNAPSHOT_WIDTH,
+                                                 "height", G_TYPE_INT, SNAPSHOT_HEIGHT,
+                                                 NULL);
+    g_object_set(G_OBJECT(snapshot->filter), "caps", caps_snapshot, NULL);
+    gst_caps_unref(caps_snapshot);
+    g_object_set(G_OBJECT(snapshot->encoder), "quality", SNAPSHOT_QUALITY, NULL);
+
+    gst_bin_add_many(GST_BIN (stem->pipeline), snapshot->queue, snapshot->scale, snapshot->filter, snapshot->encoder, NULL);
+    gst_element_link_many(snapshot->queue, snapshot->scale, snapshot->filter, snapshot->encoder, NULL);
+    if (snapshot->udpsink && snapshot->filesink) {
+        GstElement *split = gst_element_factory_make("tee", "snapshot_tee");
+        gst_bin_add(GST_BIN (stem->pipeline), split);
+        gst_element_link(snapshot->encoder, split);
+        gst_bin_add_many(GST_BIN (stem->pipeline), snapshot->udpsink, snapshot->filesink, NULL);
+        gst_element_link(split, snapshot->udpsink);
+        gst_element_link(split, snapshot->filesink);
+    } else {
+        GstElement *sink = snapshot->udpsink ? snapshot->udpsink : snapshot->filesink;
+        gst_bin_add(GST_BIN (stem->pipeline), sink);
+        gst_element_link(snapshot->encoder, sink);
+    }
+    if (snapshot->udpsink) {
+        /* a 320x240 JPEG fits in one datagram */
+        g_object_set(G_OBJECT(snapshot->udpsink), "host", host, "port", snapshot_port, "sync", FALSE, "async", FALSE, NULL);
+        if (is_multicast((unsigned char) atoi(host))) {
+            configure_multicast(snapshot->udpsink);
+        }
+    }
+    if (snapshot->filesink) {
+        /* no %d in the location, so every snapshot replaces the previous one */
+        g_object_set(G_OBJECT(snapshot->filesink), "location", snapshot_path, "sync", FALSE, "async", FALSE, NULL);
+    }
+
+    g_mutex_lock(&snapshot_stats.lock);
+    snapshot_stats.next = GST_CLOCK_TIME_NONE;
+    snapshot_stats.count = 0;
+    snapshot_stats.cpu_ns = 0;
+    snapshot_stats.started_ns = gst_util_get_timestamp();
+    g_mutex_unlock(&snapshot_stats.lock);
+
+    snapshot->tee_src = gst_element_get_request_pad(stem->tee, "src_%u");
+    snapshot->pad_queue = gst_element_get_static_pad(snapshot->queue, "sink");
+    gst_pad_add_probe(snapshot->pad_queue, GST_PAD_PROBE_TYPE_BUFFER, snapshot_gate_probe, NULL, NULL);
+    if (gst_pad_link(snapshot->tee_src, snapshot->pad_queue) != GST_PAD_LINK_OK) {
+        GST_DEBUG ("Tee could not be linked to snapshot queue.\n");
+    }
+    GstPad *pad = gst_element_get_static_pad(snapshot->scale, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, snapshot_begin_probe, NULL, NULL);
+    gst_object_unref(pad);
+    pad = gst_element_get_static_pad(snapshot->encoder, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, snapshot_end_probe, NULL, NULL);
+    gst_object_unref(pad);
+    GST_INFO ("Snapshot every %d s%s%s", snapshot_interval, snapshot->udpsink ? " over UDP" : "",
+              snapshot->filesink ? " to a file" : "");
+}
+
+/* the pipeline is in NULL state */
+static void
+snapshot_stop (GstAhc *stem)
+{
+    if (!snapshot->queue) {
+        return;
+    }
+    gst_pad_unlink(snapshot->tee_src, snapshot->pad_queue);
+    gst_element_release_request_pad(stem->tee, snapshot->tee_src);
+    gst_object_unref(snapshot->tee_src);
+    gst_object_unref(snapshot->pad_queue);
+
+    GstElement *split = gst_bin_get_by_name(GST_BIN (stem->pipeline), "snapshot_tee");
+    if (split) {
+        gst_bin_remove(GST_BIN (stem->pipeline), split);
+        gst_object_unref(split);
+    }
+    GstElement *made[] = {snapshot->queue, snapshot->scale, snapshot->filter, snapshot->encoder, snapshot->udpsink, snapshot->filesink};
+    for (guint i = 0; i < G_N_ELEMENTS (made); i++) {
+        if (made[i]) { gst_bin_remove(GST_BIN (stem->pipeline), made[i]); }
+    }
+    memset(snapshot, 0, sizeof (*snapshot));
+}
+
+static gchar *
+saf_segment_path (guint index)
+{
+    gchar name[32];
+    g_snprintf(name, sizeof (name), "segment-%08u.bin", index);
+    return g_build_filename(store_forward_dir, name, NULL);
+}
+
+/* a receiver sending RTCP (the bundle) is reachable while its packets keep coming, its RTCP goes on while it gets
+ * nothing; before its first packet, or without RTCP, only a lost route can be told: connect() then fails at once,
+ * e.g. with ENETUNREACH when Wi-Fi is gone */
+static gboolean
+saf_reachable (const struct sockaddr_in *dest)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    gint64 last_rtcp_at;
+
+    if (fd >= 0) {
+        gboolean route = connect(fd, (const struct sockaddr *) dest, sizeof (*dest)) == 0;
+        close(fd);
+        if (!route) {
+            return FALSE;
+        }
+    }
+    g_mutex_lock(&receiver_reports.lock);
+    last_rtcp_at = receiver_reports.last_rtcp_at;
+    g_mutex_unlock(&receiver_reports.lock);
+    return !last_rtcp_at || g_get_monotonic_time() - last_rtcp_at < SAF_REPORT_TIMEOUT;
+}
+
+/* deletes the oldest segment, when the cap is reached or after it has been forwarded */
+static void
+saf_drop_oldest (gboolean forwarded)
+{
+    gchar *path = saf_segment_path(saf.first);
+    GStatBuf st;
+
+    if (saf.reader && saf.reading == saf.first) {
+        fclose(saf.reader);
+        saf.reader = NULL;
+    }
+    if (g_stat(path, &st) == 0) {
+        g_mutex_lock(&saf.lock);
+        saf.stored -= MIN (saf.stored, (guint64) st.st_size);
+        if (!forwarded) {
+            saf.dropped += st.st_size;
+        }
+        g_mutex_unlock(&saf.lock);
+    }
+    g_remove(path);
+    g_free(path);
+    saf.first++;
+}
+
+/* appends one packet as a 2-byte length and its bytes */
+static void
+saf_write (GBytes *packet)
+{
+    gsize size;
+    const guint8 *data = g_bytes_get_data(packet, &size);
+    guint8 header[2];
+
+    if (saf.writer && saf.written + size + 2 > SAF_SEGMENT_SIZE) {
+        fclose(saf.writer);
+        saf.writer = NULL;
+    }
+    if (!saf.writer) {
+        while (saf.first < saf.next && saf.stored + SAF_SEGMENT_SIZE > store_forward_cap) {
+            saf_drop_oldest(FALSE);
+        }
+        gchar *path = saf_segment_path(saf.next);
+        saf.writer = g_fopen(path, "wb");
+        g_free(path);
+        if (!saf.writer) {
+            GST_WARNING ("Can't create store-and-forward segment: %s", g_strerror(errno));
+            g_mutex_lock(&saf.lock);
+            saf.dropped += size;
+            g_mutex_unlock(&saf.lock);
+            return;
+        }
+        saf.next++;
+        saf.written = 0;
+    }
+    GST_WRITE_UINT16_BE (header, size);
+    fwrite(header, 1, 2, saf.writer);
+    fwrite(data, 1, size, saf.writer);
+    saf.written += size + 2;
+    g_mutex_lock(&saf.lock);
+    saf.stored += size + 2;
+    g_mutex_unlock(&saf.lock);
+}
+
+/* sends up to budget bytes of the backlog, oldest first; the segment being written is closed first */
+static void
+saf_forward (gint64 budget)
+{
+    guint8 packet[G_MAXUINT16];
+    guint8 header[2];
+
+    while (budget > 0 && saf.first < saf.next) {
+        if (saf.writer && saf.first == saf.next - 1) {
+            fclose(saf.writer);
+            saf.writer = NULL;
+        }
+        if (!saf.reader) {
+            gchar *path = saf_segment_path(saf.first);
+            saf.reader = g_fopen(path, "rb");
+            saf.reading = saf.first;
+            g_free(path);
+            if (!saf.reader) {
+                saf_drop_oldest(FALSE);
+                continue;
+            }
+        }
+        if (fread(header, 1, 2, saf.reader) != 2) {
+            saf_drop_oldest(TRUE);
+            continue;
+        }
+        guint16 size = GST_READ_UINT16_BE (header);
+        if (fread(packet, 1, size, saf.reader) != size) {
+            saf_drop_oldest(TRUE);
+            continue;
+        }
+        sendto(saf.socket, packet, size, 0, (const struct sockaddr *) &saf.backlog, sizeof (saf.backlog));
+        budget -= size;
+        g_mutex_lock(&saf.lock);
+        saf.forwarded += size;
+        g_mutex_unlock(&saf.lock);
+    }
+}
+
+/* writes what was queued while offline and forwards the backlog with whatever rate the live stream leaves */
+static gpointer
+saf_worker (gpointer user_data)
+{
+    gint64 last_check = 0;
+    gint64 last_tick = g_get_monotonic_time();
+
+    while (g_atomic_int_get(&saf.running)) {
+        GBytes *packet = g_async_queue_timeout_pop(saf.pending, SAF_TICK);
+        while (packet) {
+            saf_write(packet);
+            g_bytes_unref(packet);
+            packet = g_async_queue_try_pop(saf.pending);
+        }
+
+        gint64 now = g_get_monotonic_time();
+        if (now - last_check >= SAF_ROUTE_CHECK) {
+            gboolean offline = !saf_reachable(&saf.dest);
+            if (offline != g_atomic_int_get(&saf.offline)) {
+                GST_INFO ("Destination %s", offline ? "unreachable, storing" : "reachable again, forwarding");
+            }
+            g_atomic_int_set(&saf.offline, offline);
+            last_check = now;
+        }
+
+        gint64 budget = saf.rate * (now - last_tick) / G_USEC_PER_SEC - g_atomic_int_and(&saf.live_bytes, 0);
+        last_tick = now;
+        if (!g_atomic_int_get(&saf.offline) && budget > 0) {
+            saf_forward(budget);
+        }
+    }
+    return NULL;
+}
+
+static void
+saf_store (GstBuffer *buffer)
+{
+    if (g_async_queue_length(saf.pending) >= saf.max_pending) {
+        g_mutex_lock(&saf.lock);
+        saf.dropped += gst_buffer_get_size(buffer);
+        g_mutex_unlock(&saf.lock);
+        return;
+    }
+    gsize size = gst_buffer_get_size(buffer);
+    guint8 *data = g_malloc(size);
+    gst_buffer_extract(buffer, 0, data, size);
+    g_async_queue_push(saf.pending, g_bytes_new_take(data, size));
+}
+
+static gboolean
+saf_store_list_item (GstBuffer **buffer, guint idx, gpointer user_data)
+{
+    saf_store(*buffer);
+    return TRUE;
+}
+
+/* in front of udpsink: packets are stored instead of sent while the destination is unreachable */
+static GstPadProbeReturn
+saf_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    if (!g_atomic_int_get(&saf.offline)) {
+        gsize size = GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST
+                     ? gst_buffer_list_calculate_size(GST_PAD_PROBE_INFO_BUFFER_LIST (info))
+                     : gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER (info));
+        g_atomic_int_add(&saf.live_bytes, size);
+        return GST_PAD_PROBE_OK;
+    }
+    if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST (info), saf_store_list_item, NULL);
+    } else {
+        saf_store(GST_PAD_PROBE_INFO_BUFFER (info));
+    }
+    return GST_PAD_PROBE_DROP;
+}
+
+static void
+saf_start (GstElement *udpsink, const gchar *host, int port, int bitrate)
+{
+    if (!store_forward || !store_forward_dir) {
+        return;
+    }
+    memset(&saf.dest, 0, sizeof (saf.dest));
+    saf.dest.sin_family = AF_INET;
+    saf.dest.sin_port = htons(port);
+    inet_pton(AF_INET, host, &saf.dest.sin_addr);
+    saf.backlog = saf.dest;
+    saf.backlog.sin_port = htons(store_forward_port);
+    saf.socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (saf.socket < 0) {
+        GST_WARNING ("Can't create the backlog socket: %s", g_strerror(errno));
+        return;
+    }
+    saf.rate = (gint64) MAX (store_forward_rate_factor, 2) * bitrate / 8;
+
+    /* a backlog of an earlier run can't be told apart from this one's, so it is cleared */
+    g_mkdir_with_parents(store_forward_dir, 0700);
+    GDir *dir = g_dir_open(store_forward_dir, 0, NULL);
+    if (dir) {
+        const gchar *name;
+        while ((name = g_dir_read_name(dir))) {
+            if (g_str_has_prefix(name, "segment-")) {
+                gchar *path = g_build_filename(store_forward_dir, name, NULL);
+                g_remove(path);
+                g_free(path);
+            }
+        }
+        g_dir_close(dir);
+    }
+    saf.first = saf.next = 0;
+    saf.stored = saf.forwarded = saf.dropped = 0;
+    saf.offline = !saf_reachable(&saf.dest);
+    saf.live_bytes = 0;
+    saf.pending = g_async_queue_new_full((GDestroyNotify) g_bytes_unref);
+    /* with a memory budget, packets waiting for the disk may take a sixteenth of it */
+    saf.max_pending = memory_budget_mb ? CLAMP ((gint64) memory_budget_mb * 1024 * 1024 / 16 / 1500, 64, SAF_MAX_PENDING) : SAF_MAX_PENDING;
+    saf.running = TRUE;
+    saf.thread = g_thread_new("store-forward", saf_worker, NULL);
+
+    GstPad *pad = gst_element_get_static_pad(udpsink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, saf_probe, NULL, NULL);
+    gst_object_unref(pad);
+    GST_INFO ("Store-and-forward to %s, backlog port %d, up to %dx the bitrate", store_forward_dir, store_forward_port,
+              MAX (store_forward_rate_factor, 2));
+}
+
+/* the pipeline is in NULL state, what wasn't forwarded is lost */
+static void
+saf_stop (void)
+{
+    if (!saf.thread) {
+        return;
+    }
+    g_atomic_int_set(&saf.running, FALSE);
+    g_thread_join(saf.thread);
+    saf.thread = NULL;
+    g_async_queue_unref(saf.pending);
+    saf.pending = NULL;
+    if (saf.writer) { fclose(saf.writer); saf.writer = NULL; }
+    if (saf.reader) { fclose(saf.reader); saf.reader = NULL; }
+    while (saf.first < saf.next) {
+        saf_drop_oldest(TRUE);
+    }
+    close(saf.socket);
+    saf.offline = FALSE;
+    /* the next stream may go without RTCP, where this one's last packet would read as a receiver gone */
+    g_mutex_lock(&receiver_reports.lock);
+    receiver_reports.last_rtcp_at = 0;
+    g_mutex_unlock(&receiver_reports.lock);
+}
+
+/* bound to the port it sends to if that is free, so a receiver can send its RTCP back without learning the port */
+static GSocket *
+bundle_socket_get (guint16 port)
+{
+    GError *error = NULL;
+
+    if (bundle_socket) {
+        return bundle_socket;
+    }
+    bundle_socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, &error);
+    if (bundle_socket) {
+        GInetAddress *any = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+        GSocketAddress *address = g_inet_socket_address_new(any, port);
+        if (!g_socket_bind(bundle_socket, address, FALSE, NULL)) {
+            g_object_unref(address);
+            address = g_inet_socket_address_new(any, 0);
+            if (!g_socket_bind(bundle_socket, address, FALSE, &error)) {
+                g_clear_object(&bundle_socket);
+            }
+        }
+        g_object_unref(address);
+        g_object_unref(any);
+    }
+    if (!bundle_socket) {
+        GST_WARNING ("Can't open the bundle socket: %s", error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    /* random, but never the same for both streams */
+    bundle_video_ssrc = g_random_int();
+    do {
+        bundle_audio_ssrc = g_random_int();
+    } while (bundle_audio_ssrc == bundle_video_ssrc);
+    return bundle_socket;
+}
+
+static guint16
+bundle_local_port (void)
+{
+    GSocketAddress *address = bundle_socket ? g_socket_get_local_address(bundle_socket, NULL) : NULL;
+    guint16 port = 0;
+
+    if (address) {
+        port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS (address));
+        g_object_unref(address);
+    }
+    return port;
+}
+
+static void
+receiver_report_reset (struct ReceiverReport *report, guint32 ssrc, guint clock_rate)
+{
+    g_mutex_lock(&receiver_reports.lock);
+    memset(report, 0, sizeof (*report));
+    report->ssrc = ssrc;
+    report->clock_rate = clock_rate;
+    report->rtt = -1;
+    g_mutex_unlock(&receiver_reports.lock);
+}
+
+static struct ReceiverReport *
+receiver_report_for (guint32 ssrc)
+{
+    if (receiver_reports.video.clock_rate && ssrc == receiver_reports.video.ssrc) {
+        return &receiver_reports.video;
+    }
+    if (receiver_reports.audio.clock_rate && ssrc == receiver_reports.audio.ssrc) {
+        return &receiver_reports.audio;
+    }
+    return NULL;
+}
+
+/* report blocks of RR and SR; the round trip is now - LSR - DLSR, in 1/65536 s */
+static void
+receiver_report_blocks (GstRTCPPacket *packet)
+{
+    guint32 now = (guint32) (unix_us_to_ntp(g_get_real_time()) >> 16);
+
+    for (guint i = 0; i < gst_rtcp_packet_get_rb_count(packet); i++) {
+        guint32 ssrc, highest, jitter, lsr, dlsr;
+        guint8 fraction;
+        gint32 lost;
+        gst_rtcp_packet_get_rb(packet, i, &ssrc, &fraction, &lost, &highest, &jitter, &lsr, &dlsr);
+        struct ReceiverReport *report = receiver_report_for(ssrc);
+        if (!report) {
+            continue;
+        }
+        report->reports++;
+        report->fraction_lost = fraction;
+        report->cumulative_lost = lost;
+        report->jitter = jitter;
+        if (lsr) {
+            report->rtt = (gint) ((guint64) (guint32) (now - lsr - dlsr) * 1000 / 65536);
+        }
+    }
+}
+
+/* the XR block accessors came with GStreamer 1.16, older SDKs only get the receiver reports */
+#if GST_CHECK_VERSION(1, 16, 0)
+static void
+receiver_report_rle_run (struct ReceiverReport *report, gboolean received, guint count, guint *burst, guint *remaining)
+{
+    /* the last bit vector is padded beyond the end of the range */
+    count = MIN (count, *remaining);
+    *remaining -= count;
+    if (received) {
+        report->rle_received += count;
+        *burst = 0;
+    } else {
+        report->rle_lost += count;
+        *burst += count;
+        report->rle_longest_burst = MAX (report->rle_longest_burst, *burst);
+    }
+}
+
+/* RFC 3611 4.1: run length chunks and 15-bit vectors, 1 for received; with thinning T every 2^T-th packet is reported */
+static void
+receiver_report_rle (GstRTCPPacket *packet)
+{
+    struct ReceiverReport *report;
+    guint32 ssrc, chunks;
+    guint8 thinning;
+    guint16 begin, end, chunk;
+    guint burst = 0, remaining;
+
+    if (!gst_rtcp_packet_xr_get_rle_info(packet, &ssrc, &thinning, &begin, &end, &chunks) || !(report = receiver_report_for(ssrc))) {
+        return;
+    }
+    /* end is one past the last packet */
+    remaining = (guint16) (end - begin) >> thinning;
+    report->rle = TRUE;
+    report->rle_received = report->rle_lost = report->rle_longest_burst = 0;
+    for (guint i = 0; i < chunks && gst_rtcp_packet_xr_get_rle_nth_chunk(packet, i, &chunk) && chunk; i++) {
+        if (chunk & 0x8000) {
+            for (gint bit = 14; bit >= 0; bit--) {
+                receiver_report_rle_run(report, (chunk >> bit) & 1, 1, &burst, &remaining);
+            }
+        } else {
+            receiver_report_rle_run(report, chunk & 0x4000, chunk & 0x3fff, &burst, &remaining);
+        }
+    }
+    report->rle_received <<= thinning;
+    report->rle_lost <<= thinning;
+}
+
+static void
+receiver_report_xr (GstRTCPPacket *packet)
+{
+    struct ReceiverReport *report;
+    guint32 ssrc, jitter_min, jitter_dev;
+    guint16 begin, end;
+
+    for (gboolean more = gst_rtcp_packet_xr_first_rb(packet); more; more = gst_rtcp_packet_xr_next_rb(packet)) {
+        switch (gst_rtcp_packet_xr_get_block_type(packet)) {
+            case GST_RTCP_XR_TYPE_LRLE:
+                receiver_report_rle(packet);
+                break;
+            case GST_RTCP_XR_TYPE_SSUMM:
+                if (gst_rtcp_packet_xr_get_summary_info(packet, &ssrc, &begin, &end) && (report = receiver_report_for(ssrc))) {
+                    report->summary = TRUE;
+                    gst_rtcp_packet_xr_get_summary_pkt(packet, &report->summary_lost, &report->summary_dup);
+                    gst_rtcp_packet_xr_get_summary_jitter(packet, &jitter_min, &report->summary_jitter_max,
+                                                          &report->summary_jitter_mean, &jitter_dev);
+                }
+                break;
+            case GST_RTCP_XR_TYPE_VOIP_METRICS:
+                if (gst_rtcp_packet_xr_get_voip_metrics_ssrc(packet, &ssrc) && (report = receiver_report_for(ssrc))) {
+                    report->voip = TRUE;
+                    gst_rtcp_packet_xr_get_voip_packet_metrics(packet, &report->loss_rate, &report->discard_rate);
+                    gst_rtcp_packet_xr_get_voip_burst_metrics(packet, &report->burst_density, &report->gap_density,
+                                                              &report->burst_duration, &report->gap_duration);
+                    gst_rtcp_packet_xr_get_voip_delay_metrics(packet, &report->roundtrip_delay, &report->end_system_delay);
+                    gst_rtcp_packet_xr_get_voip_quality_metrics(packet, &report->r_factor, &report->ext_r_factor,
+                                                                &report->mos_lq, &report->mos_cq);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+#endif
+
+static void hybrid_update (const struct ReceiverReport *report);
+
+static void
+receiver_report_route_ssrc (guint32 ssrc, gboolean *video, gboolean *audio)
+{
+    if (ssrc == bundle_video_ssrc) {
+        *video = TRUE;
+    } else if (ssrc == bundle_audio_ssrc) {
+        *audio = TRUE;
+    }
+}
+
+/* which of the bundled streams a compound packet is about, by the media SSRCs of its report blocks, XR blocks and
+ * feedback; one naming none (SDES, BYE) is about both */
+static void
+receiver_report_route (GstRTCPBuffer *rtcp, gboolean *video, gboolean *audio)
+{
+    GstRTCPPacket packet;
+    guint32 ssrc;
+
+    *video = *audio = FALSE;
+    for (gboolean more = gst_rtcp_buffer_get_first_packet(rtcp, &packet); more; more = gst_rtcp_packet_move_to_next(&packet)) {
+        switch (gst_rtcp_packet_get_type(&packet)) {
+            case GST_RTCP_TYPE_SR:
+            case GST_RTCP_TYPE_RR:
+                for (guint i = 0; i < gst_rtcp_packet_get_rb_count(&packet); i++) {
+                    gst_rtcp_packet_get_rb(&packet, i, &ssrc, NULL, NULL, NULL, NULL, NULL, NULL);
+                    receiver_report_route_ssrc(ssrc, video, audio);
+                }
+                break;
+            case GST_RTCP_TYPE_RTPFB:
+            case GST_RTCP_TYPE_PSFB:
+                receiver_report_route_ssrc(gst_rtcp_packet_fb_get_media_ssrc(&packet), video, audio);
+                break;
+#if GST_CHECK_VERSION(1, 16, 0)
+            case GST_RTCP_TYPE_XR:
+                for (gboolean block = gst_rtcp_packet_xr_first_rb(&packet); block; block = gst_rtcp_packet_xr_next_rb(&packet)) {
+                    guint32 chunks;
+                    guint16 begin, end;
+                    guint8 thinning;
+                    if (gst_rtcp_packet_xr_get_rle_info(&packet, &ssrc, &thinning, &begin, &end, &chunks)
+                        || gst_rtcp_packet_xr_get_summary_info(&packet, &ssrc, &begin, &end)
+                        || gst_rtcp_packet_xr_get_voip_metrics_ssrc(&packet, &ssrc)) {
+                        receiver_report_route_ssrc(ssrc, video, audio);
+                    }
+                }
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+    if (!*video && !*audio) {
+        *video = *audio = TRUE;
+    }
+}
+
+/* receiver reports arriving on the bundle socket: rtpsession gets those about the video, the audio session those
+ * about the audio */
+static GstPadProbeReturn
+receiver_report_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+    GstRTCPPacket packet;
+    guint video_reports;
+    gboolean video, audio;
+
+    if (!gst_rtcp_buffer_map(buffer, GST_MAP_READ, &rtcp)) {
+        return GST_PAD_PROBE_OK;
+    }
+    receiver_report_route(&rtcp, &video, &audio);
+    g_mutex_lock(&receiver_reports.lock);
+    receiver_reports.last_rtcp_at = g_get_monotonic_time();
+    video_reports = receiver_reports.video.reports;
+    for (gboolean more = gst_rtcp_buffer_get_first_packet(&rtcp, &packet); more; more = gst_rtcp_packet_move_to_next(&packet)) {
+        switch (gst_rtcp_packet_get_type(&packet)) {
+            case GST_RTCP_TYPE_SR:
+            case GST_RTCP_TYPE_RR:
+                receiver_report_blocks(&packet);
+                break;
+#if GST_CHECK_VERSION(1, 16, 0)
+            case GST_RTCP_TYPE_XR:
+                receiver_report_xr(&packet);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+    /* once the whole compound packet is in, its XR blocks included */
+    if (receiver_reports.video.reports != video_reports) {
+        hybrid_update(&receiver_reports.video);
+    }
+    gst_rtcp_buffer_unmap(&rtcp);
+    if (audio && receiver_reports.audio_rtcp) {
+        /* stamped again by the appsrc, in the audio pipeline's time */
+        GstBuffer *copy = gst_buffer_copy(buffer);
+        GstFlowReturn ret;
+        GST_BUFFER_PTS (copy) = GST_BUFFER_DTS (copy) = GST_CLOCK_TIME_NONE;
+        g_signal_emit_by_name(receiver_reports.audio_rtcp, "push-buffer", copy, &ret);
+        gst_buffer_unref(copy);
+    }
+    g_mutex_unlock(&receiver_reports.lock);
+    return video ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+/* sends through the bundle socket, which the sink must leave open for the other stream */
+static void
+bundle_configure_sink (GstElement *udpsink)
+{
+    g_object_set(G_OBJECT(udpsink), "socket", bundle_socket, "close-socket", FALSE, NULL);
+}
+
+static void
+receiver_report_append (struct ReceiverReport *report, const gchar *name, GString *text)
+{
+    g_mutex_lock(&receiver_reports.lock);
+    if (report->reports) {
+        g_string_append_printf(text, "Receiver (%s): %.1f%% lost (%d total), jitter %.1f ms", name,
+                               report->fraction_lost * 100.0 / 256, report->cumulative_lost,
+                               report->jitter * 1000.0 / report->clock_rate);
+        if (report->rtt >= 0) {
+            g_string_append_printf(text, ", RTT %d ms", report->rtt);
+        }
+        g_string_append_printf(text, ", %u reports\n", report->reports);
+    }
+    if (report->rle) {
+        g_string_append_printf(text, "  XR losses: %u received, %u lost, longest burst %u\n",
+                               report->rle_received, report->rle_lost, report->rle_longest_burst);
+    }
+    if (report->summary) {
+        g_string_append_printf(text, "  XR summary: %u lost, %u duplicates, jitter mean %.1f ms, max %.1f ms\n",
+                               report->summary_lost, report->summary_dup,
+                               report->summary_jitter_mean * 1000.0 / report->clock_rate,
+                               report->summary_jitter_max * 1000.0 / report->clock_rate);
+    }
+    if (report->voip) {
+        g_string_append_printf(text, "  XR VoIP: loss %.1f%%, discard %.1f%%, burst density %.0f%% over %u ms, gap density %.0f%% over %u ms, "
+                                     "round trip %u ms, end system delay %u ms",
+                               report->loss_rate * 100.0 / 256, report->discard_rate * 100.0 / 256,
+                               report->burst_density * 100.0 / 256, report->burst_duration,
+                               report->gap_density * 100.0 / 256, report->gap_duration,
+                               report->roundtrip_delay, report->end_system_delay);
+        if (report->r_factor != 127) {
+            g_string_append_printf(text, ", R %u", report->r_factor);
+        }
+        if (report->mos_lq != 127) {
+            g_string_append_printf(text, ", MOS-LQ %.1f, MOS-CQ %.1f", report->mos_lq / 10.0, report->mos_cq / 10.0);
+        }
+        g_string_append(text, "\n");
+    }
+    g_mutex_unlock(&receiver_reports.lock);
+}
+
+static gboolean
+is_rtp_session (GstElement *element)
+{
+    GstElementFactory *factory = gst_element_get_factory(element);
+    return factory && g_strcmp0(GST_OBJECT_NAME (factory), "rtpsession") == 0;
+}
+
+/* links two neighbours of a branch, rtpsession's RTP path goes through its request pads */
+static gboolean
+link_rtp_aware (GstElement *upstream, GstElement *downstream)
+{
+    if (is_rtp_session(downstream)) {
+        /* requesting send_rtp_sink makes send_rtp_src appear */
+        GstPad *pad = gst_element_get_request_pad(downstream, "send_rtp_sink");
+        gst_object_unref(pad);
+        return gst_element_link_pads(upstream, NULL, downstream, "send_rtp_sink");
+    }
+    return gst_element_link_pads(upstream, is_rtp_session(upstream) ? "send_rtp_src" : NULL, downstream, NULL);
+}
+
+/* RTCP of the session goes out through the funnel, interleaved with RTP (rtcp-mux) */
+static void
+bundle_link_rtcp (GstElement *session, GstElement *funnel)
+{
+    GstPad *rtcp_src = gst_element_get_request_pad(session, "send_rtcp_src");
+    GstPad *funnel_sink = gst_element_get_request_pad(funnel, "sink_%u");
+
+    if (gst_pad_link(rtcp_src, funnel_sink) != GST_PAD_LINK_OK) {
+        GST_DEBUG ("Failed to link RTCP of %s!\n", GST_ELEMENT_NAME (session));
+    }
+    gst_object_unref(rtcp_src);
+    gst_object_unref(funnel_sink);
+}
+
+/* the video session also takes the receiver's RTCP, which arrives on the bundle socket */
+static void
+bundle_link (GstElement *pipeline)
+{
+    bundle_link_rtcp(branch->session, branch->funnel);
+
+    branch->rtcp_source = gst_element_factory_make("udpsrc", "rtcp_source");
+    if (!branch->rtcp_source) {
+        GST_WARNING ("udpsrc is null, receiver reports are ignored!");
+        return;
+    }
+    GstCaps *caps = gst_caps_new_empty_simple("application/x-rtcp");
+    g_object_set(G_OBJECT(branch->rtcp_source), "socket", bundle_socket, "close-socket", FALSE, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_bin_add(GST_BIN (pipeline), branch->rtcp_source);
+    if (!gst_element_link_pads(branch->rtcp_source, "src", branch->session, "recv_rtcp_sink")) {
+        GST_DEBUG ("Failed to link the RTCP source!\n");
+    }
+
+    receiver_report_reset(&receiver_reports.video, bundle_video_ssrc, 90000);
+    g_mutex_lock(&receiver_reports.lock);
+    receiver_reports.last_rtcp_at = 0;
+    g_mutex_unlock(&receiver_reports.lock);
+    GstPad *pad = gst_element_get_static_pad(branch->rtcp_source, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, receiver_report_probe, NULL, NULL);
+    gst_object_unref(pad);
+}
+
+static void
+bundle_unlink (GstElement *pipeline)
+{
+    if (!branch->rtcp_source) {
+        return;
+    }
+    gst_element_unlink(branch->rtcp_source, branch->session);
+    gst_bin_remove(GST_BIN (pipeline), branch->rtcp_source);
+    branch->rtcp_source = NULL;
+}
+
+/* makes the RTP payloader matching the codec */
+static GstElement *
+make_video_payloader (int codec)
+{
+    switch (codec) {
+        case CODEC_H265:
+            return gst_element_factory_make("rtph265pay", "rtp");
+        case CODEC_AV1:
+            return gst_element_factory_make("rtpav1pay", "rtp");
+        case CODEC_VP8:
+            return gst_element_factory_make("rtpvp8pay", "rtp");
+        case CODEC_VP9:
+            return gst_element_factory_make("rtpvp9pay", "rtp");
+        default:
+            return gst_element_factory_make("rtph264pay", "rtp");
+    }
+}
+
+/* moves videocrop to the region of interest, even offsets keep the chroma planes aligned */
+static void
+roi_apply (void)
+{
+    struct Roi region;
+
+    if (!branch->crop) {
+        return;
+    }
+    roi_clamp(&roi, capture_width, capture_height, &region);
+    g_object_set(G_OBJECT(branch->crop),
+                 "left", region.left,
+                 "right", capture_width - region.left - region.width,
+                 "top", region.top,
+                 "bottom", capture_height - region.top - region.height,
+                 NULL);
+    GST_DEBUG ("Region of interest %dx%d at %d,%d of %dx%d", region.width, region.height, region.left, region.top,
+               capture_width, capture_height);
+}
+
+/*
+ * videocrop only changes its output caps when the region moves, videoscale takes them and keeps giving the stream size,
+ * so nothing upstream or downstream renegotiates. videocrop hands the region over as GstVideoCropMeta where downstream
+ * accepts it; videoscale doesn't, so the region alone is copied out, and only the region is scaled, with ORC SIMD.
+ */
+static void
+roi_make (int width, int height)
+{
+    branch->crop = gst_element_factory_make("videocrop", "crop");
+    branch->crop_scale = gst_element_factory_make("videoscale", "crop_scale");
+    branch->crop_filter = gst_element_factory_make("capsfilter", "crop_filter");
+    if (!branch->crop || !branch->crop_scale || !branch->crop_filter) {
+        GST_WARNING ("videocrop is null, streaming the whole frame!");
+        if (branch->crop) { gst_object_unref(branch->crop); }
+        if (branch->crop_scale) { gst_object_unref(branch->crop_scale); }
+        if (branch->crop_filter) { gst_object_unref(branch->crop_filter); }
+        branch->crop = branch->crop_scale = branch->crop_filter = NULL;
+        return;
+    }
+    /* a region of another aspect ratio is letterboxed rather than stretched */
+    g_object_set(G_OBJECT(branch->crop_scale), "add-borders", TRUE, NULL);
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "width", G_TYPE_INT, width,
+                                        "height", G_TYPE_INT, height,
+                                        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1,
+                                        NULL);
+    g_object_set(G_OBJECT(branch->crop_filter), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    roi_apply();
+}
+
+/*
+ * Sends datagrams with DF set (IP_PMTUDISC_PROBE also ignores a stale cached path MTU) towards the host, starting at
+ * the MTU of the route's interface, which is already the lower one on VPN/tunnel links. A router that can't forward
+ * a probe answers ICMP Fragmentation Needed with its next-hop MTU, the next probe is sent at that size. A port
+ * unreachable from the host itself, or no answer at all, means the probe got through.
+ */
+static int
+pmtu_probe (const gchar *host)
+{
+    struct sockaddr_in dest;
+    int fd, value;
+    int mtu = PMTU_DEFAULT;
+    socklen_t length = sizeof (mtu);
+
+    memset(&dest, 0, sizeof (dest));
+    dest.sin_family = AF_INET;
+    dest.sin_port = htons(PMTU_PROBE_PORT);
+    if (inet_pton(AF_INET, host, &dest.sin_addr) != 1 || (fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        return PMTU_DEFAULT;
+    }
+    value = IP_PMTUDISC_PROBE;
+    setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof (value));
+    value = 1;
+    setsockopt(fd, IPPROTO_IP, IP_RECVERR, &value, sizeof (value));
+    if (connect(fd, (const struct sockaddr *) &dest, sizeof (dest)) != 0) {
+        close(fd);
+        return PMTU_DEFAULT;
+    }
+    getsockopt(fd, IPPROTO_IP, IP_MTU, &mtu, &length);
+    path_mtu.interface_mtu = mtu;
+    path_mtu.reductions = 0;
+
+    guint8 *probe = g_malloc0(mtu);
+    for (int round = 0; round < PMTU_PROBE_ROUNDS; round++) {
+        if (send(fd, probe, mtu - IPV4_UDP_OVERHEAD, 0) < 0 && errno != EMSGSIZE) {
+            break;
+        }
+        /* errors queued by IP_RECVERR are reported as POLLERR */
+        struct pollfd pfd = {fd, 0, 0};
+        if (poll(&pfd, 1, PMTU_PROBE_TIMEOUT_MS) <= 0) {
+            break;
+        }
+
+        guint8 control[256];
+        struct msghdr message;
+        memset(&message, 0, sizeof (message));
+        message.msg_control = control;
+        message.msg_controllen = sizeof (control);
+        if (recvmsg(fd, &message, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+        struct sock_extended_err *error = NULL;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&message); cmsg; cmsg = CMSG_NXTHDR (&message, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) {
+                error = (struct sock_extended_err *) CMSG_DATA (cmsg);
+            }
+        }
+        if (!error || error->ee_errno != EMSGSIZE || !pmtu_usable_report(mtu, error->ee_info)) {
+            break;
+        }
+        mtu = error->ee_info;
+        path_mtu.reductions++;
+    }
+    g_free(probe);
+    close(fd);
+    return MAX (mtu, PMTU_MIN);
+}
+
+/*
+ * Sizes RTP packets to the path MTU, leaving room for the header extension, the SRTP tag and, when FEC is on, the
+ * ULPFEC headers (rtpulpfecenc makes FEC packets as long as the longest protected packet plus its headers). With
+ * openh264enc the frame is split into about as many slices as an average frame needs packets, so most slices travel
+ * in one packet and a loss takes out one slice rather than a fragment of the whole frame.
+ */
+static void
+pmtu_apply (const gchar *host, int bitrate, int framerate)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (!path_mtu_discovery) {
+        return;
+    }
+    /* re-probed for a new destination */
+    if (strcmp(path_mtu.host, host) != 0 || !path_mtu.probed_at || now - path_mtu.probed_at > PMTU_REPROBE_INTERVAL) {
+        path_mtu.mtu = pmtu_probe(host);
+        path_mtu.probed_at = now;
+        g_strlcpy(path_mtu.host, host, sizeof (path_mtu.host));
+        GST_INFO ("Path MTU to %s: %d (interface %d)", host, path_mtu.mtu, path_mtu.interface_mtu);
+    }
+
+    int rtp_mtu = pmtu_rtp_mtu(path_mtu.mtu, abs_capture_time, branch->srtp ? srtp_cipher_overhead(srtp_cipher) : 0,
+                               branch->fec != NULL, branch->rtx != NULL);
+    path_mtu.rtp_mtu = rtp_mtu;
+    g_object_set(G_OBJECT(branch->rtp), "mtu", (guint) rtp_mtu, NULL);
+
+    path_mtu.slices = 0;
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS (branch->encoder), "num-slices") && framerate > 0) {
+        path_mtu.slices = pmtu_slices(bitrate, framerate, rtp_mtu);
+        gst_util_set_object_arg(G_OBJECT(branch->encoder), "slice-mode", "n-slices");
+        g_object_set(G_OBJECT(branch->encoder), "num-slices", (guint) path_mtu.slices, NULL);
+    }
+}
+
+static void
+uep_mark (GstBuffer *buffer, int class)
+{
+    GST_BUFFER_FLAG_UNSET (buffer, GST_BUFFER_FLAG_HEADER | GST_BUFFER_FLAG_NON_DROPPABLE
+                                   | GST_BUFFER_FLAG_DELTA_UNIT | GST_BUFFER_FLAG_DROPPABLE);
+    switch (class) {
+        case UEP_PARAMETER_SETS:
+            GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_HEADER | GST_BUFFER_FLAG_NON_DROPPABLE);
+            break;
+        case UEP_KEYFRAME:
+            GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_NON_DROPPABLE);
+            break;
+        case UEP_REFERENCE:
+            GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+            break;
+        default:
+            GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT | GST_BUFFER_FLAG_DROPPABLE);
+            break;
+    }
+}
+
+static int
+uep_class_of (GstBuffer *buffer)
+{
+    if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER)) {
+        return UEP_PARAMETER_SETS;
+    }
+    if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_NON_DROPPABLE)) {
+        return UEP_KEYFRAME;
+    }
+    return GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DROPPABLE) ? UEP_NON_REFERENCE : UEP_REFERENCE;
+}
+
+static gboolean
+uep_classify_buffer (GstBuffer **buffer, guint idx, gpointer user_data)
+{
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    int class = -1;
+
+    if (!gst_rtp_buffer_map(*buffer, GST_MAP_READ, &rtp)) {
+        return TRUE;
+    }
+    guint32 timestamp = gst_rtp_buffer_get_timestamp(&rtp);
+    class = uep_classify(stream_codec, gst_rtp_buffer_get_payload(&rtp), gst_rtp_buffer_get_payload_len(&rtp));
+    gst_rtp_buffer_unmap(&rtp);
+
+    /* a new frame starts as reference until its packets tell otherwise */
+    if (timestamp != uep.frame_timestamp) {
+        uep.frame_timestamp = timestamp;
+        uep.frame_class = UEP_REFERENCE;
+    }
+    if (class < 0) {
+        class = uep.frame_class;
+    } else if (class != UEP_PARAMETER_SETS) {
+        uep.frame_class = class;
+    }
+    *buffer = gst_buffer_make_writable(*buffer);
+    uep_mark(*buffer, class);
+    return TRUE;
+}
+
+/* on the payloader's source pad, before rtpulpfecenc reads the flags */
+static GstPadProbeReturn
+uep_classify_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = gst_buffer_list_make_writable(GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+        gst_buffer_list_foreach(list, uep_classify_buffer, NULL);
+        GST_PAD_PROBE_INFO_DATA (info) = list;
+    } else {
+        GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER (info));
+        uep_classify_buffer(&buffer, 0, NULL);
+        GST_PAD_PROBE_INFO_DATA (info) = buffer;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/* counts what leaves per class and queues the copies, the RTP header is readable even with SRTP */
+static gboolean
+uep_count_buffer (GstBuffer **buffer, guint idx, gpointer user_data)
+{
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    gsize size = gst_buffer_get_size(*buffer);
+
+    if (!gst_rtp_buffer_map(*buffer, GST_MAP_READ, &rtp)) {
+        return TRUE;
+    }
+    guint8 pt = gst_rtp_buffer_get_payload_type(&rtp);
+    gst_rtp_buffer_unmap(&rtp);
+
+    g_mutex_lock(&uep.lock);
+    if (pt == FEC_PAYLOAD_TYPE) {
+        uep.counters[uep.fec_class].fec_packets++;
+        uep.counters[uep.fec_class].fec_bytes += size;
+        uep.fec_sent = TRUE;
+    } else if (pt == VIDEO_PAYLOAD_TYPE) {
+        int class = uep_class_of(*buffer);
+        uep.counters[class].packets++;
+        uep.counters[class].bytes += size;
+        uep.fec_class = uep.fec_sent ? class : MIN (uep.fec_class, class);
+        uep.fec_sent = FALSE;
+        uep.sent++;
+        for (guint i = 0; i < uep_duplicates[class] && uep.pending.length < UEP_MAX_PENDING; i++) {
+            struct UepDuplicate *duplicate = g_new(struct UepDuplicate, 1);
+            duplicate->buffer = gst_buffer_ref(*buffer);
+            duplicate->class = class;
+            duplicate->due = uep.sent + (i + 1) * UEP_DUPLICATE_SPACING;
+            g_queue_push_tail(&uep.pending, duplicate);
+        }
+    }
+    g_mutex_unlock(&uep.lock);
+    return TRUE;
+}
+
+/* writes a copy to udpsink's socket; while store-and-forward holds the stream back its copies are dropped, the
+ * backlog carries the originals */
+static void
+uep_send_duplicate (struct UepDuplicate *duplicate)
+{
+    GstMapInfo map;
+
+    if (!uep.socket || !uep.destination || g_atomic_int_get(&saf.offline)
+        || !gst_buffer_map(duplicate->buffer, &map, GST_MAP_READ)) {
+        return;
+    }
+    if (g_socket_send_to(uep.socket, uep.destination, (const gchar *) map.data, map.size, NULL, NULL) >= 0) {
+        g_mutex_lock(&uep.lock);
+        uep.counters[duplicate->class].duplicate_packets++;
+        uep.counters[duplicate->class].duplicate_bytes += map.size;
+        g_mutex_unlock(&uep.lock);
+    }
+    gst_buffer_unmap(duplicate->buffer, &map);
+}
+
+/* on udpsink's sink pad, copies that are due go out in front of the packet at hand */
+static GstPadProbeReturn
+uep_send_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstElement *udpsink = user_data;
+
+    if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST (info), uep_count_buffer, NULL);
+    } else {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+        uep_count_buffer(&buffer, 0, NULL);
+    }
+
+    /* udpsink opens its socket when it starts, or takes the bundle's */
+    if (!uep.socket) {
+        g_object_get(G_OBJECT(udpsink), "used-socket", &uep.socket, NULL);
+    }
+    for (GList *item = uep.pending.head; item;) {
+        struct UepDuplicate *duplicate = item->data;
+        GList *next = item->next;
+        if (duplicate->due <= uep.sent) {
+            g_queue_delete_link(&uep.pending, item);
+            uep_send_duplicate(duplicate);
+            gst_buffer_unref(duplicate->buffer);
+            g_free(duplicate);
+        }
+        item = next;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+uep_start (GstElement *payloader, GstElement *udpsink)
+{
+    /* fan-out can't read an encrypted payload, it takes the classes from the flags too */
+    if (!unequal_protection && !(branch->fanout_tee && branch->srtp)) {
+        return;
+    }
+    g_mutex_lock(&uep.lock);
+    memset(uep.counters, 0, sizeof (uep.counters));
+    uep.frame_timestamp = 0;
+    uep.frame_class = UEP_REFERENCE;
+    uep.fec_class = UEP_REFERENCE;
+    uep.fec_sent = TRUE;
+    uep.sent = 0;
+    g_mutex_unlock(&uep.lock);
+
+    GstPad *pad = gst_element_get_static_pad(payloader, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, uep_classify_probe, NULL, NULL);
+    gst_object_unref(pad);
+    if (!unequal_protection) {
+        return;
+    }
+    gchar *host = NULL;
+    gint port = 0;
+    g_object_get(G_OBJECT(udpsink), "host", &host, "port", &port, NULL);
+    uep.destination = host ? g_inet_socket_address_new_from_string(host, port) : NULL;
+    g_free(host);
+    pad = gst_element_get_static_pad(udpsink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, uep_send_probe, udpsink, NULL);
+    gst_object_unref(pad);
+}
+
+/* the pipeline is stopped, copies still waiting are dropped */
+static void
+uep_stop (void)
+{
+    struct UepDuplicate *duplicate;
+
+    while ((duplicate = g_queue_pop_head(&uep.pending))) {
+        gst_buffer_unref(duplicate->buffer);
+        g_free(duplicate);
+    }
+    g_clear_object(&uep.socket);
+    g_clear_object(&uep.destination);
+}
+
+static void
+uep_append (GString *report)
+{
+    g_mutex_lock(&uep.lock);
+    for (int i = 0; i < UEP_CLASSES; i++) {
+        struct UepCounters *counters = &uep.counters[i];
+        if (!counters->packets) {
+            continue;
+        }
+        g_string_append_printf(report, "Protection of %s: %" G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT " KB, "
+                               "FEC +%.0f%% (%" G_GUINT64_FORMAT " packets), copies +%.0f%% (%" G_GUINT64_FORMAT " packets)\n",
+                               uep_class_names[i], counters->packets, counters->bytes / 1024,
+                               100.0 * counters->fec_bytes / counters->bytes, counters->fec_packets,
+                               100.0 * counters->duplicate_bytes / counters->bytes, counters->duplicate_packets);
+    }
+    g_mutex_unlock(&uep.lock);
+}
+
+/* class of a whole encoded frame */
+static int
+scheduler_frame_class (GstBuffer *buffer)
+{
+    GstMapInfo map;
+    int class = -1;
+
+    if ((stream_codec == CODEC_H264 || stream_codec == CODEC_H265) && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        class = uep_classify_bytestream(stream_codec, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    /* the other encoders only tell keyframes apart */
+    if (class < 0) {
+        class = GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) ? UEP_REFERENCE : UEP_KEYFRAME;
+    }
+    return class;
+}
+
+static void
+scheduler_request_keyframe (void)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (scheduler.requested_at && now - scheduler.requested_at < SCHEDULER_KEYFRAME_INTERVAL) {
+        return;
+    }
+    scheduler.requested_at = now;
+    scheduler.keyframe_requests++;
+    GstPad *src = gst_element_get_static_pad(branch->encoder, "src");
+    gst_pad_send_event(src, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, scheduler.keyframe_requests));
+    gst_object_unref(src);
+}
+
+/* on queue_send's source pad: dropping a frame there takes no time, so a backlog drains as soon as it is dropped */
+static GstPadProbeReturn
+scheduler_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    GstClockTime backlog = 0;
+    GstPadProbeReturn ret = GST_PAD_PROBE_OK;
+
+    g_object_get(G_OBJECT(branch->queue_send), "current-level-time", &backlog, NULL);
+    int class = scheduler_frame_class(buffer);
+
+    g_mutex_lock(&scheduler.lock);
+    scheduler.peak_backlog = MAX (scheduler.peak_backlog, backlog);
+    bool was_skipping = scheduler.skipping;
+    switch (scheduler_decide(class, backlog, &scheduler.skipping)) {
+        case SCHEDULER_DROP_SKIPPING:
+            if (!was_skipping) {
+                GST_DEBUG ("Backlog of %" GST_TIME_FORMAT ", dropping up to the next keyframe", GST_TIME_ARGS (backlog));
+            }
+            scheduler_request_keyframe();
+            scheduler.dropped_skipping++;
+            ret = GST_PAD_PROBE_DROP;
+            break;
+        case SCHEDULER_DROP_NON_REFERENCE:
+            scheduler.dropped_non_reference++;
+            ret = GST_PAD_PROBE_DROP;
+            break;
+        default:
+            scheduler.sent++;
+            break;
+    }
+    g_mutex_unlock(&scheduler.lock);
+    return ret;
+}
+
+static void
+scheduler_make (void)
+{
+    branch->queue_send = gst_element_factory_make("queue", "queue_send");
+    if (!branch->queue_send) {
+        GST_WARNING ("queue is null, frames won't be scheduled!");
+        return;
+    }
+    /* bounded by time only, the probe keeps it well below that */
+    g_object_set(G_OBJECT(branch->queue_send),
+                 "max-size-buffers", 0,
+                 "max-size-bytes", 0,
+                 "max-size-time", (guint64) SCHEDULER_MAX_BACKLOG,
+                 NULL);
+
+    g_mutex_lock(&scheduler.lock);
+    scheduler.skipping = false;
+    scheduler.requested_at = 0;
+    scheduler.sent = scheduler.dropped_non_reference = scheduler.dropped_skipping = scheduler.keyframe_requests = 0;
+    scheduler.peak_backlog = 0;
+    g_mutex_unlock(&scheduler.lock);
+
+    GstPad *src = gst_element_get_static_pad(branch->queue_send, "src");
+    gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER, scheduler_probe, NULL, NULL);
+    gst_object_unref(src);
+}
+
+static void
+scheduler_append (GString *report)
+{
+    g_mutex_lock(&scheduler.lock);
+    g_string_append_printf(report, "Frame scheduler: %" G_GUINT64_FORMAT " frames sent, dropped %" G_GUINT64_FORMAT
+                           " non-reference and %" G_GUINT64_FORMAT " up to a keyframe, %" G_GUINT64_FORMAT
+                           " keyframe requests, peak backlog %" G_GUINT64_FORMAT " ms%s\n",
+                           scheduler.sent, scheduler.dropped_non_reference, scheduler.dropped_skipping,
+                           scheduler.keyframe_requests, scheduler.peak_backlog / GST_MSECOND,
+                           scheduler.skipping ? ", waiting for a keyframe" : "");
+    g_mutex_unlock(&scheduler.lock);
+}
+
+/* unsent bytes in the socket of a sink, -1 if it has none (yet) */
+static gint
+sendq_sample (GstElement *sink, gint *buffer)
+{
+    GSocket *socket = NULL;
+    gint queued = -1;
+
+    if (!sink) {
+        return -1;
+    }
+    g_object_get(G_OBJECT(sink), "used-socket", &socket, NULL);
+    if (!socket) {
+        return -1;
+    }
+    if (ioctl(g_socket_get_fd(socket), SIOCOUTQ, &queued) < 0) {
+        queued = -1;
+    }
+    socklen_t length = sizeof (*buffer);
+    getsockopt(g_socket_get_fd(socket), SOL_SOCKET, SO_SNDBUF, buffer, &length);
+    g_object_unref(socket);
+    return queued;
+}
+
+/* called with sendq.lock held, once the last change had the decrease hold to show */
+static void
+sendq_verify (gint64 now)
+{
+    gint64 held = get_video_encoder_bitrate(sendq.encoder);
+    gint64 output = sendq.verify_bytes * 8 * G_TIME_SPAN_SECOND / MAX (now - sendq.changed_at, 1);
+
+    if (sendq_change_applied(held, output, sendq.verify_bitrate, sendq.verify_previous)) {
+        sendq.confirmed++;
+    } else {
+        GST_WARNING ("%s holds %" G_GINT64_FORMAT " bit/s and sends %" G_GINT64_FORMAT " bit/s for bitrate %d",
+                     GST_ELEMENT_NAME (sendq.encoder), held, output, sendq.verify_bitrate);
+        sendq.unapplied++;
+    }
+    sendq.verify_bitrate = 0;
+}
+
+static gpointer
+sendq_worker (gpointer user_data)
+{
+    while (g_atomic_int_get(&sendq.running)) {
+        GstElement *encoder = NULL;
+
+        g_usleep(SENDQ_INTERVAL);
+
+        g_mutex_lock(&sendq.lock);
+        gint video = sendq_sample(sendq.video_sink, &sendq.video_buffer);
+        gint audio = sendq_sample(sendq.audio_sink, &sendq.audio_buffer);
+        sendq.video_bytes = MAX (video, 0);
+        sendq.audio_bytes = MAX (audio, 0);
+        sendq.video_peak = MAX (sendq.video_peak, sendq.video_bytes);
+        sendq.audio_peak = MAX (sendq.audio_peak, sendq.audio_bytes);
+        if (video < 0 || !sendq.encoder) {
+            g_mutex_unlock(&sendq.lock);
+            continue;
+        }
+
+        gint64 now = g_get_monotonic_time();
+        sendq.window_min = MIN (sendq.window_min, sendq.video_bytes + sendq.audio_bytes);
+        if (now - sendq.window_start < SENDQ_WINDOW) {
+            g_mutex_unlock(&sendq.lock);
+            continue;
+        }
+        gint64 queued_ms = (gint64) sendq.window_min * 8 * 1000 / MAX (sendq.bitrate, 1);
+        sendq.window_start = now;
+        sendq.window_min = G_MAXINT;
+        sendq.verify_bytes += g_atomic_int_and(&sendq.encoded_bytes, 0);
+        /* a restart in progress is measured once it is done */
+        if (sendq.restart) {
+            g_mutex_unlock(&sendq.lock);
+            continue;
+        }
+        if (sendq.verify_bitrate && now - sendq.changed_at > SENDQ_DECREASE_HOLD) {
+            sendq_verify(now);
+        }
+        gint bitrate = sendq_next_bitrate(sendq.bitrate, sendq.configured, queued_ms, now, sendq.changed_at,
+                                          &sendq.clear_since);
+        if (bitrate != sendq.bitrate) {
+            GST_DEBUG ("Send queue %" G_GINT64_FORMAT " ms, encoder bitrate %d -> %d", queued_ms, sendq.bitrate, bitrate);
+            if (bitrate < sendq.bitrate) { sendq.decreases++; } else { sendq.increases++; }
+            sendq.verify_previous = sendq.bitrate;
+            sendq.verify_bitrate = sendq.bitrate = bitrate;
+            sendq.changed_at = now;
+            sendq.verify_bytes = 0;
+            encoder = gst_object_ref(sendq.encoder);
+        }
+        g_mutex_unlock(&sendq.lock);
+
+        /* outside the lock, the encoder takes its object lock to set the property */
+        if (encoder) {
+            gboolean playing = set_video_encoder_bitrate(encoder, bitrate);
+            g_mutex_lock(&sendq.lock);
+            if (!playing && g_atomic_int_get(&sendq.running) && !encoder_restart_request(encoder, bitrate)) {
+                GST_WARNING ("%s can't take bitrate %d while it plays", GST_ELEMENT_NAME (encoder), bitrate);
+                sendq.unapplied++;
+                sendq.verify_bitrate = 0;
+            }
+            g_mutex_unlock(&sendq.lock);
+            gst_object_unref(encoder);
+        }
+    }
+    return NULL;
+}
+
+/* the sink's socket is sampled from now on, until sendq_detach */
+static void
+sendq_attach (GstElement **slot, GstElement *sink)
+{
+    g_mutex_lock(&sendq.lock);
+    if (*slot) {
+        gst_object_unref(*slot);
+    }
+    *slot = gst_object_ref(sink);
+    g_mutex_unlock(&sendq.lock);
+}
+
+/* before the sink closes its socket, so the number can't be sampled once it is reused */
+static void
+sendq_detach (GstElement **slot)
+{
+    g_mutex_lock(&sendq.lock);
+    if (*slot) {
+        gst_object_unref(*slot);
+        *slot = NULL;
+    }
+    g_mutex_unlock(&sendq.lock);
+}
+
+/* in the encoder's streaming thread */
+static gboolean
+sendq_count_buffer (GstBuffer **buffer, guint idx, gpointer user_data)
+{
+    g_atomic_int_add(&sendq.encoded_bytes, (gint) gst_buffer_get_size(*buffer));
+    return TRUE;
+}
+
+static GstPadProbeReturn
+sendq_encoded_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST (info), sendq_count_buffer, NULL);
+    } else {
+        g_atomic_int_add(&sendq.encoded_bytes, (gint) gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER (info)));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void
+sendq_start (GstElement *udpsink, GstElement *encoder, int bitrate)
+{
+    GstPad *src;
+
+    if (!send_queue_control) {
+        return;
+    }
+    src = gst_element_get_static_pad(encoder, "src");
+    sendq.encoded_probe = gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                                            sendq_encoded_probe, NULL, NULL);
+    gst_object_unref(src);
+    g_mutex_lock(&sendq.lock);
+    sendq.encoder = gst_object_ref(encoder);
+    sendq.configured = sendq.bitrate = bitrate;
+    sendq.changed_at = sendq.clear_since = 0;
+    sendq.window_start = g_get_monotonic_time();
+    sendq.window_min = G_MAXINT;
+    sendq.decreases = sendq.increases = 0;
+    sendq.confirmed = sendq.restarted = sendq.unapplied = 0;
+    sendq.verify_bitrate = 0;
+    sendq.encoded_bytes = 0;
+    sendq.video_peak = sendq.audio_peak = 0;
+    g_mutex_unlock(&sendq.lock);
+    sendq_attach(&sendq.video_sink, udpsink);
+    sendq.running = TRUE;
+    sendq.thread = g_thread_new("send-queue", sendq_worker, NULL);
+}
+
+static void
+sendq_stop (void)
+{
+    if (!sendq.thread) {
+        return;
+    }
+    g_atomic_int_set(&sendq.running, FALSE);
+    g_thread_join(sendq.thread);
+    sendq.thread = NULL;
+    g_mutex_lock(&sendq.lock);
+    encoder_restart_cancel();
+    if (sendq.encoder && sendq.encoded_probe) {
+        GstPad *src = gst_element_get_static_pad(sendq.encoder, "src");
+        gst_pad_remove_probe(src, sendq.encoded_probe);
+        gst_object_unref(src);
+    }
+    sendq.encoded_probe = 0;
+    g_mutex_unlock(&sendq.lock);
+    sendq_detach(&sendq.video_sink);
+    sendq_detach(&sendq.encoder);
+}
+
+static void
+sendq_append (GString *report)
+{
+    g_mutex_lock(&sendq.lock);
+    g_string_append_printf(report, "Send queue: video %d KB (peak %d of %d KB)",
+                           sendq.video_bytes / 1024, sendq.video_peak / 1024, sendq.video_buffer / 1024);
+    if (sendq.audio_sink) {
+        g_string_append_printf(report, ", audio %d KB (peak %d of %d KB)",
+                               sendq.audio_bytes / 1024, sendq.audio_peak / 1024, sendq.audio_buffer / 1024);
+    }
+    g_string_append_printf(report, ", encoder at %d of %d kbit/s (%u decreases, %u increases",
+                           sendq.bitrate / 1000, sendq.configured / 1000, sendq.decreases, sendq.increases);
+    g_string_append_printf(report, ", %u confirmed", sendq.confirmed);
+    if (sendq.restarted) {
+        g_string_append_printf(report, ", %u by restarting the encoder", sendq.restarted);
+    }
+    if (sendq.unapplied) {
+        g_string_append_printf(report, ", %u not taken by the encoder", sendq.unapplied);
+    }
+    g_string_append(report, ")\n");
+    g_mutex_unlock(&sendq.lock);
+}
+
+static void
+hybrid_apply (const struct HybridDecision *decision)
+{
+    gint important = MIN (2 * decision->fec_percentage, 100);
+
+    if (unequal_protection) {
+        important = MAX (important, UEP_IMPORTANT_PERCENTAGE);
+    }
+    g_object_set(G_OBJECT(branch->fec), "percentage", decision->fec_percentage, "percentage-important", important, NULL);
+}
+
+/* called with receiver_reports.lock held, after every report on the video stream */
+static void
+hybrid_update (const struct ReceiverReport *report)
+{
+    struct HybridDecision decision;
+    gint64 now = g_get_monotonic_time();
+
+    if (!hybrid_protection || !branch->rtx) {
+        return;
+    }
+    g_mutex_lock(&hybrid.lock);
+    hybrid.loss = hybrid.loss * 0.7 + report->fraction_lost * 100.0 / 256 * 0.3;
+    decision.at = now;
+    decision.rtt = report->rtt;
+    decision.loss = hybrid.loss;
+    decision.longest_burst = report->rle ? report->rle_longest_burst : 0;
+    gboolean bursty = decision.longest_burst >= HYBRID_BURST_PACKETS || (report->voip && report->burst_density >= 64);
+    hybrid_decide(decision.rtt, decision.loss, bursty, &decision.mode, &decision.fec_percentage);
+
+    if ((decision.mode != hybrid.current.mode || ABS (decision.fec_percentage - hybrid.current.fec_percentage) >= HYBRID_FEC_MIN)
+        && now - hybrid.current.at >= HYBRID_HOLD) {
+        GST_INFO ("Protection: %s, FEC %d%% (RTT %d ms, loss %.1f%%, longest burst %u)", hybrid_mode_names[decision.mode],
+                  decision.fec_percentage, decision.rtt, decision.loss, decision.longest_burst);
+        hybrid.current = decision;
+        hybrid.log[hybrid.logged++ % HYBRID_LOG] = decision;
+        hybrid_apply(&decision);
+    }
+    g_mutex_unlock(&hybrid.lock);
+}
+
+/* rtpsession turns NACKs into retransmission requests travelling upstream to rtprtxsend, dropped while RTX is off */
+static GstPadProbeReturn
+hybrid_request_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_UPSTREAM
+        || !gst_event_has_name(event, "GstRTPRetransmissionRequest")) {
+        return GST_PAD_PROBE_OK;
+    }
+    g_mutex_lock(&hybrid.lock);
+    gboolean rtx = hybrid.current.mode == HYBRID_RTX || hybrid.current.mode == HYBRID_RTX_FEC;
+    if (!rtx) {
+        hybrid.nacks_dropped++;
+    }
+    g_mutex_unlock(&hybrid.lock);
+    return rtx ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+/* rtprtxsend keeps the packets for the latency budget, FEC starts off until the first report */
+static void
+hybrid_make (void)
+{
+    branch->rtx = gst_element_factory_make("rtprtxsend", "rtx");
+    if (!branch->fec) {
+        branch->fec = gst_element_factory_make("rtpulpfecenc", "fec");
+        if (branch->fec) {
+            g_object_set(G_OBJECT(branch->fec), "pt", FEC_PAYLOAD_TYPE, "multipacket", TRUE, NULL);
+        }
+    }
+    if (!branch->rtx || !branch->fec) {
+        GST_WARNING ("rtprtxsend is null, protection stays fixed!");
+        if (branch->rtx) { gst_object_unref(branch->rtx); }
+        branch->rtx = NULL;
+        return;
+    }
+    GstStructure *map = gst_structure_new("application/x-rtp-pt-map",
+                                          G_STRINGIFY (VIDEO_PAYLOAD_TYPE), G_TYPE_UINT, RTX_PAYLOAD_TYPE, NULL);
+    g_object_set(G_OBJECT(branch->rtx), "payload-type-map", map, "max-size-time", HYBRID_LATENCY_BUDGET_MS, NULL);
+    gst_structure_free(map);
+    /* NACKs are feedback messages of the AVPF profile */
+    gst_util_set_object_arg(G_OBJECT(branch->session), "rtp-profile", "avpf");
+
+    g_mutex_lock(&hybrid.lock);
+    memset(&hybrid.current, 0, sizeof (hybrid.current));
+    hybrid.current.mode = HYBRID_RTX;
+    hybrid.current.rtt = -1;
+    hybrid.started_at = hybrid.current.at = g_get_monotonic_time();
+    hybrid.loss = 0;
+    hybrid.logged = 0;
+    hybrid.nacks_dropped = 0;
+    hybrid_apply(&hybrid.current);
+    g_mutex_unlock(&hybrid.lock);
+
+    GstPad *pad = gst_element_get_static_pad(branch->rtx, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, hybrid_request_probe, NULL, NULL);
+    gst_object_unref(pad);
+}
+
+static void
+hybrid_append (GString *report)
+{
+    guint requests = 0, packets = 0;
+
+    g_object_get(G_OBJECT(branch->rtx), "num-rtx-requests", &requests, "num-rtx-packets", &packets, NULL);
+    g_mutex_lock(&hybrid.lock);
+    g_string_append_printf(report, "Hybrid protection: %s, FEC %d%%; %u retransmission requests, %u retransmitted, %"
+                           G_GUINT64_FORMAT " ignored\n", hybrid_mode_names[hybrid.current.mode],
+                           hybrid.current.fec_percentage, requests, packets, hybrid.nacks_dropped);
+    for (guint i = hybrid.logged > HYBRID_LOG ? hybrid.logged - HYBRID_LOG : 0; i < hybrid.logged; i++) {
+        struct HybridDecision *decision = &hybrid.log[i % HYBRID_LOG];
+        g_string_append_printf(report, "  %5.1f s: %s, FEC %d%% (RTT %d ms, loss %.1f%%, longest burst %u)\n",
+                               (decision->at - hybrid.started_at) / (gdouble) G_USEC_PER_SEC, hybrid_mode_names[decision->mode],
+                               decision->fec_percentage, decision->rtt, decision->loss, decision->longest_burst);
+    }
+    g_mutex_unlock(&hybrid.lock);
+}
+
+/* a buffer's class and frame: with RTP the frame is its timestamp, the class flags set on the payloader's packets
+ * survive FEC and SRTP while the payload is only readable in the clear; without RTP every buffer is a frame */
+static int
+fanout_class (struct FanoutDestination *destination, GstBuffer *buffer, guint32 *frame)
+{
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    int class = -1;
+
+    if (!branch->rtp) {
+        *frame = destination->frame + 1;
+        return scheduler_frame_class(buffer);
+    }
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) {
+        *frame = destination->frame;
+        return -1;
+    }
+    *frame = gst_rtp_buffer_get_timestamp(&rtp);
+    if (unequal_protection || branch->srtp) {
+        class = uep_class_of(buffer);
+    } else if (!branch->srtp && gst_rtp_buffer_get_payload_type(&rtp) == VIDEO_PAYLOAD_TYPE) {
+        class = uep_classify(stream_codec, gst_rtp_buffer_get_payload(&rtp), gst_rtp_buffer_get_payload_len(&rtp));
+    }
+    gst_rtp_buffer_unmap(&rtp);
+    return class;
+}
+
+/* waits until the bucket holds the packet, or all of the bucket for a larger one; called with the receiver's lock held */
+static void
+fanout_pace (struct FanoutDestination *destination, gsize size)
+{
+    gint64 start = g_get_monotonic_time();
+
+    if (!destination->rate) {
+        return;
+    }
+    while (g_atomic_int_get(&fanout.running)) {
+        gint64 now = g_get_monotonic_time();
+        gint64 wait = token_bucket_wait(&destination->bucket, destination->rate, size, now);
+        if (!wait) {
+            break;
+        }
+        g_cond_wait_until(&destination->cond, &destination->lock, now + wait);
+    }
+    destination->bucket.tokens -= size;
+    destination->paced_us += g_get_monotonic_time() - start;
+}
+
+/* on the source pad of a receiver's queue, in that queue's thread: dropping takes no time, pacing only holds this
+ * receiver back; the packets of a split list are pushed from here and their flow return is the list's */
+static GstPadProbeReturn
+fanout_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    struct FanoutDestination *destination = user_data;
+    GstBufferList *list = NULL;
+    GstBuffer *buffer;
+    GstClockTime backlog = 0;
+    gsize size;
+    guint packets;
+    guint32 frame;
+
+    if (destination->splitting) {
+        return GST_PAD_PROBE_OK;
+    }
+    if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+        if (!gst_buffer_list_length(list)) {
+            return GST_PAD_PROBE_OK;
+        }
+        /* payloaders push the packets of one frame together */
+        buffer = gst_buffer_list_get(list, 0);
+        size = gst_buffer_list_calculate_size(list);
+        packets = gst_buffer_list_length(list);
+    } else {
+        buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+        size = gst_buffer_get_size(buffer);
+        packets = 1;
+    }
+    g_object_get(G_OBJECT(destination->queue), "current-level-time", &backlog, NULL);
+    int class = fanout_class(destination, buffer, &frame);
+
+    g_mutex_lock(&destination->lock);
+    destination->peak_backlog = MAX (destination->peak_backlog, backlog);
+    if (class >= 0 && class <= UEP_KEYFRAME) {
+        /* a keyframe makes everything after it decodable again */
+        destination->skipping = destination->frame_dropped = FALSE;
+    } else if (!destination->started || frame != destination->frame) {
+        /* the whole frame goes or is dropped, as decided on its first packet; skipping needs keyframes to be recognized
+         * to ever end */
+        if (destination->skipping || (backlog > FANOUT_KEYFRAME_BACKLOG && class >= 0)) {
+            if (!destination->skipping) {
+                GST_DEBUG ("Backlog of %" GST_TIME_FORMAT " to %s:%d, dropping up to the next keyframe",
+                           GST_TIME_ARGS (backlog), destination->host, destination->port);
+            }
+            destination->skipping = destination->frame_dropped = TRUE;
+            destination->frames_skipped++;
+        } else if (backlog > FANOUT_NON_REFERENCE_BACKLOG && class == UEP_NON_REFERENCE) {
+            destination->frame_dropped = TRUE;
+            destination->frames_non_reference++;
+        } else {
+            destination->frame_dropped = FALSE;
+        }
+    }
+    destination->started = TRUE;
+    destination->frame = frame;
+    if (destination->frame_dropped) {
+        destination->packets_dropped += packets;
+        g_mutex_unlock(&destination->lock);
+        return GST_PAD_PROBE_DROP;
+    }
+    if (!list || !destination->rate) {
+        fanout_pace(destination, size);
+        destination->packets += packets;
+        destination->bytes += size;
+        g_mutex_unlock(&destination->lock);
+        return GST_PAD_PROBE_OK;
+    }
+
+    /* a list holds a whole frame: its packets leave one by one as their tokens come in, not as one burst */
+    GstFlowReturn ret = GST_FLOW_OK;
+    destination->splitting = TRUE;
+    for (guint i = 0; i < packets && ret == GST_FLOW_OK; i++) {
+        if (!g_atomic_int_get(&fanout.running)) {
+            ret = GST_FLOW_FLUSHING;
+            break;
+        }
+        buffer = gst_buffer_list_get(list, i);
+        size = gst_buffer_get_size(buffer);
+        fanout_pace(destination, size);
+        destination->packets++;
+        destination->bytes += size;
+        g_mutex_unlock(&destination->lock);
+        ret = gst_pad_push(pad, gst_buffer_ref(buffer));
+        g_mutex_lock(&destination->lock);
+    }
+    destination->splitting = FALSE;
+    g_mutex_unlock(&destination->lock);
+    /* handled rather than dropped, so the queue sees a not-linked or flushing receiver */
+    gst_buffer_list_unref(list);
+    GST_PAD_PROBE_INFO_FLOW_RETURN (info) = ret;
+    return GST_PAD_PROBE_HANDLED;
+}
+
+/* parses fanout_destinations, the primary receiver is not among them */
+static guint
+fanout_parse (void)
+{
+    guint count = 0;
+
+    if (!fanout_destinations) {
+        return 0;
+    }
+    gchar **items = g_strsplit(fanout_destinations, ",", -1);
+    for (guint i = 0; items[i] && count < FANOUT_MAX; i++) {
+        struct FanoutDestination *destination = &fanout.destinations[count];
+        gint port = 0, kbps = 0;
+        memset(G_STRUCT_MEMBER_P (destination, G_STRUCT_OFFSET (struct FanoutDestination, host)), 0,
+               sizeof (*destination) - G_STRUCT_OFFSET (struct FanoutDestination, host));
+        if (sscanf(g_strstrip(items[i]), "%63[^:]:%d@%d", destination->host, &port, &kbps) < 2 || port <= 0 || port > 65535) {
+            if (*items[i]) { GST_WARNING ("Ignoring receiver '%s', expected host:port@kbit/s", items[i]); }
+            continue;
+        }
+        destination->port = port;
+        destination->rate = (gint64) MAX (kbps, 0) * 1000 / 8;
+        count++;
+    }
+    g_strfreev(items);
+    return count;
+}
+
+/* tee -> queue -> udpsink per extra receiver, next to the primary udpsink; the pipeline is not playing yet */
+static void
+fanout_start (GstAhc *stem, int bitrate)
+{
+    if (!branch->fanout_tee) {
+        return;
+    }
+    g_mutex_lock(&fanout.lock);
+    fanout.count = fanout_parse();
+    g_atomic_int_set(&fanout.running, TRUE);
+    g_mutex_unlock(&fanout.lock);
+
+    for (guint i = 0; i < fanout.count; i++) {
+        struct FanoutDestination *destination = &fanout.destinations[i];
+        gchar name[32];
+        g_snprintf(name, sizeof (name), "queue_fanout_%u", i);
+        destination->queue = gst_element_factory_make("queue", name);
+        g_snprintf(name, sizeof (name), "sink_fanout_%u", i);
+        destination->udpsink = gst_element_factory_make("udpsink", name);
+        if (!destination->queue || !destination->udpsink) {
+            GST_WARNING ("udpsink is null, not sending to %s:%d!", destination->host, destination->port);
+            if (destination->queue) { gst_object_unref(destination->queue); }
+            if (destination->udpsink) { gst_object_unref(destination->udpsink); }
+            destination->queue = destination->udpsink = NULL;
+            continue;
+        }
+        /* bounded by time, the probe keeps it well below that; the oldest packets go if it can't */
+        g_object_set(G_OBJECT(destination->queue),
+                     "max-size-buffers", 0,
+                     "max-size-bytes", 0,
+                     "max-size-time", (guint64) FANOUT_MAX_BACKLOG,
+                     NULL);
+        gst_util_set_object_arg(G_OBJECT(destination->queue), "leaky", "downstream");
+        if (memory_budget_mb) {
+            memory_cap_queue(destination->queue, -1, (gint64) bitrate / 8 * FANOUT_MAX_BACKLOG / GST_SECOND, 1500);
+        }
+        g_object_set(G_OBJECT(destination->udpsink), "host", destination->host, "port", destination->port, NULL);
+        if (is_multicast((unsigned char) atoi(destination->host))) {
+            configure_multicast(destination->udpsink);
+        }
+
+        destination->started_at = g_get_monotonic_time();
+        token_bucket_init(&destination->bucket, destination->rate, destination->started_at);
+
+        gst_bin_add_many(GST_BIN (stem->pipeline), destination->queue, destination->udpsink, NULL);
+        gst_element_link(destination->queue, destination->udpsink);
+        destination->tee_src = gst_element_get_request_pad(branch->fanout_tee, "src_%u");
+        GstPad *sink = gst_element_get_static_pad(destination->queue, "sink");
+        if (gst_pad_link(destination->tee_src, sink) != GST_PAD_LINK_OK) {
+            GST_DEBUG ("Fan-out tee could not be linked to %s!", GST_ELEMENT_NAME (destination->queue));
+        }
+        gst_object_unref(sink);
+        GstPad *src = gst_element_get_static_pad(destination->queue, "src");
+        gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, fanout_probe, destination, NULL);
+        gst_object_unref(src);
+        GST_INFO ("Also streaming to %s:%d, %s", destination->host, destination->port,
+                  destination->rate ? "shaped" : "not shaped");
+    }
+}
+
+/* before the pipeline stops, so no queue thread is left waiting for tokens */
+static void
+fanout_stop (void)
+{
+    g_mutex_lock(&fanout.lock);
+    g_atomic_int_set(&fanout.running, FALSE);
+    for (guint i = 0; i < fanout.count; i++) {
+        struct FanoutDestination *destination = &fanout.destinations[i];
+        g_mutex_lock(&destination->lock);
+        g_cond_broadcast(&destination->cond);
+        g_mutex_unlock(&destination->lock);
+    }
+    g_mutex_unlock(&fanout.lock);
+}
+
+/* the pipeline is in NULL state */
+static void
+fanout_remove (GstAhc *stem)
+{
+    g_mutex_lock(&fanout.lock);
+    guint count = fanout.count;
+    fanout.count = 0;
+    g_mutex_unlock(&fanout.lock);
+
+    for (guint i = 0; i < count; i++) {
+        struct FanoutDestination *destination = &fanout.destinations[i];
+        if (!destination->queue) {
+            continue;
+        }
+        gst_element_release_request_pad(branch->fanout_tee, destination->tee_src);
+        gst_object_unref(destination->tee_src);
+        gst_bin_remove_many(GST_BIN (stem->pipeline), destination->queue, destination->udpsink, NULL);
+        destination->queue = destination->udpsink = NULL;
+        destination->tee_src = NULL;
+    }
+}
+
+static void
+fanout_append (GString *report)
+{
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&fanout.lock);
+    for (guint i = 0; i < fanout.count; i++) {
+        struct FanoutDestination *destination = &fanout.destinations[i];
+        gdouble seconds = MAX (now - destination->started_at, 1) / (gdouble) G_USEC_PER_SEC;
+        if (!destination->queue) {
+            continue;
+        }
+        g_mutex_lock(&destination->lock);
+        g_string_append_printf(report, "Fan-out to %s:%d", destination->host, destination->port);
+        if (destination->rate) {
+            g_string_append_printf(report, " (shaped to %" G_GINT64_FORMAT " kbit/s, paced %.0f%% of the time)",
+                                   destination->rate * 8 / 1000, 100.0 * destination->paced_us / G_USEC_PER_SEC / seconds);
+        }
+        g_string_append_printf(report, ": %" G_GUINT64_FORMAT " packets, %.0f kbit/s; dropped %" G_GUINT64_FORMAT
+                               " non-reference frames and %" G_GUINT64_FORMAT " up to a keyframe (%" G_GUINT64_FORMAT
+                               " packets), peak backlog %" G_GUINT64_FORMAT " ms%s\n",
+                               destination->packets, destination->bytes * 8 / 1000 / seconds,
+                               destination->frames_non_reference, destination->frames_skipped,
+                               destination->packets_dropped, destination->peak_backlog / GST_MSECOND,
+                               destination->skipping ? ", waiting for a keyframe" : "");
+        g_mutex_unlock(&destination->lock);
+    }
+    g_mutex_unlock(&fanout.lock);
+}
+
+void
+gst_native_start_streaming_video (JNIEnv * env, jobject thiz, jshort width, jshort height, jshort framerate, int bitrate, jboolean rotate, jboolean packetization, jbyte byte0, jbyte byte1, jbyte byte2, jbyte byte3, int port) {
+    GstAhc *stem = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+    gst_element_set_state(stem->pipeline, GST_STATE_PAUSED);
+    gst_element_set_state(stem->pipeline, GST_STATE_NULL);
+
+    stream_autorotation = rotate;
+    stream_width = width;
+    stream_height = height;
+
+    /** the branch of the pipeline responsible for streaming */
+    branch->queue_udp = make_queue("queue_udp", 4, GST_SPSC_QUEUE_NO_LEAK);
+    if (!branch->queue_udp) { GST_DEBUG ("queue_udp is null!"); }
+    g_assert(branch->queue_udp);
+
+    /* optional elements, put the frames on the nominal framerate grid */
+    if (timestamp_smoothing != SMOOTHING_OFF) {
+        branch->videorate = gst_element_factory_make("videorate", "videorate");
+        branch->ratefilter = gst_element_factory_make("capsfilter", "ratefilter");
+        if (!branch->videorate || !branch->ratefilter) {
+            GST_WARNING ("videorate is null, timestamps won't be smoothed!");
+            if (branch->videorate) { gst_object_unref(branch->videorate); }
+            if (branch->ratefilter) { gst_object_unref(branch->ratefilter); }
+            branch->videorate = branch->ratefilter = NULL;
+        } else {
+            /* missing frames are only filled in when asked to */
+            g_object_set(G_OBJECT(branch->videorate), "drop-only", timestamp_smoothing == SMOOTHING_DROP_ONLY, NULL);
+            GstCaps *caps_rate = gst_caps_new_simple("video/x-raw", "framerate", GST_TYPE_FRACTION, framerate, 1, NULL);
+            g_object_set(G_OBJECT(branch->ratefilter), "caps", caps_rate, NULL);
+            gst_caps_unref(caps_rate);
+
+            GstPad *ratefilter_src = gst_element_get_static_pad(branch->ratefilter, "src");
+            gst_pad_add_probe(ratefilter_src, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                              frame_timing_probe, &smoothed_timing, NULL);
+            gst_object_unref(ratefilter_src);
+        }
+    }
+
+    /* optional elements, the camera captures more than is streamed */
+    capture_width = zoom_capture_width > 0 ? zoom_capture_width : width;
+    capture_height = zoom_capture_height > 0 ? zoom_capture_height : height;
+    if (zoom_capture_width > 0) {
+        roi_make(width, height);
+        if (!branch->crop) {
+            capture_width = width;
+            capture_height = height;
+        }
+    }
+
+    /** https://gstreamer.freedesktop.org/documentation/videofilter/videoflip.html */
+    branch->rotation = gst_element_factory_make("videoflip", "rotation");
+    if (!branch->rotation) { GST_DEBUG ("rotation is null!"); }
+    if (rotate) {
+        g_object_set(G_OBJECT(branch->rotation), "video-direction", rotation_angle, NULL);
+        g_print("rotation_angle: %d\n", rotation_angle);
+    } else { g_object_set(G_OBJECT(branch->rotation), "video-direction", 0, NULL); }
+    g_assert(branch->rotation);
+
+    /* optional elements, composite a second picture before the single encode */
+    if (pip_mode != PIP_OFF) {
+        pip_make(pip_mode, width, height);
+    }
+
+    branch->videoconvert = gst_element_factory_make("videoconvert", NULL);
+    if (!branch->videoconvert) { GST_DEBUG ("videoconvert is null!"); }
+    g_assert(branch->videoconvert);
+
+    /* the preference stays as it is for the next stream, whatever this one falls back to */
+    stream_codec = video_codec;
+    branch->encoder = make_video_encoder(&stream_codec, bitrate);
+    if (!branch->encoder) { GST_DEBUG ("encoder is null!"); }
+    g_assert(branch->encoder);
+
+    /* optional element, decouples the socket from the encoder */
+    if (frame_scheduler) {
+        scheduler_make();
+    }
+
+    /* optional element */
+    //TODO: https://github.com/mavlink/qgroundcontrol/blob/master/src/VideoReceiver/README.md
+    if (!packetization && (stream_codec == CODEC_VP8 || stream_codec == CODEC_VP9)) {
+        /* VP8/VP9 frames have no start codes, a receiver can't split them out of bare datagrams */
+        GST_DEBUG ("VP8/VP9 require RTP packetization, enabling it");
+        packetization = TRUE;
+    }
+    if (packetization) {
+        branch->rtp = make_video_payloader(stream_codec);
+        if (!branch->rtp && stream_codec != CODEC_H264) {
+            /* e.g. rtpav1pay comes from a newer plugin set than the encoder */
+            GST_WARNING ("Payloader for codec %d is not available, falling back to H.264", stream_codec);
+            gst_object_unref(branch->encoder);
+            stream_codec = CODEC_H264;
+            branch->encoder = make_video_encoder(&stream_codec, bitrate);
+            g_assert(branch->encoder);
+            branch->rtp = make_video_payloader(stream_codec);
+        }
+        if (!branch->rtp) {
+            GST_WARNING ("rtp is null, streaming without RTP!");
+            packetization = FALSE;
+        }
+    }
+    if (packetization) {
+        /* optional element, FEC is the only protection a multicast group can get; with unequal protection
+         * keyframes and parameter sets get it on unicast too */
+        gboolean fec_multicast = is_multicast(byte0 + 128) && multicast_fec_percentage > 0;
+        if (fec_multicast || unequal_protection) {
+            branch->fec = gst_element_factory_make("rtpulpfecenc", "fec");
+            if (!branch->fec) { GST_WARNING ("fec is null!"); }
+            else {
+                g_object_set(G_OBJECT(branch->fec),
+                             "pt", FEC_PAYLOAD_TYPE,
+                             "percentage", fec_multicast ? multicast_fec_percentage : 0,
+                             "percentage-important", unequal_protection
+                                                     ? MAX (UEP_IMPORTANT_PERCENTAGE, MIN (2 * multicast_fec_percentage, 100))
+                                                     : MIN (2 * multicast_fec_percentage, 100),
+                             "multipacket", TRUE,
+                             NULL);
+            }
+        }
+
+        /* optional element, only RTP can be protected */
+        if (srtp_cipher != SRTP_NONE) {
+            branch->srtp = make_srtp_encoder(srtp_cipher);
+            if (!branch->srtp) { GST_WARNING ("srtp is null, streaming in cleartext!"); }
+        }
+
+        /* optional elements, unicast in the clear only: SRTP would reject the cleartext audio sharing the port */
+        if (rtp_bundle && !branch->srtp && !is_multicast(byte0 + 128) && bundle_socket_get(port)) {
+            branch->session = gst_element_factory_make("rtpsession", "session_video");
+            branch->funnel = gst_element_factory_make("funnel", "funnel_video");
+            if (!branch->session || !branch->funnel) {
+                GST_WARNING ("rtpsession is null, not bundling!");
+                if (branch->session) { gst_object_unref(branch->session); }
+                if (branch->funnel) { gst_object_unref(branch->funnel); }
+                branch->session = branch->funnel = NULL;
+            } else {
+                g_object_set(G_OBJECT(branch->rtp), "ssrc", bundle_video_ssrc, NULL);
+            }
+        }
+
+        /* optional elements, the choice needs the receiver's reports */
+        if (branch->session && hybrid_protection) {
+            hybrid_make();
+        }
+    }
+
+    /* optional element, the bundle's socket and RTCP belong to the one receiver */
+    if (fanout_destinations && *fanout_destinations && !branch->session) {
+        branch->fanout_tee = gst_element_factory_make("tee", "fanout");
+        if (!branch->fanout_tee) { GST_WARNING ("tee is null, streaming to one receiver!"); }
+    }
+
+    branch->udpsink = gst_element_factory_make("udpsink", "sink");
+    if (!branch->udpsink) { GST_DEBUG ("UDP sink is null!"); }
+    else {
+        g_print("Branch elements made.");
+    }
+    g_assert(branch->udpsink);
+
+    GstElement *chain[BRANCH_MAX_ELEMENTS];
+    guint length = branch_collect(chain);
+    for (guint i = 0; i < length; i++) {
+        gst_bin_add(GST_BIN (stem->pipeline), chain[i]);
+    }
+
+    g_print("Branch elements added to pipeline.\n");
+
+    branch->tee_src_2 = gst_element_get_request_pad(stem->tee, "src_%u");
+    g_print("Obtained request pad %s for streaming branch: ", gst_pad_get_name (branch->tee_src_2));
+
+    branch->pad_udp = gst_element_get_static_pad(branch->queue_udp, "sink");
+
+    if (gst_pad_link(branch->tee_src_2, branch->pad_udp) != GST_PAD_LINK_OK) {
+        GST_DEBUG ("Tee could not be linked!\n");
+    }
+
+    for (guint i = 0; i + 1 < length; i++) {
+        if (!link_rtp_aware(chain[i], chain[i + 1])) {
+            GST_DEBUG ("Failed to link %s to %s!\n", GST_ELEMENT_NAME (chain[i]), GST_ELEMENT_NAME (chain[i + 1]));
+        }
+    }
+
+    if (branch->compositor) {
+        pip_link(stem->pipeline);
+    }
+
+    if (branch->session) {
+        bundle_link(stem->pipeline);
+    }
+
+    memory_apply(stem->queue_preview, capture_width, capture_height);
+
+    if (branch->rtp && abs_capture_time) {
+        GstPad *rtp_src = gst_element_get_static_pad(branch->rtp, "src");
+        abs_capture.have_rtptime = FALSE;
+        gst_pad_add_probe(rtp_src, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, abs_capture_time_probe,
+                          stem->pipeline, NULL);
+        gst_object_unref(rtp_src);
+    }
+
+    if (thread_planner) {
+        planner_start(chain, length, framerate);
+    }
+
+    GstCaps *caps_new;
+    if (packetization) {
+        caps_new = gst_caps_new_simple("video/x-raw",
+                                       "width", G_TYPE_INT, capture_width,
+                                       "height", G_TYPE_INT, capture_height,
+                                       NULL);
+    }
+    else {
+    //FIXME
+    caps_new = gst_caps_new_simple("video/x-raw",
+                                       "width", G_TYPE_INT, capture_width,
+                                       "height", G_TYPE_INT, capture_height,
+                                       "framerate", GST_TYPE_FRACTION, framerate, 1,
+                                       NULL);
+    }
+
+    g_object_set(stem->filter, "caps", caps_new, NULL);
+    gst_caps_unref(caps_new);
+
+    /* sets the destination port */
+    g_object_set(G_OBJECT(branch->udpsink), "port", port, NULL);
+
+    /* sets the destination IP address */
     char remote_IP_string[128];
     sprintf(remote_IP_string, "%d.%d.%d.%d", byte0+128, byte1+128, byte2+128, byte3+128);
     g_object_set(G_OBJECT(branch->udpsink), "host", remote_IP_string, NULL);
+    if (is_multicast(byte0 + 128)) {
+        configure_multicast(branch->udpsink);
+    }
+    if (branch->session) {
+        bundle_configure_sink(branch->udpsink);
+        GST_INFO ("Bundle from local port %u, video SSRC %08x", bundle_local_port(), bundle_video_ssrc);
+    }
+    if (branch->rtp) {
+        pmtu_apply(remote_IP_string, bitrate, framerate);
+        uep_start(branch->rtp, branch->udpsink);
+    }
+
+    snapshot_start(stem, remote_IP_string);
+    saf_start(branch->udpsink, remote_IP_string, port, bitrate);
+    fanout_start(stem, bitrate);
 
+    use_net_clock(stem->pipeline);
     gst_element_set_state(stem->pipeline, GST_STATE_PLAYING);
+    sendq_start(branch->udpsink, branch->encoder, bitrate);
 
   /* sends feedback to UI */
-  gchar *message = g_strdup_printf("Streaming to: %s\r\nvideo port: %d, RTP %s", remote_IP_string, port, packetization ? "enabled" : "disabled");
+  gchar *message = g_strdup_printf("Streaming to: %s\r\nvideo port: %d, %s, RTP %s%s%s%s%s%s", remote_IP_string, port, GST_ELEMENT_NAME (branch->encoder), packetization ? "enabled" : "disabled", branch->fec ? ", FEC" : "", branch->srtp ? ", SRTP" : (branch->rtp && srtp_cipher != SRTP_NONE ? ", SRTP unavailable (cleartext)" : ""), branch->compositor ? ", PiP" : "", branch->session ? ", bundle" : "", branch->fanout_tee ? ", fan-out" : "");
+  if (branch->rtp && path_mtu_discovery) {
+    gchar *with_mtu = g_strdup_printf("%s, MTU %d", message, path_mtu.mtu);
+    g_free(message);
+    message = with_mtu;
+  }
   set_ui_message(message, stem);
 }
 
 void
 gst_native_stop_streaming_video (JNIEnv * env, jobject thiz) {
     GstAhc *stem = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+    /* before udpsink closes its socket */
+    sendq_stop();
+    planner_stop();
+    fanout_stop();
+    net_clock_forget(stem->pipeline);
     gst_element_set_state(stem->pipeline, GST_STATE_PAUSED);
     gst_element_set_state(stem->pipeline, GST_STATE_NULL);
 
     gst_pad_unlink(branch->tee_src_2, branch->pad_udp);
 
-        if (pak) {
-            gst_element_unlink_many(branch->queue_udp, branch->rotation, branch->videoconvert, branch->encoder, branch->rtp, branch->udpsink, NULL);
-        } else {
-            gst_element_unlink_many(branch->queue_udp, branch->rotation, branch->videoconvert, branch->encoder, branch->udpsink, NULL);
-        }
+    GstElement *chain[BRANCH_MAX_ELEMENTS];
+    guint length = branch_collect(chain);
+    for (guint i = 0; i + 1 < length; i++) {
+        gst_element_unlink(chain[i], chain[i + 1]);
+    }
 
+    pip_unlink(stem->pipeline);
+    bundle_unlink(stem->pipeline);
+    snapshot_stop(stem);
+    fanout_remove(stem);
+    saf_stop();
+    uep_stop();
     g_print("Unlinked pipeline branch.\n");
-    gst_bin_remove_many(GST_BIN (stem->pipeline),
-                        branch->queue_udp,
-                        branch->rotation,
-                        branch->videoconvert,
-                        branch->encoder,
-                        branch->udpsink,
-                        NULL);
-
-        if (pak) {
-            gst_bin_remove(GST_BIN (stem->pipeline), branch->rtp);
-        }
+    for (guint i = 0; i < length; i++) {
+        gst_bin_remove(GST_BIN (stem->pipeline), chain[i]);
+    }
 
     g_print("Removed pipeline branch.\n");
 
     branch->tee_src_2 = NULL;
     branch->queue_udp = NULL;
+    branch->videorate = NULL;
+    branch->ratefilter = NULL;
+    branch->crop = NULL;
+    branch->crop_scale = NULL;
+    branch->crop_filter = NULL;
     branch->rotation = NULL;
+    branch->compositor = NULL;
     branch->videoconvert = NULL;
     branch->encoder = NULL;
+    branch->queue_send = NULL;
     branch->rtp = NULL;
+    branch->fec = NULL;
+    branch->rtx = NULL;
+    branch->srtp = NULL;
+    branch->session = NULL;
+    branch->funnel = NULL;
+    branch->fanout_tee = NULL;
     branch->udpsink = NULL;
+    branch->stages = 0;
     gst_object_unref(branch);
+    /* rotating the preview doesn't touch a stream that isn't there */
+    stream_autorotation = FALSE;
 
   GstCaps *caps_preview;
   caps_preview = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, 640, "height", G_TYPE_INT, 480, "framerate", GST_TYPE_FRACTION, 30, 1, NULL);
@@ -501,8 +4643,88 @@ static void gst_native_stream_stop_audio(JNIEnv *env, jobject thiz) {
     /* pipeline is common so this function is also common for non-flac and flac */
     audio_stop();
 
-//gchar *message = g_strdup_printf("Streaming audio stopped");
-//set_ui_message(message, stem);
+//gchar *message = g_strdup_printf("Streaming audio stopped");
+//set_ui_message(message, stem);
+}
+
+/* the receiver's RTCP about the audio is read from the bundle socket by the video pipeline, which hands it over */
+static void
+audio_link_rtcp (void)
+{
+    audio->rtcp_source = gst_element_factory_make("appsrc", "rtcp_source_audio");
+    if (!audio->rtcp_source) {
+        GST_WARNING ("appsrc is null, the audio session gets no receiver reports!");
+        return;
+    }
+    GstCaps *caps = gst_caps_new_empty_simple("application/x-rtcp");
+    g_object_set(G_OBJECT(audio->rtcp_source), "caps", caps, "is-live", TRUE, "format", GST_FORMAT_TIME,
+                 "do-timestamp", TRUE, NULL);
+    gst_caps_unref(caps);
+    gst_bin_add(GST_BIN (audio->pipeline), audio->rtcp_source);
+    if (!gst_element_link_pads(audio->rtcp_source, "src", audio->session, "recv_rtcp_sink")) {
+        GST_DEBUG ("Failed to link the audio RTCP source!");
+        return;
+    }
+    g_mutex_lock(&receiver_reports.lock);
+    receiver_reports.audio_rtcp = gst_object_ref(audio->rtcp_source);
+    g_mutex_unlock(&receiver_reports.lock);
+}
+
+/*
+ * Bundled with the video, the audio is payloaded and sent through its own rtpsession, so it gets sender reports for
+ * lip sync, and RTCP is muxed into the same port. FLAC has no RTP payload format, rtpgstpay carries it with in-band caps.
+ */
+static gboolean
+audio_link_sink (GstElement *last, gboolean flac, int rate, int port)
+{
+    if (!rtp_bundle || !bundle_socket_get(port)) {
+        return gst_element_link(last, audio->udpsink);
+    }
+    audio->rtp = gst_element_factory_make(flac ? "rtpgstpay" : "rtpL16pay", "rtp_audio");
+    audio->session = gst_element_factory_make("rtpsession", "session_audio");
+    audio->funnel = gst_element_factory_make("funnel", "funnel_audio");
+    if (!audio->rtp || !audio->session || !audio->funnel) {
+        GST_WARNING ("RTP elements are null, audio is not bundled!");
+        if (audio->rtp) { gst_object_unref(audio->rtp); }
+        if (audio->session) { gst_object_unref(audio->session); }
+        if (audio->funnel) { gst_object_unref(audio->funnel); }
+        audio->rtp = audio->session = audio->funnel = NULL;
+        return gst_element_link(last, audio->udpsink);
+    }
+    g_object_set(G_OBJECT(audio->rtp),
+                 "pt", flac ? BUNDLE_FLAC_PAYLOAD_TYPE : BUNDLE_AUDIO_PAYLOAD_TYPE,
+                 "ssrc", bundle_audio_ssrc,
+                 NULL);
+    if (flac) {
+        set_property_if_exists(audio->rtp, "config-interval", "1");
+    }
+    gst_bin_add_many(GST_BIN (audio->pipeline), audio->rtp, audio->session, audio->funnel, NULL);
+    if (!flac) {
+        /* L16 is big-endian on the wire, audioresample passes the native S16LE through */
+        GstElement *endian = gst_element_factory_make("audioconvert", "rtp_audio_convert");
+        if (!endian) {
+            GST_WARNING ("audioconvert is null, L16 can't be payloaded!");
+            return FALSE;
+        }
+        gst_bin_add(GST_BIN (audio->pipeline), endian);
+        if (!gst_element_link(last, endian)) {
+            GST_WARNING ("Failed to link %s to %s!", GST_ELEMENT_NAME (last), GST_ELEMENT_NAME (endian));
+            return FALSE;
+        }
+        last = endian;
+    }
+    if (!gst_element_link(last, audio->rtp) || !link_rtp_aware(audio->rtp, audio->session)
+        || !link_rtp_aware(audio->session, audio->funnel) || !gst_element_link(audio->funnel, audio->udpsink)) {
+        return FALSE;
+    }
+    bundle_link_rtcp(audio->session, audio->funnel);
+    bundle_configure_sink(audio->udpsink);
+    /* its reports arrive with the video's, rtpgstpay uses the 90 kHz clock */
+    receiver_report_reset(&receiver_reports.audio, bundle_audio_ssrc, flac ? 90000 : rate);
+    audio_link_rtcp();
+    GST_INFO ("Audio bundled, PT %d, SSRC %08x, %d Hz", flac ? BUNDLE_FLAC_PAYLOAD_TYPE : BUNDLE_AUDIO_PAYLOAD_TYPE,
+              bundle_audio_ssrc, rate);
+    return TRUE;
 }
 
 int audio_start(int bitrate, unsigned char arg[], int port) {
@@ -516,8 +4738,12 @@ int audio_start(int bitrate, unsigned char arg[], int port) {
   if (!audio->source) { GST_DEBUG ("openslessrc is null: NOGO!"); }
   g_assert (audio->source != NULL);
 
-  audio->queue = gst_element_factory_make("queue", NULL);
+  audio->queue = make_queue("queue_audio", 32, GST_SPSC_QUEUE_NO_LEAK);
   g_assert(audio->queue);
+  if (memory_budget_mb) {
+    /* openslessrc delivers buffers of about 20 ms */
+    memory_cap_queue(audio->queue, MEMORY_METER_AUDIO, MEMORY_AUDIO_QUEUE_BYTES, bitrate * 2 / 50);
+  }
 
   audio->capsfilter = gst_element_factory_make("capsfilter", NULL);
   if (!audio->capsfilter) { GST_DEBUG ("audiocapsfilter is null: NOGO!"); }
@@ -541,18 +4767,29 @@ int audio_start(int bitrate, unsigned char arg[], int port) {
 
   gst_bin_add_many(GST_BIN(audio->pipeline), audio->source, audio->queue, audio->capsfilter, audio->convert, audio->resample, audio->udpsink, NULL);
 
-  if (!gst_element_link_many(audio->source, audio->queue, audio->capsfilter, audio->convert, audio->resample, audio->udpsink, NULL)) {
-    GST_DEBUG ("Failed to link audio pipeline elements!\n");
+  if (!gst_element_link_many(audio->source, audio->queue, audio->capsfilter, audio->convert, audio->resample, NULL)
+      || !audio_link_sink(audio->resample, FALSE, bitrate, port)) {
+    GST_WARNING ("Failed to link audio pipeline elements!\n");
   }
 
+  audio_level_attach(audio->capsfilter);
+
   g_object_set(G_OBJECT(audio->udpsink), "host", remote_IP_string, NULL);
   g_object_set(G_OBJECT(audio->udpsink), "port", port, NULL);
+  if (is_multicast(arg[0])) {
+    configure_multicast(audio->udpsink);
+  }
 
   g_object_get(audio->udpsink, "port", &port, NULL);
   g_print("Audio port: %d\n", port);
 
+  use_net_clock(audio->pipeline);
   if (gst_element_set_state(GST_ELEMENT(audio->pipeline), GST_STATE_PLAYING)) {
     g_print("Audio pipeline state set to playing: OK\n");
+    /* bundled audio leaves through the video socket, it is already counted */
+    if (send_queue_control && !audio->session) {
+      sendq_attach (&sendq.audio_sink, audio->udpsink);
+    }
 
     return 1;
   } else {
@@ -571,8 +4808,12 @@ int audio_flac_start(int bitrate, unsigned char arg[], int port) {
   audio->source = gst_element_factory_make("openslessrc", NULL);
   if (!audio->source) { GST_DEBUG ("openslessrc is null: NOGO!"); }
 
-  audio->queue = gst_element_factory_make("queue", NULL);
+  audio->queue = make_queue("queue_audio", 32, GST_SPSC_QUEUE_NO_LEAK);
   g_assert(audio->queue);
+  if (memory_budget_mb) {
+    /* openslessrc delivers buffers of about 20 ms */
+    memory_cap_queue(audio->queue, MEMORY_METER_AUDIO, MEMORY_AUDIO_QUEUE_BYTES, bitrate * 2 / 50);
+  }
 
   audio->capsfilter = gst_element_factory_make("capsfilter", NULL);
   if (!audio->capsfilter) { GST_DEBUG ("audiocapsfilter is null: NOGO!"); }
@@ -602,18 +4843,29 @@ int audio_flac_start(int bitrate, unsigned char arg[], int port) {
 
   gst_bin_add_many(GST_BIN(audio->pipeline), audio->source, audio->queue, audio->capsfilter, audio->convert, audio->resample, audio->encoder, audio->udpsink, NULL);
 
-  if (!gst_element_link_many(audio->source, audio->queue, audio->capsfilter, audio->convert, audio->resample, audio->encoder, audio->udpsink, NULL)) {
+  if (!gst_element_link_many(audio->source, audio->queue, audio->capsfilter, audio->convert, audio->resample, audio->encoder, NULL)
+      || !audio_link_sink(audio->encoder, TRUE, bitrate, port)) {
     GST_DEBUG ("Failed to link audio pipeline elements!\n");
   }
 
+  audio_level_attach(audio->capsfilter);
+
   g_object_set(G_OBJECT(audio->udpsink), "host", remote_IP_string, NULL);
   g_object_set(G_OBJECT(audio->udpsink), "port", port, NULL);
+  if (is_multicast(arg[0])) {
+    configure_multicast(audio->udpsink);
+  }
 
   g_object_get(audio->udpsink, "port", &port, NULL);
   g_print("Audio port: %d\n", port);
 
+  use_net_clock(audio->pipeline);
   if (gst_element_set_state(GST_ELEMENT(audio->pipeline), GST_STATE_PLAYING)) {
     g_print("Audio FLAC pipeline state set to playing: OK\n");
+    /* bundled audio leaves through the video socket, it is already counted */
+    if (send_queue_control && !audio->session) {
+      sendq_attach (&sendq.audio_sink, audio->udpsink);
+    }
 
     return 1;
   } else {
@@ -623,6 +4875,11 @@ int audio_flac_start(int bitrate, unsigned char arg[], int port) {
 }
 
 int audio_stop() {
+  sendq_detach (&sendq.audio_sink);
+  g_mutex_lock (&receiver_reports.lock);
+  g_clear_object (&receiver_reports.audio_rtcp);
+  g_mutex_unlock (&receiver_reports.lock);
+  net_clock_forget (audio->pipeline);
   gst_element_set_state(audio->pipeline, GST_STATE_PAUSED);
   g_print("Audio pipeline: paused\n");
   gst_element_set_state(audio->pipeline, GST_STATE_NULL);
@@ -634,8 +4891,13 @@ int audio_stop() {
   audio->convert = NULL;
   audio->resample = NULL;
   audio->encoder = NULL;
+  audio->rtp = NULL;
+  audio->session = NULL;
+  audio->funnel = NULL;
+  audio->rtcp_source = NULL;
   audio->udpsink = NULL;
   audio->pipeline = NULL;
+  g_atomic_int_set(&audio_level, 0);
   gst_object_unref(audio);
   return 1;
 }
@@ -693,6 +4955,8 @@ void gst_native_pause (JNIEnv * env, jobject thiz)
 
 jboolean gst_class_init (JNIEnv * env, jclass klass)
 {
+  gst_element_register (NULL, "spscqueue", GST_RANK_NONE, GST_TYPE_SPSC_QUEUE);
+
   native_android_camera_field_id = (*env)->GetFieldID (env, klass, "native_custom_data", "J");
   GST_DEBUG ("The FieldID for the native_custom_data field is %p", native_android_camera_field_id);
   on_error_method_id = (*env)->GetMethodID (env, klass, "onError", "(Ljava/lang/String;)V");
@@ -814,6 +5078,552 @@ void gst_native_set_rotate_method (JNIEnv * env, jobject thiz, jint method)
   g_object_set (ahc->vsink, "rotate-method", method, NULL);
   /* angle used for rotating stream */
   rotation_angle = (char) method;
+  if (branch->rotation && stream_autorotation) {
+    /* videoflip reconfigures its src pad, width and height are renegotiated in place and the encoder
+     * restarts with a keyframe carrying the new SPS */
+    GST_DEBUG ("Rotating the running stream (%d)", method);
+    g_object_set (G_OBJECT (branch->rotation), "video-direction", method, NULL);
+    if (branch->compositor) {
+      pip_position ();
+    }
+  }
+}
+
+void gst_native_set_video_codec (JNIEnv * env, jobject thiz, jint codec)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+  GST_DEBUG ("Setting video codec (%d)", codec);
+  /* used the next time streaming starts */
+  video_codec = codec;
+}
+
+void gst_native_set_srtp_key (JNIEnv * env, jobject thiz, jint cipher, jbyteArray key)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  srtp_cipher = SRTP_NONE;
+  srtp_key_length = 0;
+  if (cipher == SRTP_NONE || !key)
+    return;
+
+  jsize length = (*env)->GetArrayLength (env, key);
+  if (length > SRTP_MAX_KEY_LENGTH) {
+    GST_WARNING ("SRTP key too long (%d bytes), SRTP disabled", length);
+    return;
+  }
+  (*env)->GetByteArrayRegion (env, key, 0, length, (jbyte *) srtp_key);
+  srtp_key_length = length;
+  srtp_cipher = cipher;
+  GST_DEBUG ("Setting SRTP cipher (%d) with %d byte key", cipher, length);
+}
+
+void gst_native_set_multicast (JNIEnv * env, jobject thiz, jint ttl, jboolean loop, jstring iface, jint fec_percentage)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  multicast_ttl = CLAMP (ttl, 0, 255);
+  multicast_loop = loop;
+  multicast_fec_percentage = CLAMP (fec_percentage, 0, 100);
+  g_free (multicast_iface);
+  multicast_iface = NULL;
+  if (iface) {
+    const gchar *chars = (*env)->GetStringUTFChars (env, iface, NULL);
+    multicast_iface = g_strdup (chars);
+    (*env)->ReleaseStringUTFChars (env, iface, chars);
+  }
+  GST_DEBUG ("Setting multicast TTL (%d), loop (%d), interface (%s), FEC (%d%%)",
+      multicast_ttl, multicast_loop, multicast_iface, multicast_fec_percentage);
+}
+
+void gst_native_set_capture_time (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+  GST_DEBUG ("Setting abs-capture-time extension (%d)", enabled);
+  abs_capture_time = enabled;
+}
+
+void gst_native_set_timestamp_smoothing (JNIEnv * env, jobject thiz, jint mode)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+  GST_DEBUG ("Setting timestamp smoothing (%d)", mode);
+  timestamp_smoothing = mode;
+}
+
+/* starts the other camera next to the running one and lets it take over at its first frame,
+ * stops the running camera first when the phone can't run both; FALSE if it stays on the running camera */
+jboolean gst_native_switch_camera (JNIEnv * env, jobject thiz, jint index)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  gchar device[16];
+
+  if (!ahc || !ahc->selector)
+    return JNI_FALSE;
+
+  g_mutex_lock (&camera_switch.lock);
+  if (index == camera_switch.index) {
+    g_mutex_unlock (&camera_switch.lock);
+    return JNI_TRUE;
+  }
+  if (camera_switch.incoming) {
+    g_mutex_unlock (&camera_switch.lock);
+    return JNI_FALSE;
+  }
+  /* the inset already holds the other camera */
+  if (branch->inset_source && gst_element_get_factory (branch->inset_source)
+      && g_str_equal (GST_OBJECT_NAME (gst_element_get_factory (branch->inset_source)), "ahcsrc")) {
+    g_mutex_unlock (&camera_switch.lock);
+    GST_WARNING ("Camera %d feeds the picture-in-picture inset, not switching", index);
+    return JNI_FALSE;
+  }
+  GstElement *incoming = gst_element_factory_make ("ahcsrc", NULL);
+  if (!incoming) {
+    g_mutex_unlock (&camera_switch.lock);
+    GST_WARNING ("ahcsrc is null, can't switch cameras!");
+    return JNI_FALSE;
+  }
+  g_snprintf (device, sizeof (device), "%d", index);
+  set_property_if_exists (incoming, "device", device);
+  g_object_set_data (G_OBJECT (incoming), "camera-index", GINT_TO_POINTER (index));
+
+  GstPad *outgoing_src = gst_element_get_static_pad (ahc->ahcsrc, "src");
+  camera_switch.outgoing = ahc->ahcsrc;
+  camera_switch.outgoing_pad = gst_pad_get_peer (outgoing_src);
+  gst_object_unref (outgoing_src);
+  camera_switch.incoming = incoming;
+  camera_switch.incoming_pad = gst_element_get_request_pad (ahc->selector, "sink_%u");
+  /* errors of the incoming camera don't stop the pipeline until it has taken over, it may fail to open next to the
+   * running one already while going to PLAYING */
+  camera_switch.failed = incoming;
+  camera_switch.warm = TRUE;
+  GstPad *incoming_pad = gst_object_ref (camera_switch.incoming_pad);
+  g_mutex_unlock (&camera_switch.lock);
+
+  gst_bin_add (GST_BIN (ahc->pipeline), incoming);
+  GstPad *incoming_src = gst_element_get_static_pad (incoming, "src");
+  gst_pad_link (incoming_src, incoming_pad);
+  gst_object_unref (incoming_pad);
+  gst_pad_add_probe (incoming_src, GST_PAD_PROBE_TYPE_BUFFER, camera_incoming_probe, ahc, NULL);
+  gst_object_unref (incoming_src);
+
+  if (gst_element_sync_state_with_parent (incoming)) {
+    GST_DEBUG ("Camera %d started next to the running one", index);
+    return JNI_TRUE;
+  }
+
+  /* cold start, the outgoing camera keeps the selector pad active until the incoming one delivers */
+  g_mutex_lock (&camera_switch.lock);
+  camera_switch.warm = FALSE;
+  g_mutex_unlock (&camera_switch.lock);
+  gst_element_set_state (incoming, GST_STATE_NULL);
+  gst_element_set_state (camera_switch.outgoing, GST_STATE_NULL);
+  if (gst_element_sync_state_with_parent (incoming)) {
+    GST_DEBUG ("Camera %d started after stopping the running one", index);
+    return JNI_TRUE;
+  }
+
+  GST_WARNING ("Camera %d can't be started, staying on camera %d", index, camera_switch.index);
+  gst_element_set_state (incoming, GST_STATE_NULL);
+  g_mutex_lock (&camera_switch.lock);
+  gst_element_release_request_pad (ahc->selector, camera_switch.incoming_pad);
+  g_mutex_unlock (&camera_switch.lock);
+  gst_bin_remove (GST_BIN (ahc->pipeline), incoming);
+  gst_element_sync_state_with_parent (camera_switch.outgoing);
+  g_mutex_lock (&camera_switch.lock);
+  gst_object_unref (camera_switch.outgoing_pad);
+  g_clear_object (&camera_switch.incoming_pad);
+  camera_switch.incoming = camera_switch.outgoing = NULL;
+  camera_switch.outgoing_pad = NULL;
+  camera_switch.failed = NULL;
+  g_mutex_unlock (&camera_switch.lock);
+  return JNI_FALSE;
+}
+
+void gst_native_set_snapshots (JNIEnv * env, jobject thiz, jint interval, jint port, jstring path)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  snapshot_interval = MAX (interval, 0);
+  snapshot_port = port;
+  g_free (snapshot_path);
+  snapshot_path = NULL;
+  if (path) {
+    const gchar *chars = (*env)->GetStringUTFChars (env, path, NULL);
+    snapshot_path = g_strdup (chars);
+    (*env)->ReleaseStringUTFChars (env, path, chars);
+  }
+  GST_DEBUG ("Setting snapshots every %d s, port %d, file %s", snapshot_interval, snapshot_port, snapshot_path);
+}
+
+void gst_native_set_unequal_protection (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  unequal_protection = enabled;
+  GST_DEBUG ("Setting unequal error protection (%d)", enabled);
+}
+
+void gst_native_set_frame_scheduler (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  frame_scheduler = enabled;
+  GST_DEBUG ("Setting frame scheduler (%d)", enabled);
+}
+
+void gst_native_set_send_queue_control (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  send_queue_control = enabled;
+  GST_DEBUG ("Setting send-queue congestion control (%d)", enabled);
+}
+
+void gst_native_set_hybrid_protection (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  hybrid_protection = enabled;
+  GST_DEBUG ("Setting hybrid FEC/RTX protection (%d)", enabled);
+}
+
+void gst_native_set_fanout (JNIEnv * env, jobject thiz, jstring destinations)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  g_free (fanout_destinations);
+  fanout_destinations = NULL;
+  if (destinations) {
+    const gchar *chars = (*env)->GetStringUTFChars (env, destinations, NULL);
+    fanout_destinations = g_strdup (chars);
+    (*env)->ReleaseStringUTFChars (env, destinations, chars);
+  }
+  GST_DEBUG ("Setting fan-out receivers (%s)", fanout_destinations);
+}
+
+void gst_native_set_digital_zoom (JNIEnv * env, jobject thiz, jint capture_width, jint capture_height)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  zoom_capture_width = MAX (capture_width, 0);
+  zoom_capture_height = MAX (capture_height, 0);
+  GST_DEBUG ("Setting digital zoom capture size (%dx%d)", capture_width, capture_height);
+}
+
+void gst_native_set_roi (JNIEnv * env, jobject thiz, jint left, jint top, jint width, jint height)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  roi.left = left;
+  roi.top = top;
+  roi.width = width;
+  roi.height = height;
+  /* videocrop takes the new region from the next frame on */
+  roi_apply ();
+}
+
+void gst_native_set_memory_budget (JNIEnv * env, jobject thiz, jint megabytes)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  memory_budget_mb = MAX (megabytes, 0);
+  GST_DEBUG ("Setting memory budget (%d MB)", megabytes);
+}
+
+void gst_native_set_rtp_bundle (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  rtp_bundle = enabled;
+  GST_DEBUG ("Setting RTP bundle (%d)", enabled);
+}
+
+void gst_native_set_path_mtu_discovery (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  path_mtu_discovery = enabled;
+  GST_DEBUG ("Setting path MTU discovery (%d)", enabled);
+}
+
+void gst_native_set_store_forward (JNIEnv * env, jobject thiz, jboolean enabled, jstring directory, jint cap_mb, jint port, jint rate_factor)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  store_forward = enabled;
+  store_forward_cap = (guint64) MAX (cap_mb, 2) * 1024 * 1024;
+  store_forward_port = port;
+  store_forward_rate_factor = rate_factor;
+  g_free (store_forward_dir);
+  store_forward_dir = NULL;
+  if (directory) {
+    const gchar *chars = (*env)->GetStringUTFChars (env, directory, NULL);
+    store_forward_dir = g_strdup (chars);
+    (*env)->ReleaseStringUTFChars (env, directory, chars);
+  }
+  GST_DEBUG ("Setting store-and-forward (%d) in %s, %d MB, backlog port %d, %dx the bitrate", enabled, store_forward_dir,
+      cap_mb, port, rate_factor);
+}
+
+void gst_native_set_picture_in_picture (JNIEnv * env, jobject thiz, jint mode)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+  GST_DEBUG ("Setting picture-in-picture (%d)", mode);
+  pip_mode = mode;
+}
+
+void gst_native_set_thread_planner (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+  GST_DEBUG ("Setting thread planner (%d)", enabled);
+  thread_planner = enabled;
+}
+
+void gst_native_set_net_clock (JNIEnv * env, jobject thiz, jint mode, jstring address, jint port)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  const gchar *host = NULL;
+  gchar *description = NULL;
+  GstClock *clock = NULL;
+
+  if (!ahc)
+    return;
+  if (address) {
+    host = (*env)->GetStringUTFChars (env, address, NULL);
+  }
+
+  switch (mode) {
+    case NET_CLOCK_NET:
+      description = g_strdup_printf ("network clock %s:%d", host, port);
+      break;
+    case NET_CLOCK_NTP:
+      description = g_strdup_printf ("NTP clock %s:%d", host, port);
+      break;
+    case NET_CLOCK_PTP:
+      description = g_strdup_printf ("PTP clock, domain %d", port);
+      break;
+    default:
+      break;
+  }
+
+  /* an unchanged clock keeps its synchronization across stream restarts */
+  if (net_clock && g_strcmp0 (description, net_clock_description) == 0) {
+    g_free (description);
+  } else {
+    switch (mode) {
+      case NET_CLOCK_NET:
+        if (host && *host) {
+          clock = gst_net_client_clock_new ("net-clock", host, port, 0);
+        }
+        break;
+      case NET_CLOCK_NTP:
+        if (host && *host) {
+          clock = gst_ntp_clock_new ("ntp-clock", host, port, 0);
+        }
+        break;
+      case NET_CLOCK_PTP:
+        /* needs gst-ptp-helper with access to ports 319 and 320 */
+        if (gst_ptp_is_initialized () || gst_ptp_init (GST_PTP_CLOCK_ID_NONE, NULL)) {
+          clock = gst_ptp_clock_new ("ptp-clock", port);
+        } else {
+          GST_WARNING ("PTP not available");
+        }
+        break;
+      default:
+        break;
+    }
+    /* pipelines already slaved keep their reference until they are rebuilt, waits for this clock end here */
+    if (net_clock) {
+      g_signal_handlers_disconnect_matched (net_clock, G_SIGNAL_MATCH_FUNC, 0, 0, NULL, net_clock_synced, NULL);
+      gst_object_unref (net_clock);
+    }
+    g_free (net_clock_description);
+    net_clock = clock;
+    net_clock_description = clock ? description : NULL;
+    net_clock_mode = clock ? mode : NET_CLOCK_OFF;
+    if (!clock) {
+      g_free (description);
+    }
+  }
+  if (host) {
+    (*env)->ReleaseStringUTFChars (env, address, host);
+  }
+  GST_DEBUG ("Setting shared clock (%d): %s", mode, net_clock_description);
+}
+
+void gst_native_set_silence_suppression (JNIEnv * env, jobject thiz, jint threshold_db)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+  GST_DEBUG ("Setting silence suppression (%d dBFS)", threshold_db);
+  /* dBFS to a linear S16 RMS, read by the audio thread */
+  g_atomic_int_set (&silence_rms, threshold_db < 0 ? (gint) (G_MAXINT16 * pow (10.0, threshold_db / 20.0)) : 0);
+}
+
+/* microphone level packed as peak << 16 | RMS, cheap enough to poll from the UI */
+jint gst_native_get_audio_level (JNIEnv * env, jobject thiz)
+{
+  return g_atomic_int_get (&audio_level);
+}
+
+/* static, the preview queue is made when the pipeline is created */
+void gst_native_set_spsc_queues (JNIEnv * env, jclass klass, jboolean enabled)
+{
+  GST_DEBUG ("Setting SPSC queues (%d)", enabled);
+  spsc_queues = enabled;
+}
+
+/* text report of the statistics gathered by the pipelines, shown in the UI */
+jstring gst_native_get_stats (JNIEnv * env, jobject thiz)
+{
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  GString *report = g_string_new (NULL);
+
+  frame_timing_append (&capture_timing, "Camera", report);
+  frame_timing_append (&smoothed_timing, "Smoothed", report);
+  g_mutex_lock (&planner.lock);
+  if (planner.report) {
+    g_string_append (report, planner.report);
+  }
+  g_mutex_unlock (&planner.lock);
+  if (ahc) {
+    spsc_queue_append (ahc->queue_preview, "Preview", report);
+  }
+  spsc_queue_append (branch->queue_udp, "Streaming", report);
+  spsc_queue_append (audio->queue, "Audio", report);
+  memory_append (report);
+  if (branch->session || audio->session) {
+    g_string_append_printf (report, "Bundle: local port %u, video SSRC %08x, audio SSRC %08x%s\n", bundle_local_port (),
+        bundle_video_ssrc, bundle_audio_ssrc, audio->session ? "" : " (not streaming)");
+  }
+  if (branch->session) {
+    receiver_report_append (&receiver_reports.video, "video", report);
+    receiver_report_append (&receiver_reports.audio, "audio", report);
+  }
+  if (branch->rtp && unequal_protection) {
+    uep_append (report);
+  }
+  if (branch->queue_send) {
+    scheduler_append (report);
+  }
+  if (sendq.thread) {
+    sendq_append (report);
+  }
+  if (branch->rtx) {
+    hybrid_append (report);
+  }
+  if (branch->fanout_tee) {
+    fanout_append (report);
+  }
+  if (branch->crop) {
+    gint left, right, top, bottom;
+
+    g_object_get (G_OBJECT (branch->crop), "left", &left, "right", &right, "top", &top, "bottom", &bottom, NULL);
+    g_string_append_printf (report, "Region of interest: %dx%d at %d,%d of %dx%d\n",
+        capture_width - left - right, capture_height - top - bottom, left, top, capture_width, capture_height);
+  }
+  if (branch->rtp && path_mtu_discovery && path_mtu.probed_at) {
+    g_string_append_printf (report, "Path MTU: %d (interface %d, %d reductions), RTP packets up to %d bytes",
+        path_mtu.mtu, path_mtu.interface_mtu, path_mtu.reductions, path_mtu.rtp_mtu);
+    if (path_mtu.slices) {
+      g_string_append_printf (report, ", %d slices per frame", path_mtu.slices);
+    }
+    g_string_append (report, "\n");
+  }
+  if (saf.thread) {
+    g_mutex_lock (&saf.lock);
+    g_string_append_printf (report, "Store-and-forward: %s, backlog %.1f MB, forwarded %.1f MB, dropped %.1f MB\n",
+        g_atomic_int_get (&saf.offline) ? "offline" : "online", saf.stored / 1048576.0,
+        saf.forwarded / 1048576.0, saf.dropped / 1048576.0);
+    g_mutex_unlock (&saf.lock);
+  }
+  g_mutex_lock (&snapshot_stats.lock);
+  if (snapshot_stats.count) {
+    gint64 elapsed = gst_util_get_timestamp () - snapshot_stats.started_ns;
+    g_string_append_printf (report, "Snapshots: %" G_GUINT64_FORMAT " sent, %.1f ms CPU each, %.2f%% of one core\n",
+        snapshot_stats.count, snapshot_stats.cpu_ns / 1e6 / snapshot_stats.count,
+        elapsed > 0 ? 100.0 * snapshot_stats.cpu_ns / elapsed : 0.0);
+  }
+  g_mutex_unlock (&snapshot_stats.lock);
+  g_mutex_lock (&camera_switch.lock);
+  if (camera_switch.report) {
+    g_string_append (report, camera_switch.report);
+  }
+  g_mutex_unlock (&camera_switch.lock);
+  if (net_clock) {
+    /* offset of the shared clock from this device's real-time clock */
+    guint64 ntp = net_clock_to_ntp (gst_clock_get_time (net_clock));
+    gint64 local = g_get_real_time ();
+    gint64 shared = ntp_to_unix_us (ntp);
+    g_string_append_printf (report, "Clock: %s, %s, %+.1f ms from local time\n", net_clock_description,
+        gst_clock_is_synced (net_clock) ? "synchronized" : "not synchronized", (shared - local) / 1000.0);
+  }
+  if (g_atomic_int_get (&silence_rms)) {
+    g_string_append_printf (report, "Silence suppression: %d audio buffers dropped\n",
+        g_atomic_int_get (&silence_dropped));
+  }
+
+  jstring jreport = (*env)->NewStringUTF (env, report->str);
+  g_string_free (report, TRUE);
+  return jreport;
 }
 
 /** https://docs.oracle.com/javase/7/docs/technotes/guides/jni/spec/types.html */
@@ -829,6 +5639,31 @@ static JNINativeMethod native_methods[] = {
   {"nativeSetRotateMethod", "(I)V", (void *) gst_native_set_rotate_method},
   {"nativeSetWhiteBalance", "(I)V", (void *) gst_native_set_white_balance},
   {"nativeSetAutoFocus", "(Z)V", (void *) gst_native_set_auto_focus},
+  {"nativeSetVideoCodec", "(I)V", (void *) gst_native_set_video_codec},
+  {"nativeSetSrtpKey", "(I[B)V", (void *) gst_native_set_srtp_key},
+  {"nativeSetMulticast", "(IZLjava/lang/String;I)V", (void *) gst_native_set_multicast},
+  {"nativeSetCaptureTime", "(Z)V", (void *) gst_native_set_capture_time},
+  {"nativeSetTimestampSmoothing", "(I)V", (void *) gst_native_set_timestamp_smoothing},
+  {"nativeSetThreadPlanner", "(Z)V", (void *) gst_native_set_thread_planner},
+  {"nativeSetPictureInPicture", "(I)V", (void *) gst_native_set_picture_in_picture},
+  {"nativeSwitchCamera", "(I)Z", (void *) gst_native_switch_camera},
+  {"nativeSetSnapshots", "(IILjava/lang/String;)V", (void *) gst_native_set_snapshots},
+  {"nativeSetStoreForward", "(ZLjava/lang/String;III)V", (void *) gst_native_set_store_forward},
+  {"nativeSetPathMtuDiscovery", "(Z)V", (void *) gst_native_set_path_mtu_discovery},
+  {"nativeSetRtpBundle", "(Z)V", (void *) gst_native_set_rtp_bundle},
+  {"nativeSetMemoryBudget", "(I)V", (void *) gst_native_set_memory_budget},
+  {"nativeSetDigitalZoom", "(II)V", (void *) gst_native_set_digital_zoom},
+  {"nativeSetUnequalProtection", "(Z)V", (void *) gst_native_set_unequal_protection},
+  {"nativeSetFrameScheduler", "(Z)V", (void *) gst_native_set_frame_scheduler},
+  {"nativeSetSendQueueControl", "(Z)V", (void *) gst_native_set_send_queue_control},
+  {"nativeSetHybridProtection", "(Z)V", (void *) gst_native_set_hybrid_protection},
+  {"nativeSetFanout", "(Ljava/lang/String;)V", (void *) gst_native_set_fanout},
+  {"nativeSetRoi", "(IIII)V", (void *) gst_native_set_roi},
+  {"nativeSetSpscQueues", "(Z)V", (void *) gst_native_set_spsc_queues},
+  {"nativeSetSilenceSuppression", "(I)V", (void *) gst_native_set_silence_suppression},
+  {"nativeSetNetClock", "(ILjava/lang/String;I)V", (void *) gst_native_set_net_clock},
+  {"nativeGetAudioLevel", "()I", (void *) gst_native_get_audio_level},
+  {"nativeGetStats", "()Ljava/lang/String;", (void *) gst_native_get_stats},
 
   {"nativeStreamStart", "(SSSIZZBBBBI)V",    (void *) gst_native_start_streaming_video},
   {"nativeStreamStop", "()V",              (void *) gst_native_stop_streaming_video},
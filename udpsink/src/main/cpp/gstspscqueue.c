@@ -0,0 +1,538 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include "gstspscqueue.h"
+
+GST_DEBUG_CATEGORY_STATIC (spsc_queue_debug);
+#define GST_CAT_DEFAULT spsc_queue_debug
+
+#define DEFAULT_CAPACITY 16
+#define DEFAULT_LEAKY GST_SPSC_QUEUE_NO_LEAK
+#define DEFAULT_SPIN_COUNT 0
+/* upper bound of a park, so a missed wake-up only costs this much */
+#define PARK_TIMEOUT (10 * G_TIME_SPAN_MILLISECOND)
+
+enum
+{
+  PROP_0,
+  PROP_CAPACITY,
+  PROP_LEAKY,
+  PROP_SPIN_COUNT,
+  PROP_CURRENT_LEVEL,
+  PROP_DROPPED,
+  PROP_AVERAGE_LATENCY
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+#define gst_spsc_queue_parent_class parent_class
+G_DEFINE_TYPE (GstSpscQueue, gst_spsc_queue, GST_TYPE_ELEMENT);
+
+#define GST_TYPE_SPSC_QUEUE_LEAKY (gst_spsc_queue_leaky_get_type ())
+static GType
+gst_spsc_queue_leaky_get_type (void)
+{
+  static GType leaky_type = 0;
+  static const GEnumValue leaky[] = {
+    {GST_SPSC_QUEUE_NO_LEAK, "Not Leaky", "no"},
+    {GST_SPSC_QUEUE_LEAK_UPSTREAM, "Leaky on upstream (new buffers)", "upstream"},
+    {GST_SPSC_QUEUE_LEAK_DOWNSTREAM, "Leaky on downstream (old buffers)", "downstream"},
+    {0, NULL, NULL},
+  };
+
+  if (!leaky_type) {
+    leaky_type = g_enum_register_static ("GstSpscQueueLeaky", leaky);
+  }
+  return leaky_type;
+}
+
+static inline guint
+spsc_level (GstSpscQueue * self)
+{
+  return spsc_ring_level (&self->ring);
+}
+
+static inline gboolean
+spsc_is_flushing (GstSpscQueue * self)
+{
+  return g_atomic_int_get (&self->flushing);
+}
+
+/* wakes the other side if it gave up spinning, the flag is read after the index was published */
+static void
+spsc_wake (GstSpscQueue * self, gint * parked)
+{
+  if (g_atomic_int_get (parked)) {
+    g_mutex_lock (&self->park_lock);
+    g_cond_broadcast (&self->park_cond);
+    g_mutex_unlock (&self->park_lock);
+  }
+}
+
+static void
+spsc_set_flushing (GstSpscQueue * self, gboolean flushing)
+{
+  g_atomic_int_set (&self->flushing, flushing);
+  g_mutex_lock (&self->park_lock);
+  g_cond_broadcast (&self->park_cond);
+  g_mutex_unlock (&self->park_lock);
+}
+
+/* spins, then parks until the level leaves the given state (empty for the consumer, full for the producer) */
+static void
+spsc_wait (GstSpscQueue * self, gint * parked, gboolean for_space)
+{
+  guint i;
+
+#define SPSC_BLOCKED() (for_space ? spsc_level (self) >= self->ring.capacity : spsc_level (self) == 0)
+
+  for (i = 0; i < self->spin_count; i++) {
+    if (!SPSC_BLOCKED () || spsc_is_flushing (self))
+      return;
+  }
+
+  g_mutex_lock (&self->park_lock);
+  g_atomic_int_set (parked, 1);
+  /* the other side publishes its index before reading the flag, so re-checking after setting it can't miss it */
+  if (SPSC_BLOCKED () && !spsc_is_flushing (self)) {
+    g_cond_wait_until (&self->park_cond, &self->park_lock,
+        g_get_monotonic_time () + PARK_TIMEOUT);
+  }
+  g_atomic_int_set (parked, 0);
+  g_mutex_unlock (&self->park_lock);
+
+#undef SPSC_BLOCKED
+}
+
+/* producer side, takes ownership of the item */
+static GstFlowReturn
+spsc_push (GstSpscQueue * self, GstMiniObject * item, gboolean is_buffer)
+{
+  while (TRUE) {
+    gint slot;
+    guint tail;
+
+    if (spsc_is_flushing (self)) {
+      gst_mini_object_unref (item);
+      return GST_FLOW_FLUSHING;
+    }
+
+    slot = spsc_ring_next_slot (&self->ring);
+    if (slot >= 0) {
+      self->is_buffer[slot] = is_buffer;
+      self->queued_at[slot] = gst_util_get_timestamp ();
+      spsc_ring_publish (&self->ring, item);
+      g_atomic_int_inc (&self->pushed);
+      spsc_wake (self, &self->consumer_parked);
+      return GST_FLOW_OK;
+    }
+
+    /* full, events are never dropped */
+    if (is_buffer && self->leaky == GST_SPSC_QUEUE_LEAK_UPSTREAM) {
+      gst_mini_object_unref (item);
+      g_atomic_int_inc (&self->dropped);
+      return GST_FLOW_OK;
+    }
+    slot = spsc_ring_oldest (&self->ring, &tail);
+    if (is_buffer && self->leaky == GST_SPSC_QUEUE_LEAK_DOWNSTREAM && slot >= 0
+        && self->is_buffer[slot]) {
+      GstMiniObject *oldest = self->ring.items[slot];
+      /* races with the consumer for the oldest slot, whoever moves the tail owns the buffer */
+      if (spsc_ring_take (&self->ring, tail)) {
+        gst_mini_object_unref (oldest);
+        g_atomic_int_inc (&self->dropped);
+      }
+      continue;
+    }
+    spsc_wait (self, &self->producer_parked, TRUE);
+  }
+}
+
+/* consumer side, NULL when flushing */
+static GstMiniObject *
+spsc_pop (GstSpscQueue * self)
+{
+  while (!spsc_is_flushing (self)) {
+    guint tail;
+    gint slot = spsc_ring_oldest (&self->ring, &tail);
+
+    if (slot >= 0) {
+      GstMiniObject *item = self->ring.items[slot];
+      GstClockTime queued_at = self->queued_at[slot];
+
+      /* raised before the level drops, cleared by the loop once the item is pushed */
+      g_atomic_int_set (&self->in_flight, 1);
+      if (spsc_ring_take (&self->ring, tail)) {
+        self->latency_total += gst_util_get_timestamp () - queued_at;
+        g_atomic_int_inc (&self->popped);
+        spsc_wake (self, &self->producer_parked);
+        return item;
+      }
+      /* the producer dropped it, try the next one */
+      g_atomic_int_set (&self->in_flight, 0);
+      continue;
+    }
+    spsc_wait (self, &self->consumer_parked, FALSE);
+  }
+  return NULL;
+}
+
+/* only called while neither side runs */
+static void
+spsc_drain (GstSpscQueue * self)
+{
+  GstMiniObject *item;
+
+  while ((item = spsc_ring_drain_one (&self->ring)))
+    gst_mini_object_unref (item);
+}
+
+static void
+spsc_allocate (GstSpscQueue * self, guint capacity)
+{
+  g_free (self->ring.items);
+  g_free (self->queued_at);
+  g_free (self->is_buffer);
+  capacity = spsc_ring_round_capacity (capacity);
+  spsc_ring_init (&self->ring, g_new0 (gpointer, capacity), capacity);
+  self->queued_at = g_new0 (GstClockTime, capacity);
+  self->is_buffer = g_new0 (gboolean, capacity);
+}
+
+static void
+gst_spsc_queue_loop (GstPad * pad)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (GST_PAD_PARENT (pad));
+  GstMiniObject *item = spsc_pop (self);
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  if (!item) {
+    gst_pad_pause_task (pad);
+    return;
+  }
+
+  if (GST_IS_BUFFER (item)) {
+    ret = gst_pad_push (self->srcpad, GST_BUFFER_CAST (item));
+  } else {
+    GstEvent *event = GST_EVENT_CAST (item);
+    gboolean is_eos = GST_EVENT_TYPE (event) == GST_EVENT_EOS;
+
+    gst_pad_push_event (self->srcpad, event);
+    if (is_eos)
+      ret = GST_FLOW_EOS;
+  }
+  g_atomic_int_set (&self->in_flight, 0);
+  spsc_wake (self, &self->producer_parked);
+
+  if (ret != GST_FLOW_OK) {
+    self->srcresult = ret;
+    GST_DEBUG_OBJECT (self, "pausing task, reason %s", gst_flow_get_name (ret));
+    if (ret == GST_FLOW_NOT_LINKED || ret < GST_FLOW_EOS) {
+      GST_ELEMENT_ERROR (self, STREAM, FAILED, ("Internal data stream error."),
+          ("streaming stopped, reason %s (%d)", gst_flow_get_name (ret), ret));
+    }
+    /* unblocks a producer waiting for space, it will return srcresult */
+    spsc_set_flushing (self, TRUE);
+    gst_pad_pause_task (pad);
+  }
+}
+
+static GstFlowReturn
+gst_spsc_queue_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (parent);
+  GstFlowReturn ret;
+
+  if (self->srcresult != GST_FLOW_OK) {
+    gst_buffer_unref (buffer);
+    return self->srcresult;
+  }
+  ret = spsc_push (self, GST_MINI_OBJECT_CAST (buffer), TRUE);
+  if (ret == GST_FLOW_FLUSHING && self->srcresult != GST_FLOW_OK)
+    ret = self->srcresult;
+  return ret;
+}
+
+static gboolean
+gst_spsc_queue_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (parent);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_pad_push_event (self->srcpad, event);
+      spsc_set_flushing (self, TRUE);
+      gst_pad_pause_task (self->srcpad);
+      return TRUE;
+    case GST_EVENT_FLUSH_STOP:
+      /* the task is paused and the producer is inside this event, nothing touches the ring */
+      spsc_drain (self);
+      self->srcresult = GST_FLOW_OK;
+      spsc_set_flushing (self, FALSE);
+      gst_pad_push_event (self->srcpad, event);
+      return gst_pad_start_task (self->srcpad,
+          (GstTaskFunction) gst_spsc_queue_loop, self->srcpad, NULL);
+    default:
+      if (GST_EVENT_IS_SERIALIZED (event)) {
+        if (self->srcresult != GST_FLOW_OK && GST_EVENT_TYPE (event) != GST_EVENT_EOS) {
+          gst_event_unref (event);
+          return FALSE;
+        }
+        return spsc_push (self, GST_MINI_OBJECT_CAST (event), FALSE) == GST_FLOW_OK;
+      }
+      return gst_pad_push_event (self->srcpad, event);
+  }
+}
+
+static gboolean
+gst_spsc_queue_sink_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (parent);
+
+  if (GST_QUERY_IS_SERIALIZED (query)) {
+    /* serialized queries must not overtake queued data, nor the item the consumer is still pushing; it wakes us
+     * after each push */
+    g_mutex_lock (&self->park_lock);
+    g_atomic_int_set (&self->producer_parked, 1);
+    while ((spsc_level (self) > 0 || g_atomic_int_get (&self->in_flight))
+        && !spsc_is_flushing (self)) {
+      g_cond_wait_until (&self->park_cond, &self->park_lock,
+          g_get_monotonic_time () + PARK_TIMEOUT);
+    }
+    g_atomic_int_set (&self->producer_parked, 0);
+    g_mutex_unlock (&self->park_lock);
+    if (spsc_is_flushing (self))
+      return FALSE;
+    return gst_pad_peer_query (self->srcpad, query);
+  }
+  return gst_pad_query_default (pad, parent, query);
+}
+
+static gboolean
+gst_spsc_queue_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (parent);
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+
+  if (active) {
+    self->srcresult = GST_FLOW_OK;
+    spsc_set_flushing (self, FALSE);
+    return gst_pad_start_task (pad, (GstTaskFunction) gst_spsc_queue_loop, pad,
+        NULL);
+  }
+
+  self->srcresult = GST_FLOW_FLUSHING;
+  spsc_set_flushing (self, TRUE);
+  gst_pad_stop_task (pad);
+  spsc_drain (self);
+  return TRUE;
+}
+
+/* both pads are inactive once the parent class is done, whatever a producer published after the task stopped is
+ * released here instead of coming out after the next start */
+static GstStateChangeReturn
+gst_spsc_queue_change_state (GstElement * element, GstStateChange transition)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (element);
+  GstStateChangeReturn ret;
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    spsc_drain (self);
+    g_atomic_int_set (&self->in_flight, 0);
+  }
+  return ret;
+}
+
+static gboolean
+gst_spsc_queue_sink_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (parent);
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+
+  if (!active) {
+    /* releases a producer waiting for space, the ring is drained once it has left */
+    spsc_set_flushing (self, TRUE);
+  }
+  return TRUE;
+}
+
+static void
+gst_spsc_queue_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (object);
+
+  switch (prop_id) {
+    case PROP_CAPACITY:
+      if (GST_STATE (self) == GST_STATE_NULL) {
+        spsc_allocate (self, g_value_get_uint (value));
+      } else {
+        GST_WARNING_OBJECT (self, "capacity can only be changed in NULL state");
+      }
+      break;
+    case PROP_LEAKY:
+      self->leaky = g_value_get_enum (value);
+      break;
+    case PROP_SPIN_COUNT:
+      self->spin_count = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_spsc_queue_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (object);
+
+  switch (prop_id) {
+    case PROP_CAPACITY:
+      g_value_set_uint (value, self->ring.capacity);
+      break;
+    case PROP_LEAKY:
+      g_value_set_enum (value, self->leaky);
+      break;
+    case PROP_SPIN_COUNT:
+      g_value_set_uint (value, self->spin_count);
+      break;
+    case PROP_CURRENT_LEVEL:
+      g_value_set_uint (value, spsc_level (self));
+      break;
+    case PROP_DROPPED:
+      g_value_set_uint64 (value, (guint) g_atomic_int_get (&self->dropped));
+      break;
+    case PROP_AVERAGE_LATENCY:{
+      guint popped = g_atomic_int_get (&self->popped);
+
+      g_value_set_uint64 (value, popped ? self->latency_total / popped : 0);
+      break;
+    }
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_spsc_queue_finalize (GObject * object)
+{
+  GstSpscQueue *self = GST_SPSC_QUEUE (object);
+
+  spsc_drain (self);
+  g_free (self->ring.items);
+  g_free (self->queued_at);
+  g_free (self->is_buffer);
+  g_mutex_clear (&self->park_lock);
+  g_cond_clear (&self->park_cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_spsc_queue_class_init (GstSpscQueueClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (spsc_queue_debug, "spscqueue", 0,
+      "lock-free single-producer/single-consumer queue");
+
+  gobject_class->set_property = gst_spsc_queue_set_property;
+  gobject_class->get_property = gst_spsc_queue_get_property;
+  gobject_class->finalize = gst_spsc_queue_finalize;
+  element_class->change_state = gst_spsc_queue_change_state;
+
+  g_object_class_install_property (gobject_class, PROP_CAPACITY,
+      g_param_spec_uint ("capacity", "Capacity",
+          "Maximum number of queued items, rounded up to a power of two",
+          1, 4096, DEFAULT_CAPACITY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LEAKY,
+      g_param_spec_enum ("leaky", "Leaky",
+          "Where the queue leaks buffers, if at all",
+          GST_TYPE_SPSC_QUEUE_LEAKY, DEFAULT_LEAKY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SPIN_COUNT,
+      g_param_spec_uint ("spin-count", "Spin count",
+          "Polls of the other side before parking on the condition variable (0 = park at once)",
+          0, G_MAXUINT, DEFAULT_SPIN_COUNT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CURRENT_LEVEL,
+      g_param_spec_uint ("current-level", "Current level",
+          "Number of queued items", 0, G_MAXUINT, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DROPPED,
+      g_param_spec_uint64 ("dropped", "Dropped",
+          "Number of buffers dropped by leaking", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_AVERAGE_LATENCY,
+      g_param_spec_uint64 ("average-latency", "Average latency",
+          "Average time between queueing and dequeueing an item, in nanoseconds",
+          0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class, "SPSC queue",
+      "Generic", "Lock-free single-producer/single-consumer ring queue",
+      "GStreamer Webcam");
+}
+
+static void
+gst_spsc_queue_init (GstSpscQueue * self)
+{
+  self->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->sinkpad, gst_spsc_queue_chain);
+  gst_pad_set_event_function (self->sinkpad, gst_spsc_queue_sink_event);
+  gst_pad_set_query_function (self->sinkpad, gst_spsc_queue_sink_query);
+  gst_pad_set_activatemode_function (self->sinkpad,
+      gst_spsc_queue_sink_activate_mode);
+  GST_PAD_SET_PROXY_CAPS (self->sinkpad);
+  GST_PAD_SET_PROXY_ALLOCATION (self->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  gst_pad_set_activatemode_function (self->srcpad,
+      gst_spsc_queue_src_activate_mode);
+  GST_PAD_SET_PROXY_CAPS (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+
+  g_mutex_init (&self->park_lock);
+  g_cond_init (&self->park_cond);
+  self->leaky = DEFAULT_LEAKY;
+  self->spin_count = DEFAULT_SPIN_COUNT;
+  self->srcresult = GST_FLOW_FLUSHING;
+  self->flushing = TRUE;
+  spsc_allocate (self, DEFAULT_CAPACITY);
+}
@@ -0,0 +1,89 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_SPSC_QUEUE_H__
+#define __GST_SPSC_QUEUE_H__
+
+#include <gst/gst.h>
+#include "spsc_ring.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_SPSC_QUEUE (gst_spsc_queue_get_type ())
+#define GST_SPSC_QUEUE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_SPSC_QUEUE, GstSpscQueue))
+#define GST_IS_SPSC_QUEUE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_SPSC_QUEUE))
+
+typedef struct _GstSpscQueue GstSpscQueue;
+typedef struct _GstSpscQueueClass GstSpscQueueClass;
+
+typedef enum
+{
+  GST_SPSC_QUEUE_NO_LEAK,
+  GST_SPSC_QUEUE_LEAK_UPSTREAM,
+  GST_SPSC_QUEUE_LEAK_DOWNSTREAM
+} GstSpscQueueLeaky;
+
+/*
+ * Bounded single-producer/single-consumer hand-off between the upstream streaming thread (sink pad)
+ * and a task on the src pad. Items travel through a ring of fixed capacity with atomic indices,
+ * so the fast path takes no lock; a side waits on the condition variable only after spinning
+ * for spin-count polls without progress.
+ */
+struct _GstSpscQueue
+{
+  GstElement parent;
+
+  GstPad *sinkpad, *srcpad;
+
+  /* ring of GstMiniObject (buffers and serialized events), its tail is also moved by the producer
+   * when it drops the oldest buffer leaking downstream */
+  SpscRing ring;
+  /* per slot, written by the producer: monotonic time the item was queued at and whether it is a buffer */
+  GstClockTime *queued_at;
+  gboolean *is_buffer;
+
+  GstSpscQueueLeaky leaky;
+  guint spin_count;
+
+  /* parking, only touched on the slow path */
+  GMutex park_lock;
+  GCond park_cond;
+  gint consumer_parked;
+  gint producer_parked;
+
+  gint flushing;
+  GstFlowReturn srcresult;
+  /* set by the consumer from taking an item until it has been pushed, so serialized queries can't overtake it */
+  gint in_flight;
+
+  /* statistics, counters are atomic as both sides and the application read or write them */
+  gint pushed;
+  gint popped;
+  gint dropped;
+  guint64 latency_total;
+};
+
+struct _GstSpscQueueClass
+{
+  GstElementClass parent_class;
+};
+
+GType gst_spsc_queue_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GST_SPSC_QUEUE_H__ */
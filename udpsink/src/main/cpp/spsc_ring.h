@@ -0,0 +1,120 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Index arithmetic of the spscqueue ring, without GStreamer so the host tests can run it. One producer fills slots at
+ * head; the consumer takes them at tail, and so may the producer when it drops the oldest item, hence the tail moves
+ * by compare-and-swap. All accesses are sequentially consistent: a side publishes its index before it reads whether
+ * the other one is parked.
+ */
+typedef struct
+{
+  void **items;
+  /* a power of two */
+  unsigned int capacity;
+  unsigned int mask;
+  /* free-running, the level is head - tail also after they wrap */
+  unsigned int head;
+  unsigned int tail;
+} SpscRing;
+
+static inline unsigned int
+spsc_ring_round_capacity (unsigned int requested)
+{
+  unsigned int capacity = 1;
+
+  while (capacity < requested)
+    capacity <<= 1;
+  return capacity;
+}
+
+/* items holds capacity slots, capacity comes from spsc_ring_round_capacity () */
+static inline void
+spsc_ring_init (SpscRing * ring, void **items, unsigned int capacity)
+{
+  ring->items = items;
+  ring->capacity = capacity;
+  ring->mask = capacity - 1;
+  ring->head = ring->tail = 0;
+}
+
+static inline unsigned int
+spsc_ring_level (SpscRing * ring)
+{
+  return __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST) -
+      __atomic_load_n (&ring->tail, __ATOMIC_SEQ_CST);
+}
+
+/* producer: the slot the next item goes to, -1 when full; side data of the slot is written before publishing */
+static inline int
+spsc_ring_next_slot (SpscRing * ring)
+{
+  unsigned int head = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+
+  if (head - __atomic_load_n (&ring->tail, __ATOMIC_SEQ_CST) >= ring->capacity)
+    return -1;
+  return (int) (head & ring->mask);
+}
+
+/* producer: stores the item in the slot spsc_ring_next_slot () returned and hands it to the consumer */
+static inline void
+spsc_ring_publish (SpscRing * ring, void *item)
+{
+  unsigned int head = __atomic_load_n (&ring->head, __ATOMIC_SEQ_CST);
+
+  ring->items[head & ring->mask] = item;
+  __atomic_store_n (&ring->head, head + 1, __ATOMIC_SEQ_CST);
+}
+
+/* the slot of the oldest item and the tail to take it with, -1 when empty */
+static inline int
+spsc_ring_oldest (SpscRing * ring, unsigned int *tail)
+{
+  *tail = __atomic_load_n (&ring->tail, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n (&ring->head, __ATOMIC_SEQ_CST) == *tail)
+    return -1;
+  return (int) (*tail & ring->mask);
+}
+
+/* moves the tail past the item spsc_ring_oldest () found, false when the other side took it first */
+static inline bool
+spsc_ring_take (SpscRing * ring, unsigned int tail)
+{
+  return __atomic_compare_exchange_n (&ring->tail, &tail, tail + 1, false,
+      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* only while neither side runs: removes the oldest item, NULL when empty */
+static inline void *
+spsc_ring_drain_one (SpscRing * ring)
+{
+  void *item;
+
+  if (ring->head == ring->tail)
+    return NULL;
+  item = ring->items[ring->tail & ring->mask];
+  ring->tail++;
+  return item;
+}
+
+#endif /* __SPSC_RING_H__ */
@@ -0,0 +1,471 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include "stream_logic.h"
+
+/* the encoders don't agree on the property or its unit: x265enc and svtav1enc take kbit/s, vpx encoders, openh264enc
+ * and rav1enc bit/s */
+const char *
+encoder_bitrate_property (const char *factory, int *scale)
+{
+    bool svtav1 = strcmp(factory, "svtav1enc") == 0;
+
+    *scale = svtav1 || strcmp(factory, "x265enc") == 0 ? 1000 : 1;
+    if (svtav1 || strcmp(factory, "vp8enc") == 0 || strcmp(factory, "vp9enc") == 0) {
+        return "target-bitrate";
+    }
+    return "bitrate";
+}
+
+/* beyond 4 threads libvpx gains little at stream sizes, and the camera, audio and sockets need cores too */
+unsigned
+vpx_encoder_threads (unsigned processors)
+{
+    return processors < 1 ? 1 : processors > 4 ? 4 : processors;
+}
+
+static const char *srtp_cipher_names[] = {NULL, "aes-128-icm", "aes-256-icm", "aes-128-gcm", "aes-256-gcm"};
+static const unsigned srtp_key_lengths[] = {0, 30, 46, 28, 44};
+
+const char *
+srtp_cipher_name (int cipher)
+{
+    return cipher > SRTP_NONE && cipher <= SRTP_AES_256_GCM ? srtp_cipher_names[cipher] : NULL;
+}
+
+unsigned
+srtp_cipher_key_length (int cipher)
+{
+    return cipher > SRTP_NONE && cipher <= SRTP_AES_256_GCM ? srtp_key_lengths[cipher] : 0;
+}
+
+unsigned
+srtp_cipher_overhead (int cipher)
+{
+    if (cipher <= SRTP_NONE || cipher > SRTP_AES_256_GCM) {
+        return 0;
+    }
+    return cipher >= SRTP_AES_128_GCM ? 16 : 10;
+}
+
+uint64_t
+unix_us_to_ntp (int64_t unix_us)
+{
+    uint64_t seconds = (uint64_t) (unix_us / 1000000) + NTP_UNIX_OFFSET;
+    uint64_t fraction = ((uint64_t) (unix_us % 1000000) << 32) / 1000000;
+    return (seconds << 32) | fraction;
+}
+
+uint64_t
+ntp_ns_to_ntp (uint64_t ntp_ns)
+{
+    return ((ntp_ns / 1000000000) << 32) | (((ntp_ns % 1000000000) << 32) / 1000000000);
+}
+
+/* the fraction is rounded, unix_us_to_ntp truncates it */
+int64_t
+ntp_to_unix_us (uint64_t ntp)
+{
+    uint64_t fraction = ((ntp & 0xffffffffu) * 1000000 + 0x80000000u) >> 32;
+    return (int64_t) ((ntp >> 32) - NTP_UNIX_OFFSET) * 1000000 + (int64_t) fraction;
+}
+
+bool
+pmtu_usable_report (int mtu, unsigned reported)
+{
+    return reported >= PMTU_MIN && (int) reported < mtu;
+}
+
+int
+pmtu_rtp_mtu (int path_mtu, bool extension, unsigned srtp_overhead, bool fec, bool rtx)
+{
+    int rtp_mtu = path_mtu - IPV4_UDP_OVERHEAD - (int) srtp_overhead;
+
+    if (extension) {
+        rtp_mtu -= RTP_EXTENSION_OVERHEAD;
+    }
+    if (fec) {
+        rtp_mtu -= ULPFEC_OVERHEAD;
+    }
+    if (rtx) {
+        rtp_mtu -= RTX_OVERHEAD;
+    }
+    return rtp_mtu;
+}
+
+int
+pmtu_slices (int bitrate, int framerate, int rtp_mtu)
+{
+    int slices;
+
+    if (framerate <= 0 || rtp_mtu <= 0) {
+        return 0;
+    }
+    slices = (bitrate / 8 / framerate + rtp_mtu - 1) / rtp_mtu;
+    return slices < 1 ? 1 : slices > MAX_SLICES ? MAX_SLICES : slices;
+}
+
+int64_t
+memory_pool_share (int64_t budget, int64_t frame, unsigned pools)
+{
+    int64_t rest = budget - (1 + MEMORY_QUEUE_FRAMES) * frame - MEMORY_AUDIO_QUEUE_BYTES;
+
+    return rest > 0 && pools ? rest / pools : 0;
+}
+
+unsigned
+memory_spsc_capacity (int64_t bytes, int64_t item_size)
+{
+    int64_t items = bytes / (item_size > 1 ? item_size : 1);
+    unsigned capacity = 1;
+
+    if (items > 4096) {
+        items = 4096;
+    }
+    while ((int64_t) capacity * 2 <= items) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+unsigned
+memory_queue_items (unsigned max_buffers, unsigned max_bytes, unsigned size)
+{
+    if (max_buffers || !max_bytes) {
+        return max_buffers;
+    }
+    /* a queue takes one more buffer while it is below the byte limit */
+    return max_bytes / (size ? size : 1) + 1;
+}
+
+unsigned
+memory_pool_max (unsigned size, unsigned min, unsigned max, unsigned reserve, int64_t pool_share)
+{
+    int64_t fit = size ? pool_share / size : 0;
+    unsigned capped = (unsigned) (fit > 1 ? (fit > UINT32_MAX ? UINT32_MAX : fit) : 1);
+
+    if (capped < min + reserve) {
+        capped = min + reserve;
+    }
+    return !max || capped < max ? capped : max;
+}
+
+static int
+roi_clamp_axis (int value, int low, int high)
+{
+    if (value < low) {
+        value = low;
+    }
+    return value > high ? high : value;
+}
+
+void
+roi_clamp (const struct Roi *requested, int capture_width, int capture_height, struct Roi *region)
+{
+    region->width = requested->width > 0 ? roi_clamp_axis(requested->width, 16, capture_width) & ~1 : capture_width;
+    region->height = requested->height > 0 ? roi_clamp_axis(requested->height, 16, capture_height) & ~1 : capture_height;
+    region->left = roi_clamp_axis(requested->left, 0, capture_width - region->width) & ~1;
+    region->top = roi_clamp_axis(requested->top, 0, capture_height - region->height) & ~1;
+}
+
+void
+pip_geometry (int width, int height, bool sideways, int *inset_width, int *inset_height, int *xpos, int *ypos)
+{
+    int frame_width = sideways ? height : width;
+
+    *inset_width = width / PIP_SCALE;
+    *inset_height = height / PIP_SCALE;
+    *xpos = frame_width - *inset_width - PIP_MARGIN;
+    if (*xpos < 0) {
+        *xpos = 0;
+    }
+    *ypos = PIP_MARGIN;
+}
+
+unsigned
+planner_partition (const uint64_t *cost, unsigned n, unsigned cores, unsigned *starts, uint64_t *bottleneck)
+{
+    uint64_t prefix[PLANNER_MAX_ELEMENTS + 1];
+    uint64_t best[PLANNER_MAX_ELEMENTS + 1][PLANNER_MAX_ELEMENTS + 1];
+    unsigned cut[PLANNER_MAX_ELEMENTS + 1][PLANNER_MAX_ELEMENTS + 1];
+    unsigned max_stages = cores > 1 ? cores - 1 : 1;
+    unsigned stages = 1;
+
+    if (n > PLANNER_MAX_ELEMENTS) {
+        n = PLANNER_MAX_ELEMENTS;
+    }
+    if (max_stages > n) {
+        max_stages = n > 0 ? n : 1;
+    }
+    prefix[0] = 0;
+    for (unsigned i = 0; i < n; i++) {
+        prefix[i + 1] = prefix[i] + cost[i];
+    }
+    /* best[s][j]: smallest bottleneck when the first j elements form exactly s stages, cut[s][j]: where the last one starts */
+    for (unsigned j = 0; j <= n; j++) {
+        best[1][j] = prefix[j];
+        cut[1][j] = 0;
+    }
+    for (unsigned s = 2; s <= max_stages; s++) {
+        for (unsigned j = 0; j <= n; j++) {
+            best[s][j] = UINT64_MAX;
+            cut[s][j] = 0;
+            for (unsigned i = s - 1; i < j; i++) {
+                uint64_t stage = prefix[j] - prefix[i];
+                uint64_t slowest = best[s - 1][i] > stage ? best[s - 1][i] : stage;
+                if (slowest < best[s][j]) {
+                    best[s][j] = slowest;
+                    cut[s][j] = i;
+                }
+            }
+        }
+    }
+    for (unsigned s = 2; s <= max_stages; s++) {
+        if (best[s][n] * 100 < best[stages][n] * (100 - PLANNER_MIN_GAIN)) {
+            stages = s;
+        }
+    }
+
+    /* walks the cuts back from the last stage */
+    unsigned end = n;
+    for (unsigned s = stages; s >= 1; s--) {
+        starts[s - 1] = cut[s][end];
+        end = starts[s - 1];
+    }
+    starts[stages] = n;
+    *bottleneck = best[stages][n];
+    return stages;
+}
+
+static unsigned
+read_uint16_be (const uint8_t *data)
+{
+    return (unsigned) data[0] << 8 | data[1];
+}
+
+int
+uep_class_h264 (const uint8_t *nal)
+{
+    int type = nal[0] & 0x1f;
+
+    if (type == 7 || type == 8) {
+        return UEP_PARAMETER_SETS;
+    }
+    if (type == 5) {
+        return UEP_KEYFRAME;
+    }
+    return (nal[0] >> 5) & 0x3 ? UEP_REFERENCE : UEP_NON_REFERENCE;
+}
+
+int
+uep_class_h265 (int type)
+{
+    if (type >= 32 && type <= 34) {
+        return UEP_PARAMETER_SETS;
+    }
+    if (type >= 16 && type <= 21) {
+        return UEP_KEYFRAME;
+    }
+    return type <= 14 && type % 2 == 0 ? UEP_NON_REFERENCE : UEP_REFERENCE;
+}
+
+int
+uep_classify (int codec, const uint8_t *payload, unsigned size)
+{
+    int class = -1;
+
+    if (size < 3) {
+        return -1;
+    }
+    switch (codec) {
+        case CODEC_H264:
+            if ((payload[0] & 0x1f) == 24) {
+                /* STAP-A, the most important of the aggregated NAL units */
+                for (unsigned offset = 1; offset + 2 < size; offset += 2 + read_uint16_be(payload + offset)) {
+                    int inner = uep_class_h264(payload + offset + 2);
+                    class = class < 0 ? inner : (inner < class ? inner : class);
+                }
+                return class;
+            }
+            if ((payload[0] & 0x1f) == 28) {
+                /* FU-A, the type is in the FU header, nal_ref_idc in the indicator */
+                uint8_t nal = (payload[0] & 0xe0) | (payload[1] & 0x1f);
+                return uep_class_h264(&nal);
+            }
+            return uep_class_h264(payload);
+        case CODEC_H265:
+            if (((payload[0] >> 1) & 0x3f) == 48) {
+                for (unsigned offset = 2; offset + 3 < size; offset += 2 + read_uint16_be(payload + offset)) {
+                    int inner = uep_class_h265((payload[offset + 2] >> 1) & 0x3f);
+                    class = class < 0 ? inner : (inner < class ? inner : class);
+                }
+                return class;
+            }
+            if (((payload[0] >> 1) & 0x3f) == 49) {
+                return uep_class_h265(payload[2] & 0x3f);
+            }
+            return uep_class_h265((payload[0] >> 1) & 0x3f);
+        case CODEC_VP8: {
+            /* payload descriptor X R N S R PID, N marks non-reference frames */
+            unsigned offset = 1;
+            if (payload[0] & 0x80) {
+                uint8_t extensions = payload[1];
+                offset = 2;
+                if (extensions & 0x80) { offset += payload[offset] & 0x80 ? 2 : 1; }
+                if (extensions & 0x40) { offset++; }
+                if (extensions & 0x30) { offset++; }
+            }
+            /* the VP8 payload header only starts partition 0, its P bit is clear on keyframes */
+            if ((payload[0] & 0x17) == 0x10 && offset < size) {
+                return payload[offset] & 0x01 ? (payload[0] & 0x20 ? UEP_NON_REFERENCE : UEP_REFERENCE) : UEP_KEYFRAME;
+            }
+            return -1;
+        }
+        case CODEC_VP9:
+            /* I P L F B E V Z: B starts a frame, without P it is a keyframe (carrying the scalability structure) */
+            if (payload[0] & 0x08) {
+                return payload[0] & 0x40 ? UEP_REFERENCE : UEP_KEYFRAME;
+            }
+            return -1;
+        case CODEC_AV1:
+            /* aggregation header Z Y W W N: N starts a coded video sequence, its sequence header and keyframe */
+            return payload[0] & 0x08 ? UEP_KEYFRAME : -1;
+        default:
+            return -1;
+    }
+}
+
+int
+uep_classify_bytestream (int codec, const uint8_t *data, size_t size)
+{
+    int class = -1;
+
+    for (size_t i = 0; i + 4 < size; i++) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            continue;
+        }
+        const uint8_t *nal = data + i + 3;
+        int nal_class = codec == CODEC_H264 ? uep_class_h264(nal) : uep_class_h265((nal[0] >> 1) & 0x3f);
+        class = class < 0 || nal_class < class ? nal_class : class;
+        i += 3;
+    }
+    return class;
+}
+
+enum SchedulerDecision
+scheduler_decide (int frame_class, uint64_t backlog, bool *skipping)
+{
+    if (frame_class <= UEP_KEYFRAME) {
+        *skipping = false;
+        return SCHEDULER_SEND;
+    }
+    if (*skipping || backlog > SCHEDULER_KEYFRAME_BACKLOG) {
+        *skipping = true;
+        return SCHEDULER_DROP_SKIPPING;
+    }
+    if (backlog > SCHEDULER_NON_REFERENCE_BACKLOG && frame_class == UEP_NON_REFERENCE) {
+        return SCHEDULER_DROP_NON_REFERENCE;
+    }
+    return SCHEDULER_SEND;
+}
+
+int
+sendq_next_bitrate (int bitrate, int configured, int64_t queued_ms, int64_t now, int64_t changed_at,
+                    int64_t *clear_since)
+{
+    if (queued_ms > SENDQ_CONGESTED_MS) {
+        *clear_since = 0;
+        if (now - changed_at > SENDQ_DECREASE_HOLD) {
+            int decreased = (int64_t) bitrate * SENDQ_DECREASE_PERCENT / 100;
+            return decreased > configured / SENDQ_MIN_FRACTION ? decreased : configured / SENDQ_MIN_FRACTION;
+        }
+    } else if (queued_ms < SENDQ_CLEAR_MS) {
+        if (!*clear_since) {
+            *clear_since = now;
+        }
+        if (now - *clear_since > SENDQ_INCREASE_HOLD && now - changed_at > SENDQ_DECREASE_HOLD) {
+            int increased = bitrate + (int64_t) configured * SENDQ_INCREASE_PERCENT / 100;
+            return increased < configured ? increased : configured;
+        }
+    } else {
+        *clear_since = 0;
+    }
+    return bitrate;
+}
+
+bool
+sendq_change_applied (int64_t held, int64_t output, int bitrate, int previous)
+{
+    /* kbit/s encoders round it down */
+    bool taken = held > bitrate - 1000 && held <= bitrate;
+
+    return taken && (bitrate > previous || output <= (int64_t) bitrate * 5 / 4);
+}
+
+/* RTX pays off when a retransmission arrives within the latency budget, FEC when it doesn't or losses come in bursts,
+ * which NACKs alone can't keep up with; XOR FEC repairs one loss per group, so bursts need more of it */
+void
+hybrid_decide (int rtt, double loss, bool bursty, enum HybridMode *mode, int *fec_percentage)
+{
+    bool rtx_in_time = rtt >= 0 && rtt * 3 / 2 < HYBRID_LATENCY_BUDGET_MS;
+
+    if (loss < HYBRID_LOSS_NEGLIGIBLE) {
+        *mode = rtx_in_time ? HYBRID_RTX : HYBRID_NONE;
+        *fec_percentage = 0;
+    } else if (rtx_in_time && !bursty && loss < HYBRID_LOSS_RTX_ONLY) {
+        *mode = HYBRID_RTX;
+        *fec_percentage = 0;
+    } else {
+        int percentage = (int) ceil(loss * (bursty ? 3 : 2));
+        *mode = rtx_in_time ? HYBRID_RTX_FEC : HYBRID_FEC;
+        *fec_percentage = percentage < HYBRID_FEC_MIN ? HYBRID_FEC_MIN
+                          : percentage > HYBRID_FEC_MAX ? HYBRID_FEC_MAX : percentage;
+    }
+}
+
+void
+token_bucket_init (struct TokenBucket *bucket, int64_t rate, int64_t now)
+{
+    bucket->depth = rate * FANOUT_BURST_MS / 1000;
+    if (bucket->depth < FANOUT_MIN_BURST) {
+        bucket->depth = FANOUT_MIN_BURST;
+    }
+    bucket->tokens = bucket->depth;
+    bucket->refilled_at = now;
+}
+
+int64_t
+token_bucket_wait (struct TokenBucket *bucket, int64_t rate, int64_t size, int64_t now)
+{
+    int64_t needed = size < bucket->depth ? size : bucket->depth;
+    int64_t refill = rate * (now - bucket->refilled_at) / 1000000;
+
+    if (bucket->tokens + refill >= bucket->depth) {
+        bucket->tokens = bucket->depth;
+        bucket->refilled_at = now;
+    } else if (refill > 0) {
+        /* only by the time the whole bytes took, the fraction left counts towards the next one */
+        bucket->tokens += refill;
+        bucket->refilled_at += refill * 1000000 / rate;
+    }
+    if (bucket->tokens >= needed) {
+        return 0;
+    }
+    return (needed - bucket->tokens) * 1000000 / rate + 1;
+}
@@ -0,0 +1,231 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Decisions of the streaming branch that don't need GStreamer: they take and return plain values, so the same code
+ * runs in the app and in the host tests under src/test/cpp.
+ */
+
+#ifndef __STREAM_LOGIC_H__
+#define __STREAM_LOGIC_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* video codec used by the streaming branch, values match GstAhc.Codec */
+enum VideoCodec {
+    CODEC_H264,
+    CODEC_H265,
+    CODEC_AV1,
+    CODEC_VP8,
+    CODEC_VP9
+};
+
+/* SRTP protection of the RTP modes, values match GstAhc.SrtpCipher */
+enum SrtpCipher {
+    SRTP_NONE,
+    SRTP_AES_128_ICM,
+    SRTP_AES_256_ICM,
+    SRTP_AES_128_GCM,
+    SRTP_AES_256_GCM
+};
+
+/* unequal error protection classes, most important first */
+enum UepClass {
+    UEP_PARAMETER_SETS,
+    UEP_KEYFRAME,
+    UEP_REFERENCE,
+    UEP_NON_REFERENCE,
+    UEP_CLASSES
+};
+
+/* queue_send backlogs in ns above which the frame scheduler drops non-reference frames, then all up to a keyframe */
+#define SCHEDULER_NON_REFERENCE_BACKLOG UINT64_C(150000000)
+#define SCHEDULER_KEYFRAME_BACKLOG UINT64_C(500000000)
+
+enum SchedulerDecision {
+    SCHEDULER_SEND,
+    SCHEDULER_DROP_NON_REFERENCE,
+    SCHEDULER_DROP_SKIPPING
+};
+
+/* send-queue congestion control: queued bytes in ms of the current bitrate, SIOCOUTQ includes the kernel's
+ * per-packet overhead */
+#define SENDQ_CONGESTED_MS 100
+#define SENDQ_CLEAR_MS 10
+/* the encoder needs some time to show a new bitrate, changes are spaced by these (µs); a change is confirmed by the
+ * encoder's output over the decrease hold */
+#define SENDQ_DECREASE_HOLD INT64_C(500000)
+#define SENDQ_INCREASE_HOLD INT64_C(2000000)
+/* multiplicative decrease and additive increase in percent, of the current and the configured bitrate */
+#define SENDQ_DECREASE_PERCENT 80
+#define SENDQ_INCREASE_PERCENT 5
+/* never below an eighth of the configured bitrate */
+#define SENDQ_MIN_FRACTION 8
+
+/* hybrid protection: the receiver's jitter buffer latency, a retransmission must make it within this */
+#define HYBRID_LATENCY_BUDGET_MS 200
+/* below this loss in percent nothing needs repairing in advance */
+#define HYBRID_LOSS_NEGLIGIBLE 0.5
+/* RTX alone as long as losses are scattered and below this, in percent */
+#define HYBRID_LOSS_RTX_ONLY 5.0
+#define HYBRID_FEC_MIN 5
+#define HYBRID_FEC_MAX 50
+
+enum HybridMode {
+    HYBRID_NONE,
+    HYBRID_RTX,
+    HYBRID_FEC,
+    HYBRID_RTX_FEC
+};
+
+/* a fan-out receiver's token bucket holds this much of its rate, and at least a few full packets */
+#define FANOUT_BURST_MS 20
+#define FANOUT_MIN_BURST (4 * 1500)
+
+/* token bucket in bytes, tokens may go below 0 after a packet larger than the bucket */
+struct TokenBucket {
+    int64_t tokens, depth, refilled_at;
+};
+
+/* seconds between the NTP (1900) and Unix (1970) epochs */
+#define NTP_UNIX_OFFSET UINT64_C(2208988800)
+
+/* upper bound of elements the thread planner splits, the app's streaming branch has as many at most */
+#define PLANNER_MAX_ELEMENTS 32
+/* a stage is only added when it shortens the slowest stage by more than this many percent */
+#define PLANNER_MIN_GAIN 5
+
+/* the picture-in-picture inset is this fraction of the frame, in the top right corner */
+#define PIP_SCALE 4
+#define PIP_MARGIN 16
+
+/* region of interest in capture pixels, a width of 0 streams the whole frame */
+struct Roi {
+    int left, top, width, height;
+};
+
+/* smallest MTU every IPv4 host takes, reports of less are ignored */
+#define PMTU_MIN 576
+/* IPv4 and UDP headers */
+#define IPV4_UDP_OVERHEAD 28
+/* the abs-capture-time header extension, with its 4-byte RFC 8285 header and padding */
+#define RTP_EXTENSION_OVERHEAD 16
+/* RFC 5109 FEC header and a level 0 header with the long mask, on top of the protected packet */
+#define ULPFEC_OVERHEAD 18
+/* RFC 4588 original sequence number in front of a retransmitted payload */
+#define RTX_OVERHEAD 2
+/* openh264enc doesn't split frames into more slices than this */
+#define MAX_SLICES 8
+
+/* raw frames queue_udp may hold under a memory budget, the preview queue holds one */
+#define MEMORY_QUEUE_FRAMES 2
+#define MEMORY_AUDIO_QUEUE_BYTES (64 * 1024)
+/* buffers a capped pool keeps above its minimum, one for each side, and above that what an encoder downstream may keep
+ * as references or lookahead; a pool allowed fewer would wait for a buffer that never comes back */
+#define MEMORY_POOL_SLACK 2
+#define MEMORY_ENCODER_FRAMES 4
+
+/* name of the bitrate property of an encoder factory, and the bit/s in one unit of it */
+const char *encoder_bitrate_property (const char *factory, int *scale);
+/* threads of vp8enc/vp9enc for the cores there are */
+unsigned vpx_encoder_threads (unsigned processors);
+
+/* srtpenc's nick of a cipher, NULL for SRTP_NONE and unknown values */
+const char *srtp_cipher_name (int cipher);
+/* master key + salt bytes libsrtp expects for a cipher, 0 for SRTP_NONE and unknown values */
+unsigned srtp_cipher_key_length (int cipher);
+/* bytes SRTP adds to every RTP packet: the HMAC-SHA1-80 tag for ICM, the GCM tag */
+unsigned srtp_cipher_overhead (int cipher);
+
+/* converts a Unix time in microseconds to a 64-bit NTP timestamp (UQ32.32) */
+uint64_t unix_us_to_ntp (int64_t unix_us);
+/* converts nanoseconds since the NTP epoch, the time of GStreamer's NTP clock, to a 64-bit NTP timestamp */
+uint64_t ntp_ns_to_ntp (uint64_t ntp_ns);
+/* converts a 64-bit NTP timestamp back to a Unix time in microseconds */
+int64_t ntp_to_unix_us (uint64_t ntp);
+
+/* splits n elements with the given cost per frame into at most one stage per spare core (one core is left to the
+ * camera, preview and audio), so that the slowest stage is as fast as possible; returns the number of stages, stage s
+ * runs elements starts[s] to starts[s + 1] - 1 and the slowest one takes *bottleneck */
+/* size of the picture-in-picture inset for a stream of width x height, and where it goes in the composited frame,
+ * which is turned on its side when sideways */
+/* whether an ICMP "Fragmentation Needed" MTU is a step down from mtu that can be taken */
+bool pmtu_usable_report (int mtu, unsigned reported);
+/* largest RTP packet for a path MTU, leaving room for what is added after the payloader */
+int pmtu_rtp_mtu (int path_mtu, bool extension, unsigned srtp_overhead, bool fec, bool rtx);
+/* slices an average frame needs to fit packets of rtp_mtu, 0 without a framerate */
+int pmtu_slices (int bitrate, int framerate, int rtp_mtu);
+
+/* what each of the raw frame pools may take of a budget, after the preview queue, queue_udp and the audio queue */
+int64_t memory_pool_share (int64_t budget, int64_t frame, unsigned pools);
+/* spscqueue capacity within bytes: the element rounds up to a power of two, so this rounds down */
+unsigned memory_spsc_capacity (int64_t bytes, int64_t item_size);
+/* buffers of size a queue with these limits holds at most */
+unsigned memory_queue_items (unsigned max_buffers, unsigned max_bytes, unsigned size);
+/* maximum buffer count of a pool of size-byte buffers within its share; never below min + reserve, where the element
+ * couldn't run, and never above the max the pool already had (0 = unlimited) */
+unsigned memory_pool_max (unsigned size, unsigned min, unsigned max, unsigned reserve, int64_t pool_share);
+
+/* the region videocrop cuts out of a capture_width x capture_height frame for a requested one: at least 16 pixels,
+ * inside the frame, and on even coordinates so chroma planes stay aligned */
+void roi_clamp (const struct Roi *requested, int capture_width, int capture_height, struct Roi *region);
+
+void pip_geometry (int width, int height, bool sideways, int *inset_width, int *inset_height, int *xpos, int *ypos);
+
+unsigned planner_partition (const uint64_t *cost, unsigned n, unsigned cores, unsigned *starts, uint64_t *bottleneck);
+
+/* class of an H.264 NAL unit from its header byte (nal_ref_idc and nal_unit_type) */
+int uep_class_h264 (const uint8_t *nal);
+/* class of an H.265 NAL unit type, sub-layer non-reference pictures have even types up to RSV_VCL_N14 */
+int uep_class_h265 (int type);
+/* class of an RTP payload of codec, -1 when the packet doesn't tell: it then belongs to the class of its frame */
+int uep_classify (int codec, const uint8_t *payload, unsigned size);
+/* class of an H.264/H.265 byte-stream frame, the most important of its NAL units, -1 without any */
+int uep_classify_bytestream (int codec, const uint8_t *data, size_t size);
+
+/* what the frame scheduler does with a frame of frame_class at a backlog in ns; skipping is set from a keyframe backlog
+ * on and cleared by the next keyframe, which makes everything after it decodable again */
+enum SchedulerDecision scheduler_decide (int frame_class, uint64_t backlog, bool *skipping);
+
+/* encoder bitrate after a window with queued_ms in the send queues, at monotonic time now (µs); clear_since is when
+ * the queues last became nearly empty, 0 while they aren't */
+int sendq_next_bitrate (int bitrate, int configured, int64_t queued_ms, int64_t now, int64_t changed_at,
+                        int64_t *clear_since);
+/* whether the encoder took a change from previous to bitrate: it holds it and, for a decrease, its output over the
+ * hold stays within a quarter above it; an increase may not show while the picture doesn't need it */
+bool sendq_change_applied (int64_t held, int64_t output, int bitrate, int previous);
+
+/* repair for a round trip in ms (-1 unknown) and a smoothed loss in percent, and the FEC percentage it needs */
+void hybrid_decide (int rtt, double loss, bool bursty, enum HybridMode *mode, int *fec_percentage);
+
+/* a full bucket for rate bytes per second at monotonic time now (µs) */
+void token_bucket_init (struct TokenBucket *bucket, int64_t rate, int64_t now);
+/* refills the bucket up to now, then returns the µs until it holds size bytes (all of it for a larger packet), 0 when
+ * it already does; the caller takes the tokens once it may send */
+int64_t token_bucket_wait (struct TokenBucket *bucket, int64_t rate, int64_t size, int64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STREAM_LOGIC_H__ */
@@ -43,6 +43,51 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
 
     private native void nativeSetAutoFocus(boolean enabled);
 
+    private native void nativeSetVideoCodec(int codec);
+
+    private native void nativeSetSrtpKey(int cipher, byte[] key);
+
+    private native void nativeSetMulticast(int ttl, boolean loop, String iface, int fecPercentage);
+
+    private native void nativeSetCaptureTime(boolean enabled);
+
+    private native void nativeSetTimestampSmoothing(int mode);
+
+    private native void nativeSetThreadPlanner(boolean enabled);
+
+    private static native void nativeSetSpscQueues(boolean enabled);
+
+    private native void nativeSetSilenceSuppression(int thresholdDb);
+
+    private native void nativeSetNetClock(int mode, String address, int port);
+
+    private native void nativeSetPictureInPicture(int mode);
+
+    private native boolean nativeSwitchCamera(int index);
+
+    private native void nativeSetSnapshots(int interval, int port, String path);
+
+    private native void nativeSetStoreForward(boolean enabled, String directory, int capMb, int port, int rateFactor);
+
+    private native void nativeSetPathMtuDiscovery(boolean enabled);
+
+    private native void nativeSetRtpBundle(boolean enabled);
+
+    private native void nativeSetMemoryBudget(int megabytes);
+    private native void nativeSetUnequalProtection(boolean enabled);
+    private native void nativeSetFrameScheduler(boolean enabled);
+    private native void nativeSetSendQueueControl(boolean enabled);
+    private native void nativeSetHybridProtection(boolean enabled);
+    private native void nativeSetFanout(String destinations);
+    private native void nativeSetDigitalZoom(int captureWidth, int captureHeight);
+    private native void nativeSetRoi(int left, int top, int width, int height);
+
+    /** microphone level of the last audio buffer, peak << 16 | RMS as linear 16-bit magnitudes */
+    private native int nativeGetAudioLevel();
+
+    /** statistics gathered by native code, as text */
+    public native String nativeGetStats();
+
     /** video */
     public native void nativeStreamStart(short width, short height, short framerate, int bitrate, boolean autorotation, boolean packetization, byte ip0, byte ip1, byte ip2, byte ip3, int port);
 
@@ -76,6 +121,68 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
             Rotate.AUTOMATIC
     };
 
+    /** order matches enum VideoCodec in android_camera.c */
+    public enum Codec {
+        H264,
+        H265,
+        AV1,
+        VP8,
+        VP9;
+
+        /** VP8/VP9 are always sent over RTP, bare frames can't be split on the receiving end */
+        public boolean requiresPacketization() {
+            return this == VP8 || this == VP9;
+        }
+    }
+
+    /** order matches enum SrtpCipher in android_camera.c */
+    public enum SrtpCipher {
+        NONE(0, null),
+        AES_128_ICM(30, "aes-128-icm"),
+        AES_256_ICM(46, "aes-256-icm"),
+        AES_128_GCM(28, "aes-128-gcm"),
+        AES_256_GCM(44, "aes-256-gcm");
+
+        /** master key + master salt, in bytes */
+        public final int keyLength;
+        /** name used in application/x-srtp caps */
+        public final String capsName;
+
+        SrtpCipher(int keyLength, String capsName) {
+            this.keyLength = keyLength;
+            this.capsName = capsName;
+        }
+
+        /** GCM carries its own authentication tag */
+        public String authName() {
+            return this == AES_128_GCM || this == AES_256_GCM ? "null" : "hmac-sha1-80";
+        }
+    }
+
+    /** order matches enum PipMode in android_camera.c */
+    public enum PictureInPicture {
+        OFF,
+        FRONT_CAMERA,
+        SLATE
+    }
+
+    /** order matches enum NetClockMode in android_camera.c */
+    public enum NetClock {
+        OFF,
+        /** GstNetTimeProvider on a host */
+        NET,
+        NTP,
+        /** the port is used as the PTP domain */
+        PTP
+    }
+
+    /** order matches enum TimestampSmoothing in android_camera.c */
+    public enum Smoothing {
+        OFF,
+        DROP_ONLY,
+        DUPLICATE
+    }
+
     private static final String[] whiteBalanceMap = {
             Camera.Parameters.WHITE_BALANCE_AUTO,
             Camera.Parameters.WHITE_BALANCE_DAYLIGHT,
@@ -103,6 +210,11 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
             }
 
     public static GstAhc init(Context context) throws Exception {
+        return init(context, false);
+    }
+
+    /** spscQueues: lock-free ring queues for the preview, streaming and audio hand-offs instead of queue */
+    public static GstAhc init(Context context, boolean spscQueues) throws Exception {
         System.loadLibrary("gstreamer_android");
         System.loadLibrary("android_camera");
 
@@ -113,6 +225,8 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
 
             throw new Exception("Failed to load application jni library.");
         }
+        Log.d(TAG, "SPSC queues: " + spscQueues);
+        nativeSetSpscQueues(spscQueues);
 
         return new GstAhc(context);
     }
@@ -201,6 +315,152 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
         nativeSetRotateMethod(Arrays.asList(rotateMap).indexOf(rotate));
     }
 
+    /** takes effect the next time streaming starts */
+    public void setVideoCodec(Codec codec) {
+        Log.d(TAG, "Video codec: " + codec);
+        nativeSetVideoCodec(codec.ordinal());
+    }
+
+    /** protects the RTP modes with SRTP from the next stream start on, NONE streams in cleartext */
+    public void setSrtpKey(SrtpCipher cipher, byte[] key) {
+        if (cipher != SrtpCipher.NONE && (key == null || key.length != cipher.keyLength)) {
+            Log.d(TAG, "SRTP key has wrong length for " + cipher + ", SRTP disabled");
+            cipher = SrtpCipher.NONE;
+        }
+        nativeSetSrtpKey(cipher.ordinal(), cipher == SrtpCipher.NONE ? null : key);
+    }
+
+    /** used when the receiver IP is a multicast group, an empty interface name leaves the choice to the system */
+    public void setMulticast(int ttl, boolean loop, String iface, int fecPercentage) {
+        Log.d(TAG, "Multicast TTL: " + ttl + ", loop: " + loop + ", interface: " + iface + ", FEC: " + fecPercentage + "%");
+        nativeSetMulticast(ttl, loop, iface, fecPercentage);
+    }
+
+    /** marks the first RTP packet of every frame with its wall-clock capture time (abs-capture-time, extension ID 3) */
+    public void setCaptureTime(boolean enabled) {
+        Log.d(TAG, "abs-capture-time: " + enabled);
+        nativeSetCaptureTime(enabled);
+    }
+
+    /** regularizes capture timestamps to the nominal framerate from the next stream start on */
+    public void setTimestampSmoothing(Smoothing mode) {
+        Log.d(TAG, "Timestamp smoothing: " + mode);
+        nativeSetTimestampSmoothing(mode.ordinal());
+    }
+
+    /** switches the running pipeline to another camera, the stream keeps going; the gap is shown in statistics.
+     * Returns false if the pipeline stays on its camera */
+    public boolean switchCamera(int index) {
+        Log.d(TAG, "Switching to camera " + index);
+        return nativeSwitchCamera(index);
+    }
+
+    /** sends a 320x240 JPEG every interval seconds (0 = off) to the receiver's port (0 = none) and/or writes it to path (null = none) */
+    public void setSnapshots(int interval, int port, String path) {
+        Log.d(TAG, "Snapshots every " + interval + " s, port " + port + ", file " + path);
+        nativeSetSnapshots(interval, port, path);
+    }
+
+    /** while the receiver is unreachable the stream is queued in directory (up to capMb), and sent to port once it is back,
+     *  live and backlog together at up to rateFactor times the bitrate */
+    public void setStoreForward(boolean enabled, String directory, int capMb, int port, int rateFactor) {
+        Log.d(TAG, "Store-and-forward: " + enabled + ", " + directory + ", " + capMb + " MB, backlog port " + port + ", " + rateFactor + "x");
+        nativeSetStoreForward(enabled, directory, capMb, port, rateFactor);
+    }
+
+    /** caps every queue and buffer pool of the next stream by bytes (0 = unlimited), peaks are shown in statistics */
+    public void setMemoryBudget(int megabytes) {
+        Log.d(TAG, "Memory budget: " + megabytes + " MB");
+        nativeSetMemoryBudget(megabytes);
+    }
+
+    /** keyframes and parameter sets of the next RTP stream get strong FEC and are sent more than once, overhead per class is shown in statistics */
+    public void setUnequalProtection(boolean enabled) {
+        Log.d(TAG, "Unequal error protection: " + enabled);
+        nativeSetUnequalProtection(enabled);
+    }
+
+    /** when the network stalls, the next stream drops stale encoded frames instead of sending them late: non-reference frames first, then up to a requested keyframe */
+    public void setFrameScheduler(boolean enabled) {
+        Log.d(TAG, "Frame scheduler: " + enabled);
+        nativeSetFrameScheduler(enabled);
+    }
+
+    /** the next stream lowers the encoder bitrate while the video and audio sockets hold unsent data, with or without RTP */
+    public void setSendQueueControl(boolean enabled) {
+        Log.d(TAG, "Send-queue congestion control: " + enabled);
+        nativeSetSendQueueControl(enabled);
+    }
+
+    /** the next bundled stream answers NACKs with retransmissions, adds FEC or both, as the receiver's reports suggest */
+    public void setHybridProtection(boolean enabled) {
+        Log.d(TAG, "Hybrid FEC/RTX protection: " + enabled);
+        nativeSetHybridProtection(enabled);
+    }
+
+    /** the next stream also goes to "host:port@kbit/s" receivers separated by commas, each shaped to its rate */
+    public void setFanout(String destinations) {
+        Log.d(TAG, "Fan-out receivers: " + destinations);
+        nativeSetFanout(destinations);
+    }
+
+    /** the camera of the next stream captures captureWidth×captureHeight and a region of it is scaled to the stream size (0 = off) */
+    public void setDigitalZoom(int captureWidth, int captureHeight) {
+        Log.d(TAG, "Digital zoom capture size: " + captureWidth + "×" + captureHeight);
+        nativeSetDigitalZoom(captureWidth, captureHeight);
+    }
+
+    /** streams the region in capture pixels (width 0 = whole frame), takes effect immediately on a running stream */
+    public void setRoi(int left, int top, int width, int height) {
+        nativeSetRoi(left, top, width, height);
+    }
+
+    /** sends RTP audio and video, and their RTCP, from one socket to the video port; audio then goes to the video port too */
+    public void setRtpBundle(boolean enabled) {
+        Log.d(TAG, "RTP bundle: " + enabled);
+        nativeSetRtpBundle(enabled);
+    }
+
+    /** probes the path MTU to the receiver at stream start and sizes RTP packets and slices to fit it */
+    public void setPathMtuDiscovery(boolean enabled) {
+        Log.d(TAG, "Path MTU discovery: " + enabled);
+        nativeSetPathMtuDiscovery(enabled);
+    }
+
+    /** composites a second picture into the corner of the streamed frame from the next stream start on, still one encode */
+    public void setPictureInPicture(PictureInPicture mode) {
+        Log.d(TAG, "Picture-in-picture: " + mode);
+        nativeSetPictureInPicture(mode.ordinal());
+    }
+
+    /** slaves the pipelines to a shared clock from the next stream start on, so timestamps of several devices line up */
+    public void setNetClock(NetClock mode, String address, int port) {
+        Log.d(TAG, "Shared clock: " + mode + " " + address + ":" + port);
+        nativeSetNetClock(mode.ordinal(), address, port);
+    }
+
+    /** drops audio once it stays below thresholdDb (dBFS) for a moment, 0 disables it */
+    public void setSilenceSuppression(int thresholdDb) {
+        Log.d(TAG, "Silence suppression: " + thresholdDb + " dBFS");
+        nativeSetSilenceSuppression(thresholdDb);
+    }
+
+    /** RMS and peak level of the microphone in dBFS, {rms, peak}; -inf when silent or not streaming audio */
+    public double[] getAudioLevel() {
+        int level = nativeGetAudioLevel();
+        return new double[]{toDbfs(level & 0xffff), toDbfs(level >>> 16)};
+    }
+
+    private static double toDbfs(int magnitude) {
+        return 20 * Math.log10(magnitude / 32767.0);
+    }
+
+    /** measures the streaming branch after start and splits it into threads with queues, the plan is shown in statistics */
+    public void setThreadPlanner(boolean enabled) {
+        Log.d(TAG, "Thread planner: " + enabled);
+        nativeSetThreadPlanner(enabled);
+    }
+
     public void changeResolutionTo(int width, int height) {
         Log.d(TAG, "Trying to set resolution to (w: " + width + " h: " + height + ")");
         nativePause();
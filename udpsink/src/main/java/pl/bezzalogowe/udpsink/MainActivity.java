@@ -8,8 +8,9 @@ import android.content.ClipboardManager;
 import android.content.DialogInterface;
 import android.content.Intent;
 import android.content.SharedPreferences;
-import android.content.pm.ActivityInfo;
+import android.content.res.Configuration;
 import android.content.pm.PackageManager;
+import android.hardware.display.DisplayManager;
 import android.net.ConnectivityManager;
 import android.net.NetworkInfo;
 import android.net.Uri;
@@ -23,9 +24,12 @@ import android.app.Activity;
 import android.text.InputType;
 import android.text.TextUtils;
 import android.util.Log;
+import android.view.GestureDetector;
 import android.view.Menu;
 import android.view.MenuInflater;
 import android.view.MenuItem;
+import android.view.MotionEvent;
+import android.view.ScaleGestureDetector;
 import android.view.Surface;
 import android.view.SurfaceView;
 import android.view.View;
@@ -40,6 +44,13 @@ import com.huawei.hms.aaid.HmsInstanceId;
 
 import org.freedesktop.gstreamer.camera.GstAhc;
 
+import java.io.File;
+import java.net.Inet4Address;
+import java.net.InetAddress;
+import java.net.NetworkInterface;
+import java.net.SocketException;
+import java.security.SecureRandom;
+import java.util.Collections;
 import java.util.concurrent.Executor;
 import java.util.concurrent.Executors;
 import java.util.regex.Matcher;
@@ -55,7 +66,7 @@ public class MainActivity extends Activity {
     final int REQUEST_CODE = 200;
     public UpdateUI update;
     //public EditText addressEditText;
-    public TextView feedback;
+    public TextView feedback, audioLevel;
     ImageButton menuButton, stream_start, stream_stop;
     Executor executorAutostart;
     /* https://stackoverflow.com/questions/2250112/why-doesnt-logcat-show-anything-in-my-android/10963065#10963065
@@ -73,9 +84,57 @@ public class MainActivity extends Activity {
     private int bitrateAudio = 16000;
     private boolean autostart = false;
     private boolean autorotation = true;
+    /* the last rotation passed to setOrientation, -1 before the first */
+    private int displayRotation = -1;
     private boolean packetization = false;
     private boolean streamAudio = true;
     private boolean flacEncoding = false;
+    private GstAhc.Codec videoCodec = GstAhc.Codec.H264;
+    private GstAhc.SrtpCipher srtpCipher = GstAhc.SrtpCipher.NONE;
+    private byte[] srtpKey;
+    private int multicastTTL = 1;
+    private boolean multicastLoop = false;
+    private String multicastIface = "";
+    private int multicastFEC = 0;
+    private boolean captureTime = true;
+    private GstAhc.Smoothing smoothing = GstAhc.Smoothing.OFF;
+    private boolean threadPlanner = false;
+    private boolean spscQueues = false;
+    private int silenceThreshold = 0;
+    private GstAhc.NetClock netClock = GstAhc.NetClock.OFF;
+    private int cameraIndex = 0;
+    private int snapshotInterval = 0;
+    private int snapshotPort = 5002;
+    private boolean snapshotFile = false;
+    private boolean storeForward = false;
+    private int storeForwardSize = 256;
+    private int storeForwardPort = 5004;
+    private int storeForwardRate = 4;
+    private boolean pathMtu = true;
+    private boolean rtpBundle = false;
+    private boolean unequalProtection = false;
+    private boolean frameScheduler = false;
+    private boolean sendQueueControl = false;
+    private boolean hybridProtection = false;
+    private String fanoutDestinations = "";
+    private int memoryBudget = 0;
+    private int zoomCaptureWidth = 0, zoomCaptureHeight = 0;
+    /* digital zoom factor and the centre of the streamed region as fractions of the captured frame */
+    private float zoom = 1f, zoomCentreX = 0.5f, zoomCentreY = 0.5f;
+    private ScaleGestureDetector zoomGesture;
+    private GestureDetector panGesture;
+    private GstAhc.PictureInPicture pictureInPicture = GstAhc.PictureInPicture.OFF;
+    private String netClockAddress = "";
+    private int netClockPort = 8554;
+    /* polls the native audio meter while audio streams */
+    private final Runnable audioLevelMeter = new Runnable() {
+        @Override
+        public void run() {
+            double[] level = gstAhc.getAudioLevel();
+            audioLevel.setText(String.format("%s %.0f dBFS (%s %.0f)", getString(R.string.audio_level_rms), Math.max(level[0], -99), getString(R.string.audio_level_peak), Math.max(level[1], -99)));
+            update.updateConversationHandler.postDelayed(this, 100);
+        }
+    };
     private String pushtoken;
     // Whether the user asked to go to PLAYING
     private boolean is_playing_desired;
@@ -89,6 +148,50 @@ public class MainActivity extends Activity {
         return matcher.matches();
     }
 
+    /** 224.0.0.0 to 239.255.255.255 */
+    public static boolean isMulticast(final String ip) {
+        if (!validate(ip)) {
+            return false;
+        }
+        int first = Integer.valueOf(ip.split("\\.")[0]);
+        return 224 <= first && first <= 239;
+    }
+
+    /** the phone's own IPv4 address, where a receiver sends its RTCP */
+    public static String localAddress() {
+        try {
+            for (NetworkInterface networkInterface : Collections.list(NetworkInterface.getNetworkInterfaces())) {
+                for (InetAddress address : Collections.list(networkInterface.getInetAddresses())) {
+                    if (address instanceof Inet4Address && !address.isLoopbackAddress()) {
+                        return address.getHostAddress();
+                    }
+                }
+            }
+        } catch (SocketException | NullPointerException e) {
+            Log.d(TAG, e.toString());
+        }
+        return "PHONE_IP";
+    }
+
+    public static String toHex(final byte[] bytes) {
+        StringBuilder builder = new StringBuilder();
+        for (byte b : bytes) {
+            builder.append(String.format("%02X", b));
+        }
+        return builder.toString();
+    }
+
+    public static byte[] fromHex(final String hex) {
+        if (hex.length() % 2 != 0) {
+            return new byte[0];
+        }
+        byte[] bytes = new byte[hex.length() / 2];
+        for (int i = 0; i < bytes.length; i++) {
+            bytes[i] = (byte) Integer.parseInt(hex.substring(2 * i, 2 * i + 2), 16);
+        }
+        return bytes;
+    }
+
     public static byte[] tokenize(final String address) {
         String[] tokens = address.split("[.,:]");
         byte[] numbers = new byte[]{-128, -128, -128, -128};
@@ -122,7 +225,7 @@ public class MainActivity extends Activity {
         surfaceView = (SurfaceView) findViewById(R.id.surface_view);
 
         try {
-            gstAhc = GstAhc.init(this);
+            gstAhc = GstAhc.init(this, spscQueues);
         } catch (Exception e) {
             Toast.makeText(this, e.getMessage(), Toast.LENGTH_LONG).show();
         }
@@ -138,9 +241,11 @@ public class MainActivity extends Activity {
         });
 
         surfaceView.getHolder().addCallback(gstAhc);
+        setupDigitalZoom();
         setOrientation(this.getWindowManager().getDefaultDisplay().getRotation());
 
         feedback = (TextView) this.findViewById(R.id.caption);
+        audioLevel = (TextView) this.findViewById(R.id.audio_level);
 
         menuButton = (ImageButton) findViewById(R.id.button_menu);
 
@@ -154,12 +259,11 @@ public class MainActivity extends Activity {
         stream_start = (ImageButton) this.findViewById(R.id.button_video_stream_start);
         stream_start.setOnClickListener(new OnClickListener() {
             public void onClick(View v) {
-                //FIXME: rotating the device will revert visibility to these values if locking rotation feature is ever removed
                 //TODO: check pipeline status, then show/hide the right button
-                if (!isNetworkAvailable()) {
+                /* with store-and-forward the stream is queued until the network is back */
+                if (!isNetworkAvailable() && !storeForward) {
                     show_info(getResources().getString(R.string.network_title), getResources().getString(R.string.network_content));
                 } else {
-                    main.setRequestedOrientation(ActivityInfo.SCREEN_ORIENTATION_LOCKED);
                     startVideo();
 
                     if (streamAudio) {
@@ -187,8 +291,9 @@ public class MainActivity extends Activity {
                 gstAhc.nativeStreamStop();
                 if (streamAudio) {
                     gstAhc.nativeStreamStopAudio();
+                    update.updateConversationHandler.removeCallbacks(audioLevelMeter);
+                    audioLevel.setText("");
                 }
-                main.setRequestedOrientation(ActivityInfo.SCREEN_ORIENTATION_FULL_SENSOR);
                 //TODO: native code should trigger hiding and showing buttons
                 stream_start.setVisibility(View.VISIBLE);
                 stream_stop.setVisibility(View.GONE);
@@ -265,6 +370,17 @@ public class MainActivity extends Activity {
             case R.id.preferences:
                 showPreferences();
                 return true;
+            case R.id.switch_camera:
+                if (gstAhc.switchCamera(1 - cameraIndex)) {
+                    cameraIndex = 1 - cameraIndex;
+                } else {
+                    /* the other camera is busy, e.g. feeding the picture-in-picture inset */
+                    Toast.makeText(this, getResources().getString(R.string.switch_camera_failed), Toast.LENGTH_SHORT).show();
+                }
+                return true;
+            case R.id.statistics:
+                show_info(getResources().getString(R.string.statistics_title), gstAhc.nativeGetStats());
+                return true;
             case R.id.help:
                 openHelpPage();
                 return true;
@@ -284,15 +400,42 @@ public class MainActivity extends Activity {
         }
     }
 
+    /* the activity handles rotation itself (configChanges in the manifest), so a running stream survives it
+     * and only the direction of videoflip changes */
+    @Override
+    public void onConfigurationChanged(Configuration newConfig) {
+        super.onConfigurationChanged(newConfig);
+        setOrientation(this.getWindowManager().getDefaultDisplay().getRotation());
+    }
+
+    /* a turn by 180 degrees keeps the configuration, only the display reports it */
+    private final DisplayManager.DisplayListener displayListener = new DisplayManager.DisplayListener() {
+        @Override
+        public void onDisplayAdded(int displayId) {
+        }
+
+        @Override
+        public void onDisplayRemoved(int displayId) {
+        }
+
+        @Override
+        public void onDisplayChanged(int displayId) {
+            setOrientation(getWindowManager().getDefaultDisplay().getRotation());
+        }
+    };
+
     @Override
     public void onResume(/*Bundle savedInstanceState*/) {
         super.onResume();
         //Toast.makeText(this, "Resume", Toast.LENGTH_LONG).show();
         setOrientation(this.getWindowManager().getDefaultDisplay().getRotation());
+        ((DisplayManager) getSystemService(DISPLAY_SERVICE)).registerDisplayListener(displayListener, null);
         /*gstAhc.nativeInit();*/
     }
 
     protected void onPause() {
+        ((DisplayManager) getSystemService(DISPLAY_SERVICE)).unregisterDisplayListener(displayListener);
+        displayRotation = -1;
 /*
         saveReceiverIP();
         Toast.makeText(this, "Pause", Toast.LENGTH_LONG).show();
@@ -369,6 +512,9 @@ public class MainActivity extends Activity {
                         editor.putString("receiver-ip", receiverIP);
                         editor.putString("port-video", Integer.toString(portVideo));
                         editor.commit();
+                        if (isMulticast(receiverIP)) {
+                            Toast.makeText(main, getResources().getString(R.string.multicast_group), Toast.LENGTH_LONG).show();
+                        }
                     } else {
                         input.setText("0.0.0.0:" + result[1]);
                     }
@@ -472,14 +618,95 @@ public class MainActivity extends Activity {
                 ", IP: " + (ip_as_bytes[0] + 128) + "." + (ip_as_bytes[1] + 128) + "." + (ip_as_bytes[2] + 128) + "." + (ip_as_bytes[3] + 128) +
                 ":" + portVideo);
 
+        gstAhc.setVideoCodec(videoCodec);
+        gstAhc.setSrtpKey(srtpCipher, srtpKey);
+        gstAhc.setMulticast(multicastTTL, multicastLoop, multicastIface, multicastFEC);
+        gstAhc.setCaptureTime(captureTime);
+        gstAhc.setTimestampSmoothing(smoothing);
+        gstAhc.setThreadPlanner(threadPlanner);
+        gstAhc.setPictureInPicture(pictureInPicture);
+        gstAhc.setSnapshots(snapshotInterval, snapshotPort, snapshotFile ? new File(getExternalFilesDir(null), "snapshot.jpg").getAbsolutePath() : null);
+        gstAhc.setPathMtuDiscovery(pathMtu);
+        gstAhc.setUnequalProtection(unequalProtection);
+        gstAhc.setFrameScheduler(frameScheduler);
+        gstAhc.setSendQueueControl(sendQueueControl);
+        gstAhc.setHybridProtection(hybridProtection);
+        gstAhc.setFanout(fanoutDestinations);
+        gstAhc.setRtpBundle(isBundled());
+        gstAhc.setMemoryBudget(memoryBudget);
+        gstAhc.setDigitalZoom(zoomCaptureWidth, zoomCaptureHeight);
+        updateRoi();
+        gstAhc.setStoreForward(storeForward, new File(getCacheDir(), "store-forward").getAbsolutePath(), storeForwardSize, storeForwardPort, storeForwardRate);
+        gstAhc.setNetClock(netClock, netClockAddress, netClockPort);
         gstAhc.nativeStreamStart(videoWidth, videoHeight, framerate, bitrateVideo, autorotation, packetization, ip_as_bytes[0], ip_as_bytes[1], ip_as_bytes[2], ip_as_bytes[3], portVideo);
     }
 
     private void startAudio(boolean flac) {
         byte[] ip_as_bytes = tokenize(receiverIP);
+        gstAhc.setMulticast(multicastTTL, multicastLoop, multicastIface, multicastFEC);
         String message = (ip_as_bytes[0] + 128) + "." + (ip_as_bytes[1] + 128) + "." + (ip_as_bytes[2] + 128) + "." + (ip_as_bytes[3] + 128);
         //this.update.updateConversationHandler.post(new UpdateTextThread(feedback, "streaming audio started"));
-        gstAhc.nativeStreamStartAudio(flac, bitrateAudio, ip_as_bytes[0], ip_as_bytes[1], ip_as_bytes[2], ip_as_bytes[3], portAudio);
+        gstAhc.setSilenceSuppression(silenceThreshold);
+        gstAhc.setRtpBundle(isBundled());
+        gstAhc.setMemoryBudget(memoryBudget);
+        gstAhc.nativeStreamStartAudio(flac, bitrateAudio, ip_as_bytes[0], ip_as_bytes[1], ip_as_bytes[2], ip_as_bytes[3], isBundled() ? portVideo : portAudio);
+        update.updateConversationHandler.removeCallbacks(audioLevelMeter);
+        update.updateConversationHandler.post(audioLevelMeter);
+    }
+
+    /* pinching the preview zooms into the captured frame, dragging moves the streamed region */
+    private void setupDigitalZoom() {
+        zoomGesture = new ScaleGestureDetector(this, new ScaleGestureDetector.SimpleOnScaleGestureListener() {
+            @Override
+            public boolean onScale(ScaleGestureDetector detector) {
+                zoom = Math.max(1f, Math.min(8f, zoom * detector.getScaleFactor()));
+                updateRoi();
+                return true;
+            }
+        });
+        panGesture = new GestureDetector(this, new GestureDetector.SimpleOnGestureListener() {
+            @Override
+            public boolean onScroll(MotionEvent e1, MotionEvent e2, float distanceX, float distanceY) {
+                /* the preview shows the whole captured frame */
+                zoomCentreX += distanceX / surfaceView.getWidth();
+                zoomCentreY += distanceY / surfaceView.getHeight();
+                updateRoi();
+                return true;
+            }
+        });
+        surfaceView.setOnTouchListener(new View.OnTouchListener() {
+            @Override
+            public boolean onTouch(View v, MotionEvent event) {
+                if (zoomCaptureWidth == 0) {
+                    return false;
+                }
+                zoomGesture.onTouchEvent(event);
+                if (!zoomGesture.isInProgress()) {
+                    panGesture.onTouchEvent(event);
+                }
+                return true;
+            }
+        });
+    }
+
+    /* the region keeps the stream's aspect ratio and stays inside the captured frame */
+    private void updateRoi() {
+        if (zoomCaptureWidth == 0) {
+            gstAhc.setRoi(0, 0, 0, 0);
+            return;
+        }
+        float scale = Math.min((float) zoomCaptureWidth / videoWidth, (float) zoomCaptureHeight / videoHeight) / zoom;
+        int width = Math.round(videoWidth * scale), height = Math.round(videoHeight * scale);
+        float halfX = width / 2f / zoomCaptureWidth, halfY = height / 2f / zoomCaptureHeight;
+        zoomCentreX = Math.max(halfX, Math.min(1f - halfX, zoomCentreX));
+        zoomCentreY = Math.max(halfY, Math.min(1f - halfY, zoomCentreY));
+        gstAhc.setRoi(Math.round(zoomCentreX * zoomCaptureWidth) - width / 2, Math.round(zoomCentreY * zoomCaptureHeight) - height / 2, width, height);
+    }
+
+    /* bundling needs RTP, and SRTP would reject the cleartext audio; a multicast group can't send RTCP back to one port */
+    private boolean isBundled() {
+        return rtpBundle && (packetization || videoCodec.requiresPacketization())
+                && srtpCipher == GstAhc.SrtpCipher.NONE && !isMulticast(receiverIP);
     }
 
     private void autostart() {
@@ -520,6 +747,11 @@ public class MainActivity extends Activity {
     }
 
     private void setOrientation(int rotation) {
+        /* the configuration and the display both report a quarter turn */
+        if (rotation == displayRotation) {
+            return;
+        }
+        displayRotation = rotation;
         GstAhc.Rotate rotate = GstAhc.Rotate.NONE;
         switch (rotation) {
             case Surface.ROTATION_0:
@@ -555,17 +787,66 @@ public class MainActivity extends Activity {
     private void readPreferences() {
         settings = PreferenceManager.getDefaultSharedPreferences(this);
         receiverIP = settings.getString("receiver-ip", "192.168.0.100");
-        portVideo = Integer.valueOf(settings.getString("port-video", "5000"));
-        portAudio = Integer.valueOf(settings.getString("port-audio", "5001"));
+        portVideo = readInt("port-video", 5000);
+        portAudio = readInt("port-audio", 5001);
         //resolutionIndex = Byte.valueOf(settings.getString("h264-resolution", "3"));
         framerate = Byte.valueOf(settings.getString("h264-framerate", "15"));
-        bitrateVideo = Integer.valueOf(settings.getString("h264-bitrate", "512000"));
-        bitrateAudio = Integer.valueOf(settings.getString("opensles-bitrate", "16000"));
+        bitrateVideo = readInt("h264-bitrate", 512000);
+        bitrateAudio = readInt("opensles-bitrate", 16000);
         streamAudio = settings.getBoolean("stream-audio", true);
         flacEncoding = settings.getBoolean("flac-toggle", false);
         autostart = settings.getBoolean("autostart", false);
         autorotation = settings.getBoolean("video-direction", true);
         packetization = settings.getBoolean("rtph264pay", false);
+        try {
+            videoCodec = GstAhc.Codec.valueOf(settings.getString("video-codec", "H264"));
+        } catch (IllegalArgumentException e) {
+            videoCodec = GstAhc.Codec.H264;
+        }
+        threadPlanner = settings.getBoolean("thread-planner", false);
+        spscQueues = settings.getBoolean("spsc-queue", false);
+        silenceThreshold = readInt("silence-threshold", 0);
+        snapshotInterval = readInt("snapshot-interval", 0);
+        snapshotPort = readInt("snapshot-port", 5002);
+        snapshotFile = settings.getBoolean("snapshot-file", false);
+        storeForward = settings.getBoolean("store-forward", false);
+        pathMtu = settings.getBoolean("path-mtu", true);
+        rtpBundle = settings.getBoolean("rtp-bundle", false);
+        unequalProtection = settings.getBoolean("unequal-protection", false);
+        frameScheduler = settings.getBoolean("frame-scheduler", false);
+        sendQueueControl = settings.getBoolean("send-queue-control", false);
+        hybridProtection = settings.getBoolean("hybrid-protection", false);
+        fanoutDestinations = settings.getString("fanout-destinations", "").trim();
+        memoryBudget = readInt("memory-budget", 0);
+        String[] zoomCapture = settings.getString("zoom-capture", "0").split("x");
+        zoomCaptureWidth = zoomCapture.length == 2 ? parseInt(zoomCapture[0], 0) : 0;
+        zoomCaptureHeight = zoomCapture.length == 2 ? parseInt(zoomCapture[1], 0) : 0;
+        storeForwardSize = readInt("store-forward-size", 256);
+        storeForwardPort = readInt("store-forward-port", 5004);
+        storeForwardRate = readInt("store-forward-rate", 4);
+        try {
+            pictureInPicture = GstAhc.PictureInPicture.valueOf(settings.getString("picture-in-picture", "OFF"));
+        } catch (IllegalArgumentException e) {
+            pictureInPicture = GstAhc.PictureInPicture.OFF;
+        }
+        try {
+            netClock = GstAhc.NetClock.valueOf(settings.getString("net-clock", "OFF"));
+        } catch (IllegalArgumentException e) {
+            netClock = GstAhc.NetClock.OFF;
+        }
+        netClockAddress = settings.getString("net-clock-address", "").trim();
+        netClockPort = readInt("net-clock-port", 8554);
+        readSrtpKey();
+        multicastTTL = readInt("multicast-ttl", 1);
+        multicastLoop = settings.getBoolean("multicast-loop", false);
+        multicastIface = settings.getString("multicast-iface", "").trim();
+        multicastFEC = readInt("multicast-fec", 0);
+        captureTime = settings.getBoolean("abs-capture-time", true);
+        try {
+            smoothing = GstAhc.Smoothing.valueOf(settings.getString("timestamp-smoothing", "OFF"));
+        } catch (IllegalArgumentException e) {
+            smoothing = GstAhc.Smoothing.OFF;
+        }
 
         String deviceManufacturer = android.os.Build.MANUFACTURER;
         Log.d(TAG, "MANUFACTURER: " + deviceManufacturer);
@@ -592,7 +873,45 @@ public class MainActivity extends Activity {
             videoWidth = 640;
             videoHeight = 480;
         }
-        Log.d("preferences read", "resolution: " + videoWidth + "×" + videoHeight + ", framerate: " + framerate + ", h264 bitrate: " + bitrateVideo + ", opensles bitrate: " + bitrateAudio + ", FLAC: " + flacEncoding);
+        Log.d("preferences read", "resolution: " + videoWidth + "×" + videoHeight + ", framerate: " + framerate + ", codec: " + videoCodec + ", video bitrate: " + bitrateVideo + ", opensles bitrate: " + bitrateAudio + ", FLAC: " + flacEncoding);
+    }
+
+    /** an integer preference, its default when it was left empty or isn't a number */
+    private int readInt(String key, int defaultValue) {
+        return parseInt(settings.getString(key, ""), defaultValue);
+    }
+
+    private static int parseInt(String value, int defaultValue) {
+        try {
+            return Integer.parseInt(value.trim());
+        } catch (NumberFormatException e) {
+            return defaultValue;
+        }
+    }
+
+    /** reads the SRTP key, a new random one is generated and saved if it doesn't fit the cipher */
+    private void readSrtpKey() {
+        try {
+            srtpCipher = GstAhc.SrtpCipher.valueOf(settings.getString("srtp-cipher", "NONE"));
+        } catch (IllegalArgumentException e) {
+            srtpCipher = GstAhc.SrtpCipher.NONE;
+        }
+        if (srtpCipher == GstAhc.SrtpCipher.NONE) {
+            return;
+        }
+        try {
+            srtpKey = fromHex(settings.getString("srtp-key", "").trim());
+        } catch (NumberFormatException e) {
+            srtpKey = new byte[0];
+        }
+        if (srtpKey.length != srtpCipher.keyLength) {
+            srtpKey = new byte[srtpCipher.keyLength];
+            new SecureRandom().nextBytes(srtpKey);
+            SharedPreferences.Editor editor = settings.edit();
+            editor.putString("srtp-key", toHex(srtpKey));
+            editor.commit();
+            Log.d(TAG, "Generated new " + srtpCipher + " key");
+        }
     }
 
     private void openPage(String url) {
@@ -601,15 +920,92 @@ public class MainActivity extends Activity {
     }
 
     public void show_usage() {
-        String messageVideo = "gst-launch-1.0 udpsrc port=" + portVideo + " ! h264parse ! avdec_h264 ! autovideosink";
-        String messageVideoRTP = "gst-launch-1.0 udpsrc port=" + portVideo + " caps='application/x-rtp, media=(string)video, clock-rate=(int)90000, encoding-name=(string)H264' ! rtpjitterbuffer ! rtph264depay ! h264parse ! avdec_h264 ! autovideosink fps-update-interval=1000 sync=false";
+        /* parser and decoder for the selected codec */
+        String decoder, encodingName, depayloader;
+        switch (videoCodec) {
+            case H265:
+                decoder = "h265parse ! avdec_h265";
+                encodingName = "H265";
+                depayloader = "rtph265depay";
+                break;
+            case AV1:
+                decoder = "av1parse ! dav1ddec";
+                encodingName = "AV1";
+                depayloader = "rtpav1depay";
+                break;
+            case VP8:
+                decoder = "vp8dec";
+                encodingName = "VP8";
+                depayloader = "rtpvp8depay";
+                break;
+            case VP9:
+                decoder = "vp9dec";
+                encodingName = "VP9";
+                depayloader = "rtpvp9depay";
+                break;
+            default:
+                decoder = "h264parse ! avdec_h264";
+                encodingName = "H264";
+                depayloader = "rtph264depay";
+                break;
+        }
+        /* receivers of a multicast stream join the group */
+        boolean multicast = isMulticast(receiverIP);
+        String source = multicast ? "udpsrc address=" + receiverIP + " " : "udpsrc ";
+        String messageVideo = "gst-launch-1.0 " + source + "port=" + portVideo + " ! " + decoder + " ! autovideosink";
+
+        String extmap = captureTime ? ", extmap-3=(string)http://www.webrtc.org/experiments/rtp-hdrext/abs-capture-time" : "";
+        String capsRTP = "application/x-rtp, media=(string)video, clock-rate=(int)90000, encoding-name=(string)" + encodingName + ", payload=(int)96" + extmap;
+        String decryption = "";
+        if (srtpCipher != GstAhc.SrtpCipher.NONE) {
+            capsRTP = "application/x-srtp, media=(string)video, clock-rate=(int)90000, encoding-name=(string)" + encodingName + ", payload=(int)96" + extmap +
+                    ", srtp-key=(buffer)" + toHex(srtpKey) +
+                    ", srtp-cipher=(string)" + srtpCipher.capsName + ", srtp-auth=(string)" + srtpCipher.authName() +
+                    ", srtcp-cipher=(string)" + srtpCipher.capsName + ", srtcp-auth=(string)" + srtpCipher.authName();
+            decryption = " ! srtpdec";
+        }
+        /* FEC packets are sent to multicast groups, and to anyone with unequal protection; rtpbin pairs rtpulpfecdec with its packet storage */
+        String jitterbuffer = multicast && multicastFEC > 0 || unequalProtection
+                ? " ! rtpbin.recv_rtp_sink_0 rtpbin name=rtpbin fec-decoders='fec,0=\"rtpulpfecdec\\ pt\\=122\";' ! "
+                : " ! rtpjitterbuffer ! ";
+        String messageVideoRTP = "gst-launch-1.0 " + source + "port=" + portVideo + " caps='" + capsRTP + "'" + decryption + jitterbuffer + depayloader + " ! " + decoder + " ! autovideosink fps-update-interval=1000 sync=false";
 
-        String messageRAW = "udpsrc port=" + portAudio + " ! audio/x-raw, format=S16LE, channels=1, rate=16000 ! autoaudiosink sync=false";
-        String messageFLAC = "udpsrc port=" + portAudio + " ! flacparse ! flacdec ! autoaudiosink sync=false";
+        String messageRAW = source + "port=" + portAudio + " ! audio/x-raw, format=S16LE, channels=1, rate=16000 ! autoaudiosink sync=false";
+        String messageFLAC = source + "port=" + portAudio + " ! flacparse ! flacdec ! autoaudiosink sync=false";
 
         /* shows different message depending on preferences */
         String messageAudio = flacEncoding ? messageFLAC : messageRAW;
-        final String message = packetization ? messageVideoRTP : messageVideo + (streamAudio ? " " + messageAudio : "");
+        /* every JPEG arrives in one datagram */
+        String messageSnapshot = snapshotInterval > 0 && snapshotPort > 0
+                ? "\n\ngst-launch-1.0 " + source + "port=" + snapshotPort + " ! multifilesink location=snapshot-%05d.jpg"
+                : "";
+        if (isBundled()) {
+            /* the receiver splits the bundle by payload type, RTCP (72 and 73 when read as RTP), FEC and retransmissions are left out */
+            String audioCaps = flacEncoding
+                    ? "application/x-rtp, media=(string)application, clock-rate=(int)90000, encoding-name=(string)X-GST, payload=(int)98"
+                    : "application/x-rtp, media=(string)audio, clock-rate=(int)" + bitrateAudio + ", encoding-name=(string)L16, channels=(int)1, payload=(int)97";
+            String audioDecoder = flacEncoding ? "rtpgstdepay ! flacparse ! flacdec" : "rtpL16depay";
+            String audioReceiver = streamAudio ? " demux.src_" + (flacEncoding ? 98 : 97) + " ! capssetter replace=true caps='" + audioCaps + "' ! rtpjitterbuffer ! " + audioDecoder + " ! audioconvert ! autoaudiosink sync=false" : "";
+            messageVideoRTP = "gst-launch-1.0 " + source + "port=" + portVideo + " caps='" + capsRTP + "' ! rtpptdemux name=demux ignored-payload-types='<72,73" + (unequalProtection ? ",122" : "") + ">'" +
+                    " demux.src_96 ! rtpjitterbuffer ! " + depayloader + " ! " + decoder + " ! autovideosink fps-update-interval=1000 sync=false" + audioReceiver;
+            if (hybridProtection) {
+                /* the phone's sender reports (72) and the video with its FEC and retransmissions go into an rtpsession, which sends
+                 * the NACKs of the jitterbuffer and receiver reports back to the phone's bundle port; rtprtxreceive has to see the
+                 * requests, so it sits between the two, and rtpbin repairs from the FEC with its packet storage */
+                messageVideoRTP = "gst-launch-1.0 rtpsession name=session rtp-profile=avpf " + source + "port=" + portVideo + " caps='" + capsRTP + "' ! rtpptdemux name=demux ignored-payload-types='<73>'" +
+                        " demux.src_72 ! capssetter replace=true caps='application/x-rtcp' ! session.recv_rtcp_sink" +
+                        " demux.src_96 ! funnel name=video ! session.recv_rtp_sink demux.src_99 ! video. demux.src_122 ! video." +
+                        " session.recv_rtp_src ! rtprtxreceive payload-type-map='application/x-rtp-pt-map, 96=(uint)99' ! rtpssrcdemux ! rtpjitterbuffer do-retransmission=true" +
+                        " ! rtpbin.recv_rtp_sink_0 rtpbin name=rtpbin fec-decoders='fec,0=\"rtpulpfecdec\\ pt\\=122\";' ! " + depayloader + " ! " + decoder + " ! autovideosink fps-update-interval=1000 sync=false" +
+                        " session.send_rtcp_src ! udpsink host=" + localAddress() + " port=" + portVideo + " sync=false async=false" + audioReceiver;
+            }
+        }
+        String messageStream = packetization || videoCodec.requiresPacketization() ? messageVideoRTP : messageVideo;
+        /* the backlog is the same stream, only late, on its own port */
+        String messageBacklog = storeForward
+                ? "\n\n" + messageStream.replace("port=" + portVideo, "port=" + storeForwardPort)
+                : "";
+        final String message = (packetization || videoCodec.requiresPacketization() ? messageVideoRTP : messageVideo + (streamAudio ? " " + messageAudio : "")) + messageSnapshot + messageBacklog;
 
         new AlertDialog.Builder(this).setIcon(android.R.drawable.ic_dialog_info)
                 .setTitle(getResources().getString(R.string.usage_title))
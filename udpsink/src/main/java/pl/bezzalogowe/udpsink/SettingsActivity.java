@@ -7,6 +7,7 @@ import android.media.Ringtone;
 import android.media.RingtoneManager;
 import android.net.Uri;
 import android.os.Bundle;
+import android.preference.EditTextPreference;
 import android.preference.ListPreference;
 import android.preference.Preference;
 import android.preference.PreferenceActivity;
@@ -14,6 +15,7 @@ import android.preference.SwitchPreference;
 import android.support.v7.app.ActionBar;
 import android.preference.PreferenceManager;
 import android.preference.RingtonePreference;
+import android.text.InputType;
 import android.text.TextUtils;
 import android.util.Log;
 import android.view.MenuItem;
@@ -50,6 +52,12 @@ public class SettingsActivity extends PreferenceActivity {
         public boolean onPreferenceChange(Preference preference, Object value) {
             String stringValue = value.toString();
 
+            // A numeric field can still be left empty, the previous value is kept then.
+            if (preference instanceof EditTextPreference && !isNumber(preference, stringValue)) {
+                Toast.makeText(preference.getContext(), R.string.invalid_number, Toast.LENGTH_SHORT).show();
+                return false;
+            }
+
             if (preference instanceof ListPreference) {
                 // For list preferences, look up the correct display value in
                 // the preference's 'entries' list.
@@ -78,6 +86,20 @@ public class SettingsActivity extends PreferenceActivity {
         }
     };
 
+    /** whether a value fits a preference, only those edited as numbers need to parse as one */
+    private static boolean isNumber(Preference preference, String value) {
+        int inputType = ((EditTextPreference) preference).getEditText().getInputType();
+        if ((inputType & InputType.TYPE_MASK_CLASS) != InputType.TYPE_CLASS_NUMBER) {
+            return true;
+        }
+        try {
+            Integer.parseInt(value.trim());
+            return true;
+        } catch (NumberFormatException e) {
+            return false;
+        }
+    }
+
     /**
      * Helper method to determine if the device has an extra-large screen. For
      * example, 10" tablets are extra-large.
@@ -146,12 +168,43 @@ public class SettingsActivity extends PreferenceActivity {
 
         bindPreferenceSummaryToValue(findPreference("video-size"));
         bindPreferenceSummaryToValue(findPreference("h264-framerate"));
+        bindPreferenceSummaryToValue(findPreference("video-codec"));
+        bindPreferenceSummaryToValue(findPreference("timestamp-smoothing"));
+        bindPreferenceSummaryToValue(findPreference("picture-in-picture"));
+        bindPreferenceSummaryToValue(findPreference("memory-budget"));
+        bindPreferenceSummaryToValue(findPreference("zoom-capture"));
+        bindPreferenceSummaryToValue(findPreference("snapshot-interval"));
+        bindPreferenceSummaryToValue(findPreference("snapshot-port"));
+        bindSwitchPreferenceSummaryToValue(findPreference("snapshot-file"));
+        bindSwitchPreferenceSummaryToValue(findPreference("path-mtu"));
+        bindSwitchPreferenceSummaryToValue(findPreference("rtp-bundle"));
+        bindSwitchPreferenceSummaryToValue(findPreference("unequal-protection"));
+        bindSwitchPreferenceSummaryToValue(findPreference("frame-scheduler"));
+        bindSwitchPreferenceSummaryToValue(findPreference("send-queue-control"));
+        bindSwitchPreferenceSummaryToValue(findPreference("hybrid-protection"));
+        bindPreferenceSummaryToValue(findPreference("fanout-destinations"));
+        bindSwitchPreferenceSummaryToValue(findPreference("store-forward"));
+        bindPreferenceSummaryToValue(findPreference("store-forward-size"));
+        bindPreferenceSummaryToValue(findPreference("store-forward-port"));
+        bindPreferenceSummaryToValue(findPreference("store-forward-rate"));
         bindPreferenceSummaryToValue(findPreference("h264-bitrate"));
         bindSwitchPreferenceSummaryToValue(findPreference("autostart"));
         bindSwitchPreferenceSummaryToValue(findPreference("video-direction"));
+        bindSwitchPreferenceSummaryToValue(findPreference("thread-planner"));
+        bindSwitchPreferenceSummaryToValue(findPreference("spsc-queue"));
         bindSwitchPreferenceSummaryToValue(findPreference("rtph264pay"));
+        bindSwitchPreferenceSummaryToValue(findPreference("abs-capture-time"));
+        bindPreferenceSummaryToValue(findPreference("srtp-cipher"));
+        bindPreferenceSummaryToValue(findPreference("multicast-ttl"));
+        bindSwitchPreferenceSummaryToValue(findPreference("multicast-loop"));
+        bindPreferenceSummaryToValue(findPreference("multicast-iface"));
+        bindPreferenceSummaryToValue(findPreference("multicast-fec"));
+        bindPreferenceSummaryToValue(findPreference("net-clock"));
+        bindPreferenceSummaryToValue(findPreference("net-clock-address"));
+        bindPreferenceSummaryToValue(findPreference("net-clock-port"));
         bindSwitchPreferenceSummaryToValue(findPreference("stream-audio"));
         bindSwitchPreferenceSummaryToValue(findPreference("flac-toggle"));
+        bindPreferenceSummaryToValue(findPreference("silence-threshold"));
         bindPreferenceSummaryToValue(findPreference("opensles-bitrate"));
         bindPreferenceSummaryToValue(findPreference("port-video"));
         bindPreferenceSummaryToValue(findPreference("port-audio"));
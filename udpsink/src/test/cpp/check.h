@@ -0,0 +1,45 @@
+/*
+ * Minimal assertions for the host tests of the native code: a failed check prints where it failed and the test
+ * program exits non-zero once all checks have run.
+ */
+
+#ifndef __CHECK_H__
+#define __CHECK_H__
+
+#include <stdio.h>
+#include <string.h>
+
+static int check_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_INT(actual, expected) \
+    do { \
+        long long check_actual = (long long) (actual), check_expected = (long long) (expected); \
+        if (check_actual != check_expected) { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, check_actual, \
+                    check_expected); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_STR(actual, expected) \
+    do { \
+        const char *check_actual = (actual), *check_expected = (expected); \
+        if (strcmp(check_actual, check_expected) != 0) { \
+            fprintf(stderr, "%s:%d: %s is \"%s\", expected \"%s\"\n", __FILE__, __LINE__, #actual, check_actual, \
+                    check_expected); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_RESULT(name) \
+    (check_failures ? (fprintf(stderr, "%s: %d failed\n", name, check_failures), 1) : (printf("%s: passed\n", name), 0))
+
+#endif /* __CHECK_H__ */
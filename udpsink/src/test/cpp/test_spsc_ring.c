@@ -0,0 +1,142 @@
+/* host tests of spsc_ring.h, the index arithmetic of the spscqueue element */
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include "check.h"
+#include "spsc_ring.h"
+
+#define ITEMS 1000000
+
+static void
+test_capacity (void)
+{
+    CHECK_INT(spsc_ring_round_capacity(0), 1);
+    CHECK_INT(spsc_ring_round_capacity(1), 1);
+    CHECK_INT(spsc_ring_round_capacity(3), 4);
+    CHECK_INT(spsc_ring_round_capacity(16), 16);
+    CHECK_INT(spsc_ring_round_capacity(17), 32);
+}
+
+static void
+test_order_and_full (void)
+{
+    void *items[4];
+    SpscRing ring;
+    unsigned int tail;
+
+    spsc_ring_init(&ring, items, 4);
+    CHECK_INT(spsc_ring_oldest(&ring, &tail), -1);
+    for (uintptr_t i = 1; i <= 4; i++) {
+        CHECK(spsc_ring_next_slot(&ring) >= 0);
+        spsc_ring_publish(&ring, (void *) i);
+    }
+    CHECK_INT(spsc_ring_level(&ring), 4);
+    CHECK_INT(spsc_ring_next_slot(&ring), -1);
+    for (uintptr_t i = 1; i <= 4; i++) {
+        int slot = spsc_ring_oldest(&ring, &tail);
+        CHECK(slot >= 0);
+        CHECK_INT((uintptr_t) ring.items[slot], i);
+        CHECK(spsc_ring_take(&ring, tail));
+    }
+    CHECK_INT(spsc_ring_level(&ring), 0);
+}
+
+/* the indices run freely, the level and slots stay right where they wrap */
+static void
+test_wrap (void)
+{
+    void *items[8];
+    SpscRing ring;
+    unsigned int tail;
+
+    spsc_ring_init(&ring, items, 8);
+    ring.head = ring.tail = UINT_MAX - 2;
+    for (uintptr_t i = 0; i < 6; i++) {
+        spsc_ring_publish(&ring, (void *) i);
+    }
+    CHECK_INT(spsc_ring_level(&ring), 6);
+    for (uintptr_t i = 0; i < 6; i++) {
+        int slot = spsc_ring_oldest(&ring, &tail);
+        CHECK_INT((uintptr_t) ring.items[slot], i);
+        CHECK(spsc_ring_take(&ring, tail));
+    }
+    CHECK_INT(ring.head, 3);
+    CHECK_INT(spsc_ring_level(&ring), 0);
+}
+
+/* a producer dropping the oldest item and the consumer both go for the same tail, only one of them gets it */
+static void
+test_take_race (void)
+{
+    void *items[2];
+    SpscRing ring;
+    unsigned int producer_tail, consumer_tail;
+
+    spsc_ring_init(&ring, items, 2);
+    spsc_ring_publish(&ring, (void *) 1);
+    spsc_ring_publish(&ring, (void *) 2);
+    spsc_ring_oldest(&ring, &producer_tail);
+    spsc_ring_oldest(&ring, &consumer_tail);
+    CHECK(spsc_ring_take(&ring, consumer_tail));
+    CHECK(!spsc_ring_take(&ring, producer_tail));
+    CHECK_INT(spsc_ring_level(&ring), 1);
+    CHECK_INT((uintptr_t) spsc_ring_drain_one(&ring), 2);
+    CHECK(spsc_ring_drain_one(&ring) == NULL);
+}
+
+static void *
+produce (void *data)
+{
+    SpscRing *ring = data;
+
+    for (uintptr_t i = 1; i <= ITEMS; i++) {
+        while (spsc_ring_next_slot(ring) < 0) {
+            sched_yield();
+        }
+        spsc_ring_publish(ring, (void *) i);
+    }
+    return NULL;
+}
+
+/* a producer and a consumer thread, every item arrives once and in order */
+static void
+test_threads (void)
+{
+    void *items[64];
+    SpscRing ring;
+    pthread_t producer;
+    uintptr_t expected = 1;
+    int out_of_order = 0;
+
+    spsc_ring_init(&ring, items, 64);
+    pthread_create(&producer, NULL, produce, &ring);
+    while (expected <= ITEMS) {
+        unsigned int tail;
+        int slot = spsc_ring_oldest(&ring, &tail);
+        if (slot < 0) {
+            sched_yield();
+            continue;
+        }
+        uintptr_t item = (uintptr_t) ring.items[slot];
+        if (spsc_ring_take(&ring, tail)) {
+            out_of_order += item != expected;
+            expected++;
+        }
+    }
+    pthread_join(producer, NULL);
+    CHECK_INT(out_of_order, 0);
+    CHECK_INT(spsc_ring_level(&ring), 0);
+}
+
+int
+main (void)
+{
+    test_capacity();
+    test_order_and_full();
+    test_wrap();
+    test_take_race();
+    test_threads();
+    return CHECK_RESULT("spsc_ring");
+}
@@ -0,0 +1,464 @@
+/* host tests of stream_logic.c, the decisions the streaming branch takes without GStreamer */
+
+#include "check.h"
+#include "stream_logic.h"
+
+static void
+test_encoder_bitrate_property (void)
+{
+    int scale;
+
+    CHECK_STR(encoder_bitrate_property("openh264enc", &scale), "bitrate");
+    CHECK_INT(scale, 1);
+    CHECK_STR(encoder_bitrate_property("x265enc", &scale), "bitrate");
+    CHECK_INT(scale, 1000);
+    CHECK_STR(encoder_bitrate_property("svtav1enc", &scale), "target-bitrate");
+    CHECK_INT(scale, 1000);
+    CHECK_STR(encoder_bitrate_property("rav1enc", &scale), "bitrate");
+    CHECK_INT(scale, 1);
+}
+
+static void
+test_vpx_encoder (void)
+{
+    int scale;
+
+    CHECK_STR(encoder_bitrate_property("vp8enc", &scale), "target-bitrate");
+    CHECK_INT(scale, 1);
+    CHECK_STR(encoder_bitrate_property("vp9enc", &scale), "target-bitrate");
+    CHECK_INT(scale, 1);
+    CHECK_INT(vpx_encoder_threads(0), 1);
+    CHECK_INT(vpx_encoder_threads(2), 2);
+    CHECK_INT(vpx_encoder_threads(8), 4);
+}
+
+static void
+test_srtp_cipher (void)
+{
+    CHECK(srtp_cipher_name(SRTP_NONE) == NULL);
+    CHECK(srtp_cipher_name(SRTP_AES_256_GCM + 1) == NULL);
+    CHECK_STR(srtp_cipher_name(SRTP_AES_128_ICM), "aes-128-icm");
+    CHECK_STR(srtp_cipher_name(SRTP_AES_256_GCM), "aes-256-gcm");
+    /* 16 or 32 byte key and a 14 byte salt for ICM, a 12 byte salt for GCM */
+    CHECK_INT(srtp_cipher_key_length(SRTP_AES_128_ICM), 30);
+    CHECK_INT(srtp_cipher_key_length(SRTP_AES_256_ICM), 46);
+    CHECK_INT(srtp_cipher_key_length(SRTP_AES_128_GCM), 28);
+    CHECK_INT(srtp_cipher_key_length(SRTP_AES_256_GCM), 44);
+    CHECK_INT(srtp_cipher_key_length(-1), 0);
+    /* HMAC-SHA1-80 tag, GCM tag, nothing without SRTP */
+    CHECK_INT(srtp_cipher_overhead(SRTP_AES_256_ICM), 10);
+    CHECK_INT(srtp_cipher_overhead(SRTP_AES_128_GCM), 16);
+    CHECK_INT(srtp_cipher_overhead(SRTP_NONE), 0);
+}
+
+static void
+test_abs_capture_time (void)
+{
+    /* the Unix epoch, half a second later, and the smallest step a microsecond clock makes */
+    CHECK(unix_us_to_ntp(0) == NTP_UNIX_OFFSET << 32);
+    CHECK(unix_us_to_ntp(1500000) == (((NTP_UNIX_OFFSET + 1) << 32) | 0x80000000u));
+    CHECK((unix_us_to_ntp(1) & 0xffffffffu) == 4294);
+    /* the fraction never carries into the seconds */
+    CHECK(unix_us_to_ntp(999999) >> 32 == NTP_UNIX_OFFSET);
+}
+
+static void
+test_net_clock_ntp (void)
+{
+    /* 1 s and a quarter after 1900 on GStreamer's NTP clock */
+    CHECK(ntp_ns_to_ntp(1250000000) == ((UINT64_C(1) << 32) | 0x40000000u));
+    /* the same instant on the NTP clock and on a clock counting from 1970 */
+    CHECK(ntp_ns_to_ntp((NTP_UNIX_OFFSET + 5) * 1000000000 + 500000000) == unix_us_to_ntp(5500000));
+    /* the offset shown in statistics goes back to the same microsecond */
+    CHECK_INT(ntp_to_unix_us(unix_us_to_ntp(0)), 0);
+    CHECK_INT(ntp_to_unix_us(unix_us_to_ntp(1700000000123456)), 1700000000123456);
+    CHECK_INT(ntp_to_unix_us(unix_us_to_ntp(1700000000999999)), 1700000000999999);
+    CHECK_INT(ntp_to_unix_us(ntp_ns_to_ntp((NTP_UNIX_OFFSET + 1) * 1000000000)), 1000000);
+}
+
+static void
+test_path_mtu (void)
+{
+    /* routers report the next hop's MTU, nonsense and increases are ignored */
+    CHECK(pmtu_usable_report(1500, 1400));
+    CHECK(!pmtu_usable_report(1500, 1500));
+    CHECK(!pmtu_usable_report(1500, 9000));
+    CHECK(!pmtu_usable_report(1500, 68));
+    CHECK(pmtu_usable_report(1500, PMTU_MIN));
+
+    /* plain RTP on Ethernet, then with every addition: 1500 - 28 - 16 - 16 - 18 - 2 */
+    CHECK_INT(pmtu_rtp_mtu(1500, false, 0, false, false), 1472);
+    CHECK_INT(pmtu_rtp_mtu(1500, true, srtp_cipher_overhead(SRTP_AES_128_GCM), true, true), 1420);
+    /* a VPN's smaller MTU carries through */
+    CHECK_INT(pmtu_rtp_mtu(1400, true, srtp_cipher_overhead(SRTP_AES_128_ICM), false, false), 1346);
+
+    /* 2 Mbit/s at 30 fps is 8333 bytes a frame, 6 packets of 1472 */
+    CHECK_INT(pmtu_slices(2000000, 30, 1472), 6);
+    CHECK_INT(pmtu_slices(64000, 30, 1472), 1);
+    CHECK_INT(pmtu_slices(20000000, 30, 1472), MAX_SLICES);
+    CHECK_INT(pmtu_slices(2000000, 0, 1472), 0);
+}
+
+static void
+test_memory_budget (void)
+{
+    const int64_t frame = 1280 * 720 * 3 / 2;
+    /* 64 MB less the preview frame, two frames in queue_udp and 64 KB of audio, over four pools */
+    int64_t share = memory_pool_share(64 * 1024 * 1024, frame, 4);
+    unsigned reserve = MEMORY_POOL_SLACK + MEMORY_ENCODER_FRAMES;
+
+    CHECK_INT(share, (64 * 1024 * 1024 - 3 * frame - MEMORY_AUDIO_QUEUE_BYTES) / 4);
+    /* a budget below the fixed queues leaves the pools nothing */
+    CHECK_INT(memory_pool_share(4 * 1024 * 1024, frame, 4), 0);
+    CHECK_INT(memory_pool_share(64 * 1024 * 1024, frame, 0), 0);
+
+    /* 11 frames fit the share, the unlimited pool is lowered to them, a smaller max stays */
+    CHECK_INT(memory_pool_max(frame, 2, 0, reserve, share), 11);
+    CHECK_INT(memory_pool_max(frame, 2, 8, reserve, share), 8);
+    /* a small budget never takes a pool below what lets its element run: min, slack and the encoder's frames */
+    CHECK_INT(memory_pool_max(frame, 2, 0, reserve, frame), 2 + reserve);
+    CHECK_INT(memory_pool_max(frame, 2, 0, reserve, 0), 2 + reserve);
+    /* a queue of 3 frames after the pool adds to the reserve */
+    CHECK_INT(memory_pool_max(frame, 2, 0, reserve + memory_queue_items(3, 0, frame), 4 * frame), 2 + reserve + 3);
+    CHECK_INT(memory_pool_max(0, 0, 0, 0, share), 1);
+
+    /* queues limited by bytes hold one buffer more than fits */
+    CHECK_INT(memory_queue_items(0, 2 * frame, frame), 3);
+    CHECK_INT(memory_queue_items(5, 2 * frame, frame), 5);
+    CHECK_INT(memory_queue_items(0, 0, frame), 0);
+
+    /* spscqueue capacities round down to a power of two, within 1 and 4096 */
+    CHECK_INT(memory_spsc_capacity(2 * frame, frame), 2);
+    CHECK_INT(memory_spsc_capacity(3 * frame, frame), 2);
+    CHECK_INT(memory_spsc_capacity(frame / 2, frame), 1);
+    CHECK_INT(memory_spsc_capacity(MEMORY_AUDIO_QUEUE_BYTES, 1), 4096);
+}
+
+static void
+test_roi_clamp (void)
+{
+    struct Roi region;
+
+    /* no region is the whole capture */
+    roi_clamp(&(struct Roi) {0, 0, 0, 0}, 3840, 2160, &region);
+    CHECK_INT(region.width, 3840);
+    CHECK_INT(region.height, 2160);
+    CHECK_INT(region.left, 0);
+    CHECK_INT(region.top, 0);
+    /* a 720p window in the middle of 4K is taken as it is */
+    roi_clamp(&(struct Roi) {1280, 720, 1280, 720}, 3840, 2160, &region);
+    CHECK_INT(region.left, 1280);
+    CHECK_INT(region.top, 720);
+    CHECK_INT(region.width, 1280);
+    /* odd values go to even ones, a region past the edge is pushed back inside */
+    roi_clamp(&(struct Roi) {3001, 1999, 1281, 721}, 3840, 2160, &region);
+    CHECK_INT(region.width, 1280);
+    CHECK_INT(region.height, 720);
+    CHECK_INT(region.left, 3840 - 1280);
+    CHECK_INT(region.top, 2160 - 720);
+    roi_clamp(&(struct Roi) {-50, -1, 4, 99999}, 3840, 2160, &region);
+    CHECK_INT(region.width, 16);
+    CHECK_INT(region.height, 2160);
+    CHECK_INT(region.left, 0);
+    CHECK_INT(region.top, 0);
+    /* a capture smaller than the minimum region stays inside the frame */
+    roi_clamp(&(struct Roi) {0, 0, 8, 8}, 12, 12, &region);
+    CHECK_INT(region.width, 12);
+    CHECK_INT(region.left, 0);
+}
+
+static void
+test_pip_geometry (void)
+{
+    int inset_width, inset_height, xpos, ypos;
+
+    /* a quarter of 1280x720, 16 pixels from the top right corner */
+    pip_geometry(1280, 720, false, &inset_width, &inset_height, &xpos, &ypos);
+    CHECK_INT(inset_width, 320);
+    CHECK_INT(inset_height, 180);
+    CHECK_INT(xpos, 1280 - 320 - 16);
+    CHECK_INT(ypos, 16);
+    /* turned on its side the frame is 720 wide, the inset keeps its size */
+    pip_geometry(1280, 720, true, &inset_width, &inset_height, &xpos, &ypos);
+    CHECK_INT(inset_width, 320);
+    CHECK_INT(xpos, 720 - 320 - 16);
+    /* never left of the frame */
+    pip_geometry(64, 16, true, &inset_width, &inset_height, &xpos, &ypos);
+    CHECK_INT(xpos, 0);
+}
+
+static void
+test_planner_partition (void)
+{
+    /* scale, convert, encode, pay: the encoder dominates */
+    const uint64_t chain[] = {2, 3, 10, 1};
+    const uint64_t even[] = {5, 5, 5, 5};
+    const uint64_t flat[] = {100, 3};
+    unsigned starts[PLANNER_MAX_ELEMENTS + 1];
+    uint64_t bottleneck;
+
+    /* a single core keeps everything on queue_udp's thread */
+    CHECK_INT(planner_partition(chain, 4, 1, starts, &bottleneck), 1);
+    CHECK_INT(starts[0], 0);
+    CHECK_INT(starts[1], 4);
+    CHECK_INT(bottleneck, 16);
+
+    /* two spare cores: the encoder can't be split, so what goes before it gets its own stage */
+    CHECK_INT(planner_partition(chain, 4, 3, starts, &bottleneck), 2);
+    CHECK_INT(starts[1], 2);
+    CHECK_INT(bottleneck, 11);
+
+    /* enough cores for equal elements: one stage each */
+    CHECK_INT(planner_partition(even, 4, 8, starts, &bottleneck), 4);
+    for (unsigned s = 0; s <= 4; s++) {
+        CHECK_INT(starts[s], s);
+    }
+    CHECK_INT(bottleneck, 5);
+
+    /* a stage that shortens the slowest one by 3% isn't worth a thread */
+    CHECK_INT(planner_partition(flat, 2, 4, starts, &bottleneck), 1);
+    CHECK_INT(bottleneck, 103);
+
+    CHECK_INT(planner_partition(chain, 0, 4, starts, &bottleneck), 1);
+    CHECK_INT(starts[1], 0);
+}
+
+static void
+test_uep_classify (void)
+{
+    static const uint8_t h264_sps[] = {0x67, 0x42, 0x00};
+    static const uint8_t h264_idr[] = {0x65, 0x88, 0x80};
+    static const uint8_t h264_reference[] = {0x41, 0x9a, 0x00};
+    static const uint8_t h264_non_reference[] = {0x01, 0x9e, 0x00};
+    /* STAP-A with a PPS and an IDR slice */
+    static const uint8_t h264_stap[] = {0x78, 0x00, 0x02, 0x68, 0xce, 0x00, 0x02, 0x65, 0x88};
+    /* FU-A: indicator with nal_ref_idc 3, header with S set and the IDR type */
+    static const uint8_t h264_fu[] = {0x7c, 0x85, 0x88};
+    static const uint8_t h265_vps[] = {0x40, 0x01, 0x0c};
+    static const uint8_t h265_idr[] = {0x26, 0x01, 0xaf};
+    static const uint8_t h265_trail_n[] = {0x00, 0x01, 0xd0};
+    static const uint8_t h265_trail_r[] = {0x02, 0x01, 0xd0};
+    /* AP with an SPS and a TRAIL_R */
+    static const uint8_t h265_ap[] = {0x60, 0x01, 0x00, 0x02, 0x42, 0x01, 0x00, 0x02, 0x02, 0x01};
+    /* FU with the start of a CRA */
+    static const uint8_t h265_fu[] = {0x62, 0x01, 0x95};
+    /* S set, partition 0, then the payload header with the P bit */
+    static const uint8_t vp8_key[] = {0x10, 0x00, 0x9d};
+    static const uint8_t vp8_inter[] = {0x10, 0x01, 0x9d};
+    static const uint8_t vp8_non_reference[] = {0x30, 0x01, 0x9d};
+    /* X with a 15-bit picture ID before the payload header */
+    static const uint8_t vp8_extended_key[] = {0x90, 0x80, 0x81, 0x23, 0x00};
+    static const uint8_t vp8_continuation[] = {0x00, 0x01, 0x9d};
+    static const uint8_t vp9_key[] = {0x0a, 0x00, 0x00};
+    static const uint8_t vp9_inter[] = {0x48, 0x00, 0x00};
+    static const uint8_t vp9_middle[] = {0x40, 0x00, 0x00};
+    static const uint8_t av1_sequence[] = {0x18, 0x0a, 0x0b};
+    static const uint8_t av1_other[] = {0x10, 0x32, 0x00};
+
+    CHECK_INT(uep_classify(CODEC_H264, h264_sps, sizeof (h264_sps)), UEP_PARAMETER_SETS);
+    CHECK_INT(uep_classify(CODEC_H264, h264_idr, sizeof (h264_idr)), UEP_KEYFRAME);
+    CHECK_INT(uep_classify(CODEC_H264, h264_reference, sizeof (h264_reference)), UEP_REFERENCE);
+    CHECK_INT(uep_classify(CODEC_H264, h264_non_reference, sizeof (h264_non_reference)), UEP_NON_REFERENCE);
+    CHECK_INT(uep_classify(CODEC_H264, h264_stap, sizeof (h264_stap)), UEP_PARAMETER_SETS);
+    CHECK_INT(uep_classify(CODEC_H264, h264_fu, sizeof (h264_fu)), UEP_KEYFRAME);
+    /* too short to tell anything */
+    CHECK_INT(uep_classify(CODEC_H264, h264_sps, 2), -1);
+
+    CHECK_INT(uep_classify(CODEC_H265, h265_vps, sizeof (h265_vps)), UEP_PARAMETER_SETS);
+    CHECK_INT(uep_classify(CODEC_H265, h265_idr, sizeof (h265_idr)), UEP_KEYFRAME);
+    CHECK_INT(uep_classify(CODEC_H265, h265_trail_n, sizeof (h265_trail_n)), UEP_NON_REFERENCE);
+    CHECK_INT(uep_classify(CODEC_H265, h265_trail_r, sizeof (h265_trail_r)), UEP_REFERENCE);
+    CHECK_INT(uep_classify(CODEC_H265, h265_ap, sizeof (h265_ap)), UEP_PARAMETER_SETS);
+    CHECK_INT(uep_classify(CODEC_H265, h265_fu, sizeof (h265_fu)), UEP_KEYFRAME);
+
+    CHECK_INT(uep_classify(CODEC_VP8, vp8_key, sizeof (vp8_key)), UEP_KEYFRAME);
+    CHECK_INT(uep_classify(CODEC_VP8, vp8_inter, sizeof (vp8_inter)), UEP_REFERENCE);
+    CHECK_INT(uep_classify(CODEC_VP8, vp8_non_reference, sizeof (vp8_non_reference)), UEP_NON_REFERENCE);
+    CHECK_INT(uep_classify(CODEC_VP8, vp8_extended_key, sizeof (vp8_extended_key)), UEP_KEYFRAME);
+    CHECK_INT(uep_classify(CODEC_VP8, vp8_continuation, sizeof (vp8_continuation)), -1);
+
+    CHECK_INT(uep_classify(CODEC_VP9, vp9_key, sizeof (vp9_key)), UEP_KEYFRAME);
+    CHECK_INT(uep_classify(CODEC_VP9, vp9_inter, sizeof (vp9_inter)), UEP_REFERENCE);
+    CHECK_INT(uep_classify(CODEC_VP9, vp9_middle, sizeof (vp9_middle)), -1);
+
+    CHECK_INT(uep_classify(CODEC_AV1, av1_sequence, sizeof (av1_sequence)), UEP_KEYFRAME);
+    CHECK_INT(uep_classify(CODEC_AV1, av1_other, sizeof (av1_other)), -1);
+}
+
+static void
+test_frame_scheduler (void)
+{
+    /* access unit delimiter, SPS, PPS, IDR slice */
+    static const uint8_t h264_key[] = {0, 0, 0, 1, 0x09, 0x10, 0, 0, 0, 1, 0x67, 0x42, 0, 0, 1, 0x68, 0xce,
+                                       0, 0, 1, 0x65, 0x88};
+    static const uint8_t h264_non_reference[] = {0, 0, 0, 1, 0x09, 0x30, 0, 0, 1, 0x01, 0x9e, 0x00};
+    /* TRAIL_R in a three-byte start code */
+    static const uint8_t h265_reference[] = {0, 0, 1, 0x02, 0x01, 0xd0};
+    bool skipping = false;
+
+    CHECK_INT(uep_classify_bytestream(CODEC_H264, h264_key, sizeof (h264_key)), UEP_PARAMETER_SETS);
+    CHECK_INT(uep_classify_bytestream(CODEC_H264, h264_non_reference, sizeof (h264_non_reference)), UEP_NON_REFERENCE);
+    CHECK_INT(uep_classify_bytestream(CODEC_H265, h265_reference, sizeof (h265_reference)), UEP_REFERENCE);
+    CHECK_INT(uep_classify_bytestream(CODEC_H264, h264_key, 3), -1);
+
+    /* a short backlog sends everything */
+    CHECK_INT(scheduler_decide(UEP_NON_REFERENCE, SCHEDULER_NON_REFERENCE_BACKLOG, &skipping), SCHEDULER_SEND);
+    /* above the first threshold only non-reference frames go */
+    CHECK_INT(scheduler_decide(UEP_NON_REFERENCE, SCHEDULER_NON_REFERENCE_BACKLOG + 1, &skipping),
+              SCHEDULER_DROP_NON_REFERENCE);
+    CHECK_INT(scheduler_decide(UEP_REFERENCE, SCHEDULER_KEYFRAME_BACKLOG, &skipping), SCHEDULER_SEND);
+    CHECK(!skipping);
+    /* above the second everything up to the next keyframe, even once the backlog is gone */
+    CHECK_INT(scheduler_decide(UEP_REFERENCE, SCHEDULER_KEYFRAME_BACKLOG + 1, &skipping), SCHEDULER_DROP_SKIPPING);
+    CHECK(skipping);
+    CHECK_INT(scheduler_decide(UEP_REFERENCE, 0, &skipping), SCHEDULER_DROP_SKIPPING);
+    /* keyframes and parameter sets always go, and end the skipping */
+    CHECK_INT(scheduler_decide(UEP_PARAMETER_SETS, SCHEDULER_KEYFRAME_BACKLOG * 2, &skipping), SCHEDULER_SEND);
+    CHECK(!skipping);
+    skipping = true;
+    CHECK_INT(scheduler_decide(UEP_KEYFRAME, 0, &skipping), SCHEDULER_SEND);
+    CHECK(!skipping);
+    CHECK_INT(scheduler_decide(UEP_REFERENCE, 0, &skipping), SCHEDULER_SEND);
+}
+
+static void
+test_send_queue_control (void)
+{
+    int64_t clear_since = 0;
+    int64_t now = 10 * SENDQ_INCREASE_HOLD;
+
+    /* congested: 80% per step, spaced by the decrease hold */
+    CHECK_INT(sendq_next_bitrate(2000000, 2000000, SENDQ_CONGESTED_MS + 1, now, 0, &clear_since), 1600000);
+    CHECK_INT(sendq_next_bitrate(1600000, 2000000, SENDQ_CONGESTED_MS + 1, now, now - SENDQ_DECREASE_HOLD,
+                                 &clear_since), 1600000);
+    /* down to an eighth of the configured bitrate */
+    CHECK_INT(sendq_next_bitrate(260000, 2000000, SENDQ_CONGESTED_MS + 1, now, 0, &clear_since), 250000);
+    /* no overflow at high bitrates */
+    CHECK_INT(sendq_next_bitrate(50000000, 50000000, SENDQ_CONGESTED_MS + 1, now, 0, &clear_since), 40000000);
+
+    /* between the thresholds nothing changes */
+    CHECK_INT(sendq_next_bitrate(1000000, 2000000, SENDQ_CLEAR_MS, now, 0, &clear_since), 1000000);
+    CHECK_INT(clear_since, 0);
+
+    /* nearly empty: 5% of the configured bitrate once the queues stayed clear for the increase hold */
+    CHECK_INT(sendq_next_bitrate(1000000, 2000000, 0, now, 0, &clear_since), 1000000);
+    CHECK_INT(clear_since, now);
+    CHECK_INT(sendq_next_bitrate(1000000, 2000000, 0, now + SENDQ_INCREASE_HOLD, 0, &clear_since), 1000000);
+    CHECK_INT(sendq_next_bitrate(1000000, 2000000, 0, now + SENDQ_INCREASE_HOLD + 1, 0, &clear_since), 1100000);
+    /* never above the configured bitrate */
+    CHECK_INT(sendq_next_bitrate(1950000, 2000000, 0, now + SENDQ_INCREASE_HOLD + 1, 0, &clear_since), 2000000);
+    /* nor right after a change */
+    CHECK_INT(sendq_next_bitrate(1000000, 2000000, 0, now + SENDQ_INCREASE_HOLD + 1, now + SENDQ_INCREASE_HOLD,
+                                 &clear_since), 1000000);
+    /* congestion restarts the clear period */
+    sendq_next_bitrate(1000000, 2000000, SENDQ_CONGESTED_MS + 1, now, now, &clear_since);
+    CHECK_INT(clear_since, 0);
+
+    /* a kbit/s encoder rounding down took it, one holding the previous bitrate didn't */
+    CHECK(sendq_change_applied(1599000, 1600000, 1599500, 2000000));
+    CHECK(!sendq_change_applied(2000000, 1600000, 1600000, 2000000));
+    CHECK(!sendq_change_applied(1598000, 1600000, 1600000, 2000000));
+    /* a decrease also has to show in the output, an increase doesn't */
+    CHECK(sendq_change_applied(1600000, 2000000, 1600000, 2000000));
+    CHECK(!sendq_change_applied(1600000, 2000001, 1600000, 2000000));
+    CHECK(sendq_change_applied(2000000, 500000, 2000000, 1600000));
+}
+
+static void
+test_hybrid_decide (void)
+{
+    enum HybridMode mode;
+    int fec;
+
+    /* negligible loss: RTX while it makes the latency budget, else nothing */
+    hybrid_decide(50, 0.2, false, &mode, &fec);
+    CHECK_INT(mode, HYBRID_RTX);
+    CHECK_INT(fec, 0);
+    hybrid_decide(140, 0.2, false, &mode, &fec);
+    CHECK_INT(mode, HYBRID_NONE);
+    hybrid_decide(-1, 0.2, false, &mode, &fec);
+    CHECK_INT(mode, HYBRID_NONE);
+
+    /* scattered losses on a short round trip: RTX alone */
+    hybrid_decide(50, 4.0, false, &mode, &fec);
+    CHECK_INT(mode, HYBRID_RTX);
+    CHECK_INT(fec, 0);
+
+    /* bursts or heavier loss add FEC, bursts twice as much per lost percent */
+    hybrid_decide(50, 4.0, true, &mode, &fec);
+    CHECK_INT(mode, HYBRID_RTX_FEC);
+    CHECK_INT(fec, 12);
+    hybrid_decide(50, 6.0, false, &mode, &fec);
+    CHECK_INT(mode, HYBRID_RTX_FEC);
+    CHECK_INT(fec, 12);
+
+    /* a round trip beyond the budget leaves FEC only, within its bounds */
+    hybrid_decide(200, 1.0, false, &mode, &fec);
+    CHECK_INT(mode, HYBRID_FEC);
+    CHECK_INT(fec, HYBRID_FEC_MIN);
+    hybrid_decide(200, 30.0, true, &mode, &fec);
+    CHECK_INT(mode, HYBRID_FEC);
+    CHECK_INT(fec, HYBRID_FEC_MAX);
+}
+
+static void
+test_token_bucket (void)
+{
+    struct TokenBucket bucket;
+    /* 8 Mbit/s: a 20 ms bucket of 20000 bytes, 1 byte per µs */
+    int64_t rate = 1000000;
+
+    token_bucket_init(&bucket, rate, 0);
+    CHECK_INT(bucket.depth, 20000);
+    CHECK_INT(bucket.tokens, 20000);
+
+    /* a full bucket lets a burst through at once */
+    CHECK_INT(token_bucket_wait(&bucket, rate, 1500, 0), 0);
+    bucket.tokens -= 20000;
+    /* then a packet waits for its own tokens */
+    CHECK_INT(token_bucket_wait(&bucket, rate, 1500, 0), 1501);
+    CHECK_INT(token_bucket_wait(&bucket, rate, 1500, 1000), 501);
+    CHECK_INT(bucket.tokens, 1000);
+    CHECK_INT(token_bucket_wait(&bucket, rate, 1500, 1500), 0);
+    bucket.tokens -= 1500;
+
+    /* an idle receiver doesn't save up more than the bucket */
+    CHECK_INT(token_bucket_wait(&bucket, rate, 1500, 10000000), 0);
+    CHECK_INT(bucket.tokens, 20000);
+
+    /* a packet larger than the bucket only waits for a full one, and leaves it in debt */
+    CHECK_INT(token_bucket_wait(&bucket, rate, 30000, 10000000), 0);
+    bucket.tokens -= 30000;
+    CHECK_INT(token_bucket_wait(&bucket, rate, 100, 10000000), 10101);
+
+    /* slow rates still get a few full packets: 64 kbit/s is 8 bytes per ms */
+    token_bucket_init(&bucket, 8000, 0);
+    CHECK_INT(bucket.depth, FANOUT_MIN_BURST);
+    bucket.tokens = 0;
+    /* under a byte per call: the time adds up instead of being lost */
+    for (int64_t now = 100; now <= 1000; now += 100) {
+        token_bucket_wait(&bucket, 8000, 1500, now);
+    }
+    CHECK_INT(bucket.tokens, 8);
+}
+
+int
+main (void)
+{
+    test_encoder_bitrate_property();
+    test_vpx_encoder();
+    test_srtp_cipher();
+    test_abs_capture_time();
+    test_net_clock_ntp();
+    test_path_mtu();
+    test_memory_budget();
+    test_roi_clamp();
+    test_pip_geometry();
+    test_planner_partition();
+    test_uep_classify();
+    test_frame_scheduler();
+    test_send_queue_control();
+    test_hybrid_decide();
+    test_token_bucket();
+    return CHECK_RESULT("stream_logic");
+}